@@ -1,6 +1,121 @@
+#include <algorithm>
+
 #include "vast/bitmap.hpp"
 
 namespace vast {
+namespace {
+
+// The estimated space of a bitmap in various representations, in bytes.
+struct space_estimate {
+  uint64_t ewah = 0;
+  uint64_t null = 0;
+  uint64_t roaring = 0;
+};
+
+// Estimates the space of a bitmap in a single pass over its blocks.
+space_estimate estimate_space(bitmap const& bm) {
+  using word_type = bitmap::word_type;
+  using block_type = bitmap::block_type;
+  using container_type = roaring_bitmap::container_type;
+  constexpr uint64_t block_bytes = sizeof(block_type);
+  constexpr uint64_t container_bytes = 16; // Approximate overhead.
+  constexpr uint64_t container_blocks = container_type::num_blocks;
+  space_estimate result;
+  // The EWAH state: -1 initially, 0 or 1 within a clean run, 2 after a
+  // dirty block. Every clean run and a leading dirty block need a marker.
+  auto ewah_state = -1;
+  // The roaring state: the current container and its statistics.
+  auto container = uint64_t{0};
+  auto ones = uint64_t{0};
+  auto runs = uint64_t{0};
+  auto last_bit = false;
+  auto position = uint64_t{0}; // In blocks.
+  auto finish_container = [&] {
+    if (ones == 0)
+      return;
+    auto bytes = std::min(container_blocks * block_bytes, 4 * runs);
+    if (ones <= container_type::max_array_size)
+      bytes = std::min(bytes, 2 * ones);
+    result.roaring += container_bytes + bytes;
+    ones = runs = 0;
+  };
+  // Accounts for n consecutive blocks of value x, which must be homogeneous
+  // if n > 1.
+  auto add = [&](block_type x, uint64_t n) {
+    result.null += n * block_bytes;
+    if (word_type::all_or_none(x)) {
+      auto bit = x != word_type::none ? 1 : 0;
+      if (ewah_state != bit)
+        result.ewah += block_bytes;
+      ewah_state = bit;
+    } else {
+      if (ewah_state == -1)
+        result.ewah += block_bytes;
+      result.ewah += n * block_bytes;
+      ewah_state = 2;
+    }
+    if (x == word_type::none) {
+      position += n;
+      last_bit = false;
+      return;
+    }
+    auto msb = [](block_type y) { return y >> (word_type::width - 1); };
+    while (n > 0) {
+      if (position / container_blocks != container) {
+        finish_container();
+        container = position / container_blocks;
+        last_bit = false;
+      }
+      auto k = std::min(n, container_blocks - position % container_blocks);
+      ones += k * word_type::popcount(x);
+      runs += word_type::popcount(x & ~((x << 1) | (last_bit ? 1 : 0)));
+      runs += (k - 1) * word_type::popcount(x & ~((x << 1) | msb(x)));
+      last_bit = msb(x) != 0;
+      position += k;
+      n -= k;
+    }
+  };
+  // Assembles the sequences of the bitmap into blocks.
+  auto block = block_type{0};
+  auto bits = uint64_t{0};
+  auto push = [&](block_type x, uint64_t n) {
+    block |= x << bits;
+    if (bits + n < word_type::width) {
+      bits += n;
+      return;
+    }
+    add(block, 1);
+    auto used = word_type::width - bits;
+    block = used < word_type::width ? x >> used : 0;
+    bits = bits + n - word_type::width;
+  };
+  for (auto b : bit_range(bm)) {
+    auto n = b.size();
+    if (n <= word_type::width) {
+      push(n < word_type::width ? b.data() & word_type::lsb_mask(n) : b.data(),
+           n);
+      continue;
+    }
+    auto x = b.data() != word_type::none ? word_type::all : word_type::none;
+    if (bits > 0) {
+      auto k = word_type::width - bits;
+      push(x & word_type::lsb_mask(k), k);
+      n -= k;
+    }
+    if (n >= word_type::width) {
+      add(x, n / word_type::width);
+      n %= word_type::width;
+    }
+    if (n > 0)
+      push(x & word_type::lsb_mask(n), n);
+  }
+  if (bits > 0)
+    add(block, 1);
+  finish_container();
+  return result;
+}
+
+} // namespace <anonymous>
 
 bitmap::bitmap() : bitmap_{default_bitmap{}} {
 }
@@ -33,8 +148,68 @@ void bitmap::flip() {
   visit([](auto& bm) { bm.flip(); }, bitmap_);
 }
 
+void bitmap::optimize() {
+  if (empty())
+    return;
+  auto convert = [&](auto x) {
+    using bitmap_type = decltype(x);
+    if (get_if<bitmap_type>(bitmap_))
+      return;
+    x.append(*this);
+    bitmap_ = std::move(x);
+  };
+  auto space = estimate_space(*this);
+  if (space.null <= space.ewah)
+    convert(null_bitmap{});
+  else if (2 * space.roaring <= space.ewah)
+    convert(roaring_bitmap{});
+  else
+    convert(ewah_bitmap{});
+}
+
+void bitmap::build_skip_index() {
+  if (auto bm = get_if<ewah_bitmap>(bitmap_))
+    bm->build_skip_index();
+}
+
 bool operator==(bitmap const& x, bitmap const& y) {
-  return x.bitmap_ == y.bitmap_;
+  if (x.bitmap_.index() == y.bitmap_.index())
+    return x.bitmap_ == y.bitmap_;
+  // Since bitmap::optimize chooses the representation per bitmap, we compare
+  // different representations bit by bit.
+  using word_type = bitmap::word_type;
+  if (x.size() != y.size())
+    return false;
+  auto value = [](auto& bits, bitmap::size_type offset) {
+    return bits.size() > word_type::width ? bits.data() : bits.data() >> offset;
+  };
+  auto xs = bit_range(x);
+  auto ys = bit_range(y);
+  auto x_offset = bitmap::size_type{0};
+  auto y_offset = bitmap::size_type{0};
+  while (!xs.done() && !ys.done()) {
+    auto& xb = xs.get();
+    auto& yb = ys.get();
+    auto n = std::min(xb.size() - x_offset, yb.size() - y_offset);
+    if (xb.size() <= word_type::width || yb.size() <= word_type::width)
+      n = std::min(n, word_type::width);
+    auto diff = value(xb, x_offset) ^ value(yb, y_offset);
+    if (n < word_type::width)
+      diff &= word_type::lsb_mask(n);
+    if (diff != word_type::none)
+      return false;
+    x_offset += n;
+    if (x_offset == xb.size()) {
+      xs.next();
+      x_offset = 0;
+    }
+    y_offset += n;
+    if (y_offset == yb.size()) {
+      ys.next();
+      y_offset = 0;
+    }
+  }
+  return true;
 }
 
 bitmap_bit_range::bitmap_bit_range(bitmap const& bm) {
@@ -63,4 +238,15 @@ bitmap_bit_range bit_range(bitmap const& bm) {
   return bitmap_bit_range{bm};
 }
 
+bitmap::size_type seek(bitmap_bit_range& rng, bitmap::size_type n,
+                       bitmap::size_type i) {
+  auto visitor = [&](auto& r) {
+    n = seek(r, n, i);
+    if (!r.done())
+      rng.bits_ = r.get();
+  };
+  visit(visitor, rng.range_);
+  return n;
+}
+
 } // namespace vast
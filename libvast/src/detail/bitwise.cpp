@@ -0,0 +1,181 @@
+#include "vast/config.hpp"
+
+#include "vast/detail/bitwise.hpp"
+
+#if (defined(VAST_GCC) || defined(VAST_CLANG)) && defined(__x86_64__)
+#  define VAST_BITWISE_X86
+#  include <immintrin.h>
+#endif
+
+namespace vast {
+namespace detail {
+
+namespace {
+
+using binary_kernel = void (*)(uint64_t const*, uint64_t const*, uint64_t*,
+                               size_t);
+
+using unary_kernel = void (*)(uint64_t const*, uint64_t*, size_t);
+
+// The kernels of one instruction set, indexed by bitwise_operator.
+struct kernel_table {
+  const char* name;
+  binary_kernel binary[5];
+  unary_kernel unary;
+};
+
+template <bitwise_operator Op>
+void scalar_binary(uint64_t const* x, uint64_t const* y, uint64_t* out,
+                   size_t n) {
+  for (size_t i = 0; i < n; ++i)
+    out[i] = apply(Op, x[i], y[i]);
+}
+
+void scalar_unary(uint64_t const* x, uint64_t* out, size_t n) {
+  for (size_t i = 0; i < n; ++i)
+    out[i] = ~x[i];
+}
+
+#ifdef VAST_BITWISE_X86
+
+// The x86 kernels process as many blocks as fit into a vector register per
+// iteration and hand the remainder to the scalar kernel. We compile them with
+// function-level target attributes so that the rest of the library stays
+// free of instructions the CPU may not support.
+
+template <bitwise_operator Op>
+__attribute__((target("sse2")))
+void sse2_binary(uint64_t const* x, uint64_t const* y, uint64_t* out,
+                 size_t n) {
+  auto ones = _mm_set1_epi64x(-1);
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    auto a = _mm_loadu_si128(reinterpret_cast<__m128i const*>(x + i));
+    auto b = _mm_loadu_si128(reinterpret_cast<__m128i const*>(y + i));
+    switch (Op) {
+      case bitwise_operator::bitwise_and:
+        a = _mm_and_si128(a, b);
+        break;
+      case bitwise_operator::bitwise_or:
+        a = _mm_or_si128(a, b);
+        break;
+      case bitwise_operator::bitwise_xor:
+        a = _mm_xor_si128(a, b);
+        break;
+      case bitwise_operator::bitwise_nand:
+        a = _mm_andnot_si128(b, a);
+        break;
+      case bitwise_operator::bitwise_nor:
+        a = _mm_or_si128(a, _mm_xor_si128(b, ones));
+        break;
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), a);
+  }
+  scalar_binary<Op>(x + i, y + i, out + i, n - i);
+}
+
+__attribute__((target("sse2")))
+void sse2_unary(uint64_t const* x, uint64_t* out, size_t n) {
+  auto ones = _mm_set1_epi64x(-1);
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    auto a = _mm_loadu_si128(reinterpret_cast<__m128i const*>(x + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                     _mm_xor_si128(a, ones));
+  }
+  scalar_unary(x + i, out + i, n - i);
+}
+
+template <bitwise_operator Op>
+__attribute__((target("avx2")))
+void avx2_binary(uint64_t const* x, uint64_t const* y, uint64_t* out,
+                 size_t n) {
+  auto ones = _mm256_set1_epi64x(-1);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    auto a = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(x + i));
+    auto b = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(y + i));
+    switch (Op) {
+      case bitwise_operator::bitwise_and:
+        a = _mm256_and_si256(a, b);
+        break;
+      case bitwise_operator::bitwise_or:
+        a = _mm256_or_si256(a, b);
+        break;
+      case bitwise_operator::bitwise_xor:
+        a = _mm256_xor_si256(a, b);
+        break;
+      case bitwise_operator::bitwise_nand:
+        a = _mm256_andnot_si256(b, a);
+        break;
+      case bitwise_operator::bitwise_nor:
+        a = _mm256_or_si256(a, _mm256_xor_si256(b, ones));
+        break;
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), a);
+  }
+  scalar_binary<Op>(x + i, y + i, out + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void avx2_unary(uint64_t const* x, uint64_t* out, size_t n) {
+  auto ones = _mm256_set1_epi64x(-1);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    auto a = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(x + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i),
+                        _mm256_xor_si256(a, ones));
+  }
+  scalar_unary(x + i, out + i, n - i);
+}
+
+#endif // VAST_BITWISE_X86
+
+#define VAST_BITWISE_KERNELS(isa)                                           \
+  kernel_table {                                                            \
+    #isa,                                                                   \
+    {                                                                       \
+      isa##_binary<bitwise_operator::bitwise_and>,                          \
+      isa##_binary<bitwise_operator::bitwise_or>,                           \
+      isa##_binary<bitwise_operator::bitwise_xor>,                          \
+      isa##_binary<bitwise_operator::bitwise_nand>,                         \
+      isa##_binary<bitwise_operator::bitwise_nor>                           \
+    },                                                                      \
+    isa##_unary                                                             \
+  }
+
+kernel_table select_kernels() {
+#ifdef VAST_BITWISE_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return VAST_BITWISE_KERNELS(avx2);
+  if (__builtin_cpu_supports("sse2"))
+    return VAST_BITWISE_KERNELS(sse2);
+#endif
+  return VAST_BITWISE_KERNELS(scalar);
+}
+
+#undef VAST_BITWISE_KERNELS
+
+kernel_table const& kernels() {
+  static auto const table = select_kernels();
+  return table;
+}
+
+} // namespace <anonymous>
+
+void bitwise_blocks(bitwise_operator op, uint64_t const* x, uint64_t const* y,
+                    uint64_t* out, size_t n) {
+  kernels().binary[static_cast<size_t>(op)](x, y, out, n);
+}
+
+void complement_blocks(uint64_t const* x, uint64_t* out, size_t n) {
+  kernels().unary(x, out, n);
+}
+
+const char* bitwise_kernel() {
+  return kernels().name;
+}
+
+} // namespace detail
+} // namespace vast
@@ -32,7 +32,7 @@ mmapbuf::mmapbuf(const std::string& filename, size_t size)
 }
 
 mmapbuf::~mmapbuf() {
-  if (!map_)
+  if (map_)
     ::munmap(map_, size_);
   if (fd_ != -1)
     ::close(fd_);
@@ -42,6 +42,10 @@ size_t mmapbuf::size() const {
   return size_;
 }
 
+const mmapbuf::char_type* mmapbuf::data() const {
+  return map_;
+}
+
 std::streamsize mmapbuf::showmanyc() {
   VAST_ASSERT(map_);
   return egptr() - gptr();
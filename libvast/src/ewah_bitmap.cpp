@@ -1,7 +1,117 @@
+#include <algorithm>
+#include <cstring>
+
 #include "vast/ewah_bitmap.hpp"
 
 namespace vast {
 
+ewah_skip_index::ewah_skip_index(ewah_bitmap_view bm, size_t interval) {
+  VAST_ASSERT(interval > 0);
+  using word_type = ewah_bitmap::word_type;
+  auto blocks = bm.data();
+  auto num_blocks = bm.num_blocks();
+  auto position = size_type{0};
+  auto last_sample = size_t{0};
+  auto sample = [&](size_t i, size_t num_dirty) {
+    if (i - last_sample >= interval) {
+      entries_.push_back({i, num_dirty, position, count_});
+      last_sample = i;
+    }
+  };
+  // Walk the bitmap in the same way as ewah_bitmap_range, but block by block,
+  // so that each entry denotes a state from which the range can resume.
+  auto i = size_t{0};
+  while (i + 1 < num_blocks) {
+    auto marker = blocks[i];
+    sample(i, 0);
+    auto num_clean = word_type::marker_num_clean(marker);
+    auto num_dirty = word_type::marker_num_dirty(marker);
+    position += num_clean * word_type::width;
+    if (word_type::marker_type(marker))
+      count_ += num_clean * word_type::width;
+    for (++i; num_dirty > 0 && i + 1 < num_blocks; --num_dirty, ++i) {
+      sample(i, num_dirty);
+      position += word_type::width;
+      count_ += word_type::popcount(blocks[i]);
+    }
+  }
+  if (num_blocks > 0) {
+    auto partial = bm.size() % word_type::width;
+    auto last = blocks[num_blocks - 1];
+    if (partial > 0)
+      last &= word_type::lsb_fill(partial);
+    count_ += word_type::popcount(last);
+  }
+}
+
+ewah_skip_index::size_type ewah_skip_index::count() const {
+  return count_;
+}
+
+ewah_skip_index::entry const*
+ewah_skip_index::find_position(size_type i) const {
+  auto pred = [](size_type x, entry const& e) { return x < e.position; };
+  auto j = std::upper_bound(entries_.begin(), entries_.end(), i, pred);
+  return j == entries_.begin() ? nullptr : &*(j - 1);
+}
+
+ewah_skip_index::entry const*
+ewah_skip_index::find_rank(size_type i, bool bit) const {
+  VAST_ASSERT(i > 0);
+  auto pred = [=](size_type x, entry const& e) {
+    return x <= (bit ? e.rank : e.position - e.rank);
+  };
+  auto j = std::upper_bound(entries_.begin(), entries_.end(), i - 1, pred);
+  return j == entries_.begin() ? nullptr : &*(j - 1);
+}
+
+ewah_skip_index::size_type
+ewah_skip_index::rank(ewah_bitmap_view bm, size_type i) {
+  VAST_ASSERT(i < bm.size());
+  auto rng = ewah_bitmap_range{bm};
+  auto n = size_type{0};
+  auto result = size_type{0};
+  auto idx = bm.skip_index();
+  if (auto e = idx ? idx->find_position(i) : nullptr) {
+    rng.resume(*e);
+    n = e->position;
+    result = e->rank;
+  }
+  for (; !rng.done(); rng.next()) {
+    auto& b = rng.get();
+    if (i < n + b.size())
+      return result + vast::rank<1>(b, i - n);
+    result += vast::rank<1>(b);
+    n += b.size();
+  }
+  return result;
+}
+
+ewah_skip_index::size_type
+ewah_skip_index::select(ewah_bitmap_view bm, size_type i, bool bit) {
+  VAST_ASSERT(i > 0);
+  auto rng = ewah_bitmap_range{bm};
+  auto n = size_type{0};
+  auto rnk = size_type{0};
+  auto idx = bm.skip_index();
+  if (auto e = idx ? idx->find_rank(i, bit) : nullptr) {
+    rng.resume(*e);
+    n = e->position;
+    rnk = bit ? e->rank : e->position - e->rank;
+  }
+  for (; !rng.done(); rng.next()) {
+    auto& b = rng.get();
+    auto ones = vast::rank<1>(b);
+    auto count = bit ? ones : b.size() - ones;
+    if (rnk + count >= i)
+      return n + (bit ? vast::select<1>(b, i - rnk)
+                      : vast::select<0>(b, i - rnk));
+    rnk += count;
+    n += b.size();
+  }
+  return ewah_bitmap::word_type::npos;
+}
+
 ewah_bitmap::ewah_bitmap(size_type n, bool bit) {
   append_bits(bit, n);
 }
@@ -19,6 +129,7 @@ ewah_bitmap::block_vector const& ewah_bitmap::blocks() const {
 }
 
 void ewah_bitmap::append_bit(bool bit) {
+  skip_index_.reset();
   auto partial = num_bits_ % word_type::width;
   if (blocks_.empty()) {
     blocks_.push_back(0); // Always begin with an empty marker.
@@ -34,6 +145,7 @@ void ewah_bitmap::append_bit(bool bit) {
 }
 
 void ewah_bitmap::append_bits(bool bit, size_type n) {
+  skip_index_.reset();
   if (n == 0)
     return;
   if (blocks_.empty()) {
@@ -108,6 +220,7 @@ void ewah_bitmap::append_bits(bool bit, size_type n) {
 }
 
 void ewah_bitmap::append_block(block_type value, size_type bits) {
+  skip_index_.reset();
   VAST_ASSERT(bits > 0);
   VAST_ASSERT(bits <= word_type::width);
   if (blocks_.empty())
@@ -135,7 +248,33 @@ void ewah_bitmap::append_block(block_type value, size_type bits) {
   }
 }
 
+void ewah_bitmap::append_blocks(block_type const* xs, size_type n) {
+  skip_index_.reset();
+  if (n == 0)
+    return;
+  if (num_bits_ % word_type::width != 0) {
+    for (auto i = 0u; i < n; ++i)
+      append_block(xs[i]);
+    return;
+  }
+  // At a block boundary, each block becomes the new last dirty block after
+  // we have integrated its predecessor.
+  blocks_.reserve(blocks_.size() + n + (blocks_.empty() ? 1 : 0));
+  if (blocks_.empty())
+    blocks_.push_back(0); // Always begin with an empty marker.
+  else
+    integrate_last_block();
+  blocks_.push_back(xs[0]);
+  num_bits_ += word_type::width;
+  for (auto i = 1u; i < n; ++i) {
+    integrate_last_block();
+    blocks_.push_back(xs[i]);
+    num_bits_ += word_type::width;
+  }
+}
+
 void ewah_bitmap::flip() {
+  skip_index_.reset();
   if (blocks_.empty())
     return;
   VAST_ASSERT(blocks_.size() >= 2);
@@ -152,7 +291,7 @@ void ewah_bitmap::flip() {
   }
   // Only flip the active bits in the last block.
   auto partial = num_bits_ % word_type::width;
-  blocks_.back() ^= word_type::lsb_mask(partial);
+  blocks_.back() ^= partial == 0 ? word_type::all : word_type::lsb_mask(partial);
 }
 
 void ewah_bitmap::integrate_last_block() {
@@ -214,34 +353,125 @@ void ewah_bitmap::bump_dirty_count() {
   }
 }
 
+void ewah_bitmap::build_skip_index(size_t interval) {
+  skip_index_ = std::make_shared<ewah_skip_index>(*this, interval);
+}
+
+ewah_skip_index const* ewah_bitmap::skip_index() const {
+  return skip_index_.get();
+}
+
 bool operator==(ewah_bitmap const& x, ewah_bitmap const& y) {
   // If the block vector and the number of bits are equal, so must be the
   // marker by construction.
   return x.blocks_ == y.blocks_ && x.num_bits_ == y.num_bits_;
 }
 
-ewah_bitmap_range::ewah_bitmap_range(ewah_bitmap const& bm)
-  : bm_{&bm} {
-  if (!bm_->empty())
+ewah_bitmap_view::ewah_bitmap_view(ewah_bitmap const& bm)
+  : blocks_{bm.blocks().data()},
+    num_blocks_{bm.blocks().size()},
+    num_bits_{bm.size()},
+    skip_index_{bm.skip_index()} {
+}
+
+ewah_bitmap_view::ewah_bitmap_view(block_type const* blocks,
+                                   size_t num_blocks, size_type num_bits)
+  : blocks_{blocks},
+    num_blocks_{num_blocks},
+    num_bits_{num_bits} {
+}
+
+bool ewah_bitmap_view::empty() const {
+  return num_bits_ == 0;
+}
+
+ewah_bitmap_view::size_type ewah_bitmap_view::size() const {
+  return num_bits_;
+}
+
+ewah_bitmap_view::block_type const* ewah_bitmap_view::data() const {
+  return blocks_;
+}
+
+size_t ewah_bitmap_view::num_blocks() const {
+  return num_blocks_;
+}
+
+ewah_skip_index const* ewah_bitmap_view::skip_index() const {
+  return skip_index_;
+}
+
+void save_flat(std::vector<char>& buf, ewah_bitmap_view bm) {
+  using block_type = ewah_bitmap_view::block_type;
+  uint64_t header[2] = {bm.size(), bm.num_blocks()};
+  auto bytes = bm.num_blocks() * sizeof(block_type);
+  auto offset = buf.size();
+  buf.resize(offset + sizeof(header) + bytes);
+  std::memcpy(buf.data() + offset, header, sizeof(header));
+  if (bytes > 0)
+    std::memcpy(buf.data() + offset + sizeof(header), bm.data(), bytes);
+}
+
+expected<ewah_bitmap_view> make_ewah_bitmap_view(char const* data,
+                                                 size_t size) {
+  using block_type = ewah_bitmap_view::block_type;
+  using word_type = ewah_bitmap_view::word_type;
+  if (reinterpret_cast<uintptr_t>(data) % alignof(block_type) != 0)
+    return make_error(ec::format_error, "misaligned EWAH bitmap");
+  if (size < 2 * sizeof(uint64_t))
+    return make_error(ec::end_of_input, "incomplete EWAH bitmap header");
+  auto header = reinterpret_cast<uint64_t const*>(data);
+  auto num_bits = header[0];
+  auto num_blocks = header[1];
+  auto blocks = reinterpret_cast<block_type const*>(header + 2);
+  if (num_blocks > (size - 2 * sizeof(uint64_t)) / sizeof(block_type))
+    return make_error(ec::end_of_input, "incomplete EWAH bitmap blocks");
+  if (num_blocks == 0) {
+    if (num_bits > 0)
+      return make_error(ec::format_error, "EWAH bitmap without blocks");
+    return ewah_bitmap_view{blocks, 0, 0};
+  }
+  // Walk the markers to ensure that ranges never read past the last block:
+  // the dirty blocks of each marker precede the last block, which is dirty,
+  // and the encoded blocks account for exactly the given number of bits.
+  auto bits = uint64_t{0};
+  auto i = uint64_t{0};
+  while (i + 1 < num_blocks) {
+    auto marker = blocks[i];
+    auto num_dirty = word_type::marker_num_dirty(marker);
+    if (num_dirty > num_blocks - i - 2)
+      return make_error(ec::format_error, "invalid EWAH dirty block count");
+    bits += (word_type::marker_num_clean(marker) + num_dirty)
+            * word_type::width;
+    i += num_dirty + 1;
+  }
+  if (num_blocks < 2 || num_bits <= bits
+      || num_bits - bits > word_type::width)
+    return make_error(ec::format_error, "invalid EWAH bitmap size");
+  return ewah_bitmap_view{blocks, num_blocks, num_bits};
+}
+
+ewah_bitmap_range::ewah_bitmap_range(ewah_bitmap_view bm) : bm_{bm} {
+  if (!bm_.empty())
     scan();
 }
 
 bool ewah_bitmap_range::done() const {
-  return next_ == bm_->blocks().size();
+  return next_ == bm_.num_blocks();
 }
 
 void ewah_bitmap_range::next() {
   VAST_ASSERT(!done());
-  if (++next_ != bm_->blocks().size())
+  if (++next_ != bm_.num_blocks())
     scan();
 }
 
 void ewah_bitmap_range::scan() {
-  VAST_ASSERT(next_ < bm_->blocks().size());
-  auto block = bm_->blocks()[next_];
-  if (next_ + 1 == bm_->blocks().size()) {
+  VAST_ASSERT(next_ < bm_.num_blocks());
+  auto block = bm_.data()[next_];
+  if (next_ + 1 == bm_.num_blocks()) {
     // The ast block; always dirty.
-    auto partial = bm_->size() % word_type::width;
+    auto partial = bm_.size() % word_type::width;
     bits_ = {block, partial == 0 ? word_type::width : partial};
   } else if (num_dirty_ > 0) {
     // An intermediate dirty block.
@@ -262,8 +492,8 @@ void ewah_bitmap_range::scan() {
       // If no dirty blocks follow this marker and we have not reached the
       // final dirty block yet, we know that the next block must be a marker as
       // well and check whether we can incorporate it into this sequence.
-      while (num_dirty_ == 0 && next_ + 2 < bm_->blocks().size()) {
-        auto next_marker = bm_->blocks()[next_ + 1];
+      while (num_dirty_ == 0 && next_ + 2 < bm_.num_blocks()) {
+        auto next_marker = bm_.data()[next_ + 1];
         auto next_type = word_type::marker_type(next_marker);
         if ((next_type && !data) || (!next_type && data))
           break; // not compatible with current run
@@ -276,8 +506,88 @@ void ewah_bitmap_range::scan() {
   }
 }
 
+void ewah_bitmap_range::resume(ewah_skip_index::entry const& e) {
+  next_ = e.block;
+  num_dirty_ = e.num_dirty;
+  scan();
+}
+
 ewah_bitmap_range bit_range(ewah_bitmap const& bm) {
   return ewah_bitmap_range{bm};
 }
 
+ewah_bitmap_range bit_range(ewah_bitmap_view const& bm) {
+  return ewah_bitmap_range{bm};
+}
+
+ewah_bitmap::size_type seek(ewah_bitmap_range& rng, ewah_bitmap::size_type n,
+                            ewah_bitmap::size_type i) {
+  if (!rng.done())
+    if (auto idx = rng.bm_.skip_index())
+      if (auto e = idx->find_position(i))
+        if (e->position > n) {
+          rng.resume(*e);
+          n = e->position;
+        }
+  return seek<ewah_bitmap_range, ewah_bitmap::size_type>(rng, n, i);
+}
+
+ewah_bitmap_word_range::ewah_bitmap_word_range(ewah_bitmap_view bm)
+  : bm_{bm},
+    done_{bm.empty()} {
+  if (!done_)
+    scan();
+}
+
+bool ewah_bitmap_word_range::done() const {
+  return done_;
+}
+
+void ewah_bitmap_word_range::next() {
+  VAST_ASSERT(!done());
+  if (next_ == bm_.num_blocks())
+    done_ = true;
+  else
+    scan();
+}
+
+void ewah_bitmap_word_range::scan() {
+  auto blocks = bm_.data();
+  auto num_blocks = bm_.num_blocks();
+  VAST_ASSERT(next_ < num_blocks);
+  while (num_dirty_ == 0 && next_ + 1 < num_blocks) {
+    // A marker. We skip those without clean words.
+    auto marker = blocks[next_++];
+    num_dirty_ = word_type::marker_num_dirty(marker);
+    auto num_clean = word_type::marker_num_clean(marker);
+    if (num_clean > 0) {
+      auto data = word_type::marker_type(marker) ? word_type::all
+                                                 : word_type::none;
+      words_ = {data, num_clean * word_type::width};
+      return;
+    }
+  }
+  // The dirty words of the current marker. The last block is always dirty and
+  // directly follows the dirty words of the last marker, without being
+  // accounted for in the marker.
+  auto n = num_dirty_;
+  auto bits = n * word_type::width;
+  if (next_ + n + 1 == num_blocks) {
+    auto partial = bm_.size() % word_type::width;
+    bits += partial == 0 ? word_type::width : partial;
+    ++n;
+  }
+  words_ = {blocks + next_, bits};
+  next_ += n;
+  num_dirty_ = 0;
+}
+
+ewah_bitmap_word_range word_range(ewah_bitmap const& bm) {
+  return ewah_bitmap_word_range{bm};
+}
+
+ewah_bitmap_word_range word_range(ewah_bitmap_view const& bm) {
+  return ewah_bitmap_word_range{bm};
+}
+
 } // namespace vast
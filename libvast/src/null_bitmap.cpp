@@ -26,6 +26,10 @@ void null_bitmap::append_block(block_type value, size_type bits) {
   bitvector_.append_block(value, bits);
 }
 
+void null_bitmap::append_blocks(block_type const* xs, size_type n) {
+  bitvector_.append_blocks(xs, xs + n);
+}
+
 void null_bitmap::flip() {
   bitvector_.flip();
 }
@@ -70,7 +74,7 @@ void null_bitmap_range::scan() {
     if (block_ == last) {
       auto partial = bitvector_->size() % word_type::width;
       if (partial > 0) {
-        auto mask = word_type::mask(partial);
+        auto mask = word_type::lsb_mask(partial);
         if ((*block_ & mask) == (data & mask)) {
           n += partial;
           ++block_;
@@ -89,4 +93,22 @@ null_bitmap_range bit_range(null_bitmap const& bm) {
   return null_bitmap_range{bm};
 }
 
+null_bitmap_word_range::null_bitmap_word_range(null_bitmap const& bm)
+  : done_{bm.empty()} {
+  if (!done_)
+    words_ = {bm.bitvector_.blocks().data(), bm.size()};
+}
+
+void null_bitmap_word_range::next() {
+  done_ = true;
+}
+
+bool null_bitmap_word_range::done() const {
+  return done_;
+}
+
+null_bitmap_word_range word_range(null_bitmap const& bm) {
+  return null_bitmap_word_range{bm};
+}
+
 } // namespace vast
@@ -0,0 +1,160 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include "vast/detail/assert.hpp"
+#include "vast/detail/mmapbuf.hpp"
+#include "vast/packfile.hpp"
+#include "vast/save.hpp"
+
+namespace vast {
+
+namespace {
+
+// The fixed-size header preceding the TOC: magic, version, and data offset.
+constexpr size_t header_size = 4 + 4 + 8;
+
+size_t align(size_t n) {
+  return (n + packfile::alignment - 1) & ~(packfile::alignment - 1);
+}
+
+} // namespace <anonymous>
+
+constexpr uint32_t packfile::magic;
+constexpr uint32_t packfile::version;
+constexpr size_t packfile::alignment;
+
+void packfile::writer::add(path name, path filename) {
+  files_.emplace_back(std::move(name), std::move(filename));
+}
+
+expected<void> packfile::writer::write(path const& filename) {
+  std::sort(files_.begin(), files_.end(),
+            [](auto& x, auto& y) { return x.first.str() < y.first.str(); });
+  // Compute the layout of the data section.
+  toc_type toc;
+  toc.reserve(files_.size());
+  uint64_t offset = 0;
+  for (auto& x : files_) {
+    std::ifstream in{x.second.str(), std::ios::binary | std::ios::ate};
+    if (!in)
+      return make_error(ec::filesystem_error, "failed to open file",
+                        x.second);
+    auto size = static_cast<uint64_t>(in.tellg());
+    toc.emplace_back(x.first.str(), entry{offset, size});
+    offset = align(offset + size);
+  }
+  std::vector<char> buf;
+  auto result = save(buf, toc);
+  if (!result)
+    return result;
+  uint64_t data_offset = align(header_size + buf.size());
+  // We write to a temporary file first and rename it afterwards, so that a
+  // failure leaves either no packfile or a complete one behind.
+  auto tmp = path{filename.str() + ".tmp"};
+  std::ofstream out{tmp.str(), std::ios::binary};
+  if (!out)
+    return make_error(ec::filesystem_error, "failed to create packfile", tmp);
+  // Write header and TOC.
+  out.write(reinterpret_cast<char const*>(&magic), sizeof(magic));
+  out.write(reinterpret_cast<char const*>(&version), sizeof(version));
+  out.write(reinterpret_cast<char const*>(&data_offset), sizeof(data_offset));
+  out.write(buf.data(), buf.size());
+  static char const padding[alignment] = {};
+  out.write(padding, data_offset - header_size - buf.size());
+  // Write blobs.
+  for (size_t i = 0; i < files_.size(); ++i) {
+    auto contents = load_contents(files_[i].second);
+    if (!contents)
+      return contents.error();
+    if (contents->size() != toc[i].second.size)
+      return make_error(ec::filesystem_error, "file changed while packing",
+                        files_[i].second);
+    out.write(contents->data(), contents->size());
+    out.write(padding, align(contents->size()) - contents->size());
+  }
+  out.flush();
+  out.close();
+  if (!out) {
+    rm(tmp);
+    return make_error(ec::filesystem_error, "failed to write packfile", tmp);
+  }
+  if (std::rename(tmp.str().c_str(), filename.str().c_str()) != 0) {
+    rm(tmp);
+    return make_error(ec::filesystem_error, "failed to rename", tmp);
+  }
+  return {};
+}
+
+expected<std::shared_ptr<packfile>> packfile::open(path const& filename) {
+  auto result = std::shared_ptr<packfile>(new packfile);
+  result->root_ = filename.parent();
+  result->map_ = std::make_unique<detail::mmapbuf>(filename.str());
+  auto& map = *result->map_;
+  if (!map.data() || map.size() < header_size)
+    return make_error(ec::filesystem_error, "failed to map packfile",
+                      filename);
+  uint32_t file_magic;
+  uint32_t file_version;
+  uint64_t data_offset;
+  std::memcpy(&file_magic, map.data(), sizeof(file_magic));
+  std::memcpy(&file_version, map.data() + 4, sizeof(file_version));
+  std::memcpy(&data_offset, map.data() + 8, sizeof(data_offset));
+  if (file_magic != magic)
+    return make_error(ec::format_error, "invalid packfile magic", filename);
+  if (file_version != version)
+    return make_error(ec::version_error, "unsupported packfile version",
+                      file_version);
+  if (data_offset < header_size || data_offset > map.size())
+    return make_error(ec::format_error, "invalid packfile header", filename);
+  caf::charbuf buf{const_cast<char*>(map.data()) + header_size,
+                  data_offset - header_size};
+  auto r = vast::load(buf, result->toc_);
+  if (!r)
+    return r.error();
+  result->data_ = map.data() + data_offset;
+  auto available = map.size() - data_offset;
+  for (auto& x : result->toc_)
+    if (x.second.offset + x.second.size > available)
+      return make_error(ec::format_error, "truncated packfile", filename);
+  return result;
+}
+
+packfile::~packfile() {
+  // nop
+}
+
+path const& packfile::root() const {
+  return root_;
+}
+
+packfile::toc_type const& packfile::toc() const {
+  return toc_;
+}
+
+packfile::entry const* packfile::find(path const& p) const {
+  auto& root = root_.str();
+  auto& str = p.str();
+  auto name = str;
+  if (!root.empty() && str.size() > root.size()
+      && str.compare(0, root.size(), root) == 0
+      && str[root.size()] == '/')
+    name = str.substr(root.size() + 1);
+  auto i = std::lower_bound(toc_.begin(), toc_.end(), name,
+                            [](auto& x, auto& y) { return x.first < y; });
+  if (i == toc_.end() || i->first != name)
+    return nullptr;
+  return &i->second;
+}
+
+bool packfile::contains(path const& p) const {
+  return find(p) != nullptr;
+}
+
+char const* packfile::data(entry const& x) const {
+  VAST_ASSERT(data_);
+  return data_ + x.offset;
+}
+
+} // namespace vast
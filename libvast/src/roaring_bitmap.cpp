@@ -0,0 +1,606 @@
+#include "vast/roaring_bitmap.hpp"
+
+namespace vast {
+namespace detail {
+
+namespace {
+
+using block_type = roaring_container::block_type;
+using word_type = roaring_container::word_type;
+
+constexpr auto width = static_cast<uint32_t>(word_type::width);
+
+// Sets the bits in [first, last) of a sequence of blocks.
+void set_range(block_type* xs, uint32_t first, uint32_t last) {
+  while (first < last) {
+    auto i = first / width;
+    auto offset = first % width;
+    auto n = std::min(last - first, width - offset);
+    xs[i] |= word_type::lsb_fill(n) << offset;
+    first += n;
+  }
+}
+
+} // namespace <anonymous>
+
+template <class F>
+void roaring_container::each_run(F f) const {
+  switch (kind_) {
+    case kind::array:
+      for (auto i = size_t{0}; i < values_.size();) {
+        auto j = i + 1;
+        while (j < values_.size() && values_[j] == values_[j - 1] + 1u)
+          ++j;
+        f(uint32_t{values_[i]}, values_[j - 1] + 1u);
+        i = j;
+      }
+      break;
+    case kind::runs:
+      for (auto i = size_t{0}; i < values_.size(); i += 2)
+        f(uint32_t{values_[i]}, values_[i + 1] + 1u);
+      break;
+    case kind::bitset: {
+      // Alternately searches for the next 1-bit and the next 0-bit.
+      auto find = [&](uint32_t i, bool bit) -> uint32_t {
+        auto k = i / width;
+        auto mask = word_type::all << (i % width);
+        auto x = (bit ? blocks_[k] : ~blocks_[k]) & mask;
+        while (x == 0 && ++k < num_blocks)
+          x = bit ? blocks_[k] : ~blocks_[k];
+        if (k == num_blocks)
+          return capacity;
+        return k * width + word_type::count_trailing_zeros(x);
+      };
+      auto i = find(0, true);
+      while (i < capacity) {
+        auto j = find(i, false);
+        f(i, j);
+        if (j == capacity)
+          break;
+        i = find(j, true);
+      }
+      break;
+    }
+  }
+}
+
+roaring_container::roaring_container(uint64_t key) : key_{key} {
+}
+
+uint64_t roaring_container::key() const {
+  return key_;
+}
+
+roaring_container::kind roaring_container::representation() const {
+  return kind_;
+}
+
+bool roaring_container::empty() const {
+  switch (kind_) {
+    case kind::array:
+    case kind::runs:
+      return values_.empty();
+    case kind::bitset:
+      return std::all_of(blocks_.begin(), blocks_.end(),
+                         [](auto x) { return x == 0; });
+  }
+  return true;
+}
+
+uint32_t roaring_container::cardinality() const {
+  auto result = uint32_t{0};
+  switch (kind_) {
+    case kind::array:
+      result = values_.size();
+      break;
+    case kind::runs:
+      for (auto i = 0u; i < values_.size(); i += 2)
+        result += values_[i + 1] - values_[i] + 1u;
+      break;
+    case kind::bitset:
+      for (auto x : blocks_)
+        result += word_type::popcount(x);
+      break;
+  }
+  return result;
+}
+
+bool roaring_container::test(uint32_t i) const {
+  VAST_ASSERT(i < capacity);
+  return word_type::test(block(i / width), i % width);
+}
+
+block_type roaring_container::block(uint32_t i) const {
+  VAST_ASSERT(i < num_blocks);
+  auto first = i * width;
+  auto last = first + width;
+  auto result = word_type::none;
+  switch (kind_) {
+    case kind::array: {
+      auto x = std::lower_bound(values_.begin(), values_.end(), first);
+      for (; x != values_.end() && *x < last; ++x)
+        result |= word_type::mask(*x - first);
+      break;
+    }
+    case kind::runs: {
+      auto n = values_.size() / 2;
+      for (auto r = find_run(first); r < n && values_[2 * r] < last; ++r) {
+        auto begin = std::max(uint32_t{values_[2 * r]}, first);
+        auto end = std::min(values_[2 * r + 1] + 1u, last);
+        result |= word_type::lsb_fill(end - begin) << (begin - first);
+      }
+      break;
+    }
+    case kind::bitset:
+      result = blocks_[i];
+      break;
+  }
+  return result;
+}
+
+uint32_t roaring_container::uniform_blocks(uint32_t i, bool bit) const {
+  VAST_ASSERT(i < num_blocks);
+  auto first = i * width;
+  switch (kind_) {
+    case kind::array: {
+      auto x = std::lower_bound(values_.begin(), values_.end(), first);
+      if (!bit)
+        return (x == values_.end() ? capacity : uint32_t{*x})
+                 / width - i;
+      // Since the values are sorted and unique, a block is full iff the
+      // 64th value from its first bit is its last bit.
+      auto j = i;
+      auto k = static_cast<size_t>(x - values_.begin());
+      while (j < num_blocks && k + width <= values_.size()
+             && values_[k] == j * width
+             && values_[k + width - 1]
+                  == (j + 1) * width - 1) {
+        ++j;
+        k += width;
+      }
+      return j - i;
+    }
+    case kind::runs: {
+      auto r = find_run(first);
+      auto covered = r < values_.size() / 2 && values_[2 * r] <= first;
+      if (!bit) {
+        if (covered)
+          return 0;
+        return (r == values_.size() / 2 ? capacity : uint32_t{values_[2 * r]})
+                 / width - i;
+      }
+      if (!covered)
+        return 0;
+      return (values_[2 * r + 1] + 1u - first) / width;
+    }
+    case kind::bitset: {
+      auto x = bit ? word_type::all : word_type::none;
+      auto j = i;
+      while (j < num_blocks && blocks_[j] == x)
+        ++j;
+      return j - i;
+    }
+  }
+  return 0;
+}
+
+void roaring_container::blocks(block_type* out) const {
+  if (kind_ == kind::bitset) {
+    std::copy(blocks_.begin(), blocks_.end(), out);
+    return;
+  }
+  std::fill(out, out + num_blocks, word_type::none);
+  each_run([=](uint32_t first, uint32_t last) {
+    set_range(out, first, last);
+  });
+}
+
+void roaring_container::append(uint32_t first, uint32_t last) {
+  VAST_ASSERT(first < last);
+  VAST_ASSERT(last <= capacity);
+  if (kind_ == kind::array) {
+    // We only add short sequences to arrays, for longer ones runs are
+    // preferable.
+    auto n = last - first;
+    if (n <= 2 && values_.size() + n <= max_array_size) {
+      for (auto i = first; i < last; ++i)
+        values_.push_back(i);
+      return;
+    }
+    convert(n <= 2 ? kind::bitset : kind::runs);
+  }
+  if (kind_ == kind::runs) {
+    if (!values_.empty() && values_.back() + 1u == first) {
+      values_.back() = last - 1;
+    } else {
+      values_.push_back(first);
+      values_.push_back(last - 1);
+    }
+    // Beyond this number of runs, a bitset requires less space.
+    if (values_.size() > max_array_size)
+      convert(kind::bitset);
+    return;
+  }
+  set_range(blocks_.data(), first, last);
+}
+
+void roaring_container::assign(block_type const* xs) {
+  values_.clear();
+  blocks_.assign(xs, xs + num_blocks);
+  kind_ = kind::bitset;
+  optimize();
+}
+
+void roaring_container::complement(uint32_t n) {
+  VAST_ASSERT(n <= capacity);
+  convert(kind::bitset);
+  auto i = 0u;
+  for (; (i + 1) * width <= n; ++i)
+    blocks_[i] = ~blocks_[i];
+  if (n % width > 0)
+    blocks_[i] ^= word_type::lsb_mask(n % width);
+  optimize();
+}
+
+void roaring_container::truncate(uint32_t n) {
+  VAST_ASSERT(n <= capacity);
+  if (n == capacity)
+    return;
+  convert(kind::bitset);
+  auto i = n / width;
+  blocks_[i] &= word_type::lsb_mask(n % width);
+  std::fill(blocks_.begin() + i + 1, blocks_.end(), word_type::none);
+  optimize();
+}
+
+void roaring_container::optimize() {
+  // We pick the representation with the smallest size in bytes, and prefer
+  // arrays over runs over bitsets on a tie.
+  auto card = cardinality();
+  auto array_size = card <= max_array_size ? 2 * card : ~0u;
+  auto runs_size = 4 * num_runs();
+  auto bitset_size = num_blocks * sizeof(block_type);
+  if (array_size <= runs_size && array_size <= bitset_size)
+    convert(kind::array);
+  else if (runs_size <= bitset_size)
+    convert(kind::runs);
+  else
+    convert(kind::bitset);
+}
+
+bool operator==(roaring_container const& x, roaring_container const& y) {
+  if (x.key_ != y.key_)
+    return false;
+  if (x.kind_ == y.kind_)
+    return x.values_ == y.values_ && x.blocks_ == y.blocks_;
+  block_type xs[roaring_container::num_blocks];
+  block_type ys[roaring_container::num_blocks];
+  x.blocks(xs);
+  y.blocks(ys);
+  return std::equal(xs, xs + roaring_container::num_blocks, ys);
+}
+
+roaring_container eval(roaring_container const& x, roaring_container const& y,
+                       bitwise_operator op) {
+  VAST_ASSERT(x.key_ == y.key_);
+  roaring_container result{x.key_};
+  using kind = roaring_container::kind;
+  if (x.kind_ == kind::array && y.kind_ == kind::array
+      && op != bitwise_operator::bitwise_nor) {
+    auto& xs = x.values_;
+    auto& ys = y.values_;
+    auto out = std::back_inserter(result.values_);
+    switch (op) {
+      case bitwise_operator::bitwise_and:
+        std::set_intersection(xs.begin(), xs.end(), ys.begin(), ys.end(), out);
+        break;
+      case bitwise_operator::bitwise_or:
+        std::set_union(xs.begin(), xs.end(), ys.begin(), ys.end(), out);
+        break;
+      case bitwise_operator::bitwise_xor:
+        std::set_symmetric_difference(xs.begin(), xs.end(), ys.begin(),
+                                      ys.end(), out);
+        break;
+      default:
+        std::set_difference(xs.begin(), xs.end(), ys.begin(), ys.end(), out);
+        break;
+    }
+    result.optimize();
+    return result;
+  }
+  block_type xs[roaring_container::num_blocks];
+  block_type ys[roaring_container::num_blocks];
+  x.blocks(xs);
+  y.blocks(ys);
+  bitwise_blocks(op, xs, ys, xs, roaring_container::num_blocks);
+  result.assign(xs);
+  return result;
+}
+
+size_t roaring_container::find_run(uint32_t i) const {
+  VAST_ASSERT(kind_ == kind::runs);
+  auto lo = size_t{0};
+  auto hi = values_.size() / 2;
+  while (lo < hi) {
+    auto mid = (lo + hi) / 2;
+    if (values_[2 * mid + 1] < i)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+uint32_t roaring_container::num_runs() const {
+  if (kind_ == kind::runs)
+    return values_.size() / 2;
+  auto result = 0u;
+  each_run([&](uint32_t, uint32_t) { ++result; });
+  return result;
+}
+
+void roaring_container::convert(kind k) {
+  if (k == kind_)
+    return;
+  std::vector<uint16_t> values;
+  std::vector<block_type> blocks;
+  switch (k) {
+    case kind::array:
+      each_run([&](uint32_t first, uint32_t last) {
+        for (auto i = first; i < last; ++i)
+          values.push_back(i);
+      });
+      break;
+    case kind::runs:
+      each_run([&](uint32_t first, uint32_t last) {
+        values.push_back(first);
+        values.push_back(last - 1);
+      });
+      break;
+    case kind::bitset:
+      blocks.resize(num_blocks);
+      this->blocks(blocks.data());
+      break;
+  }
+  values_ = std::move(values);
+  blocks_ = std::move(blocks);
+  kind_ = k;
+}
+
+} // namespace detail
+
+namespace {
+
+using container_type = roaring_bitmap::container_type;
+using word_type = roaring_bitmap::word_type;
+
+constexpr auto container_bits = roaring_bitmap::size_type{
+  container_type::capacity};
+
+} // namespace <anonymous>
+
+roaring_bitmap::roaring_bitmap(size_type n, bool bit) {
+  append_bits(bit, n);
+}
+
+bool roaring_bitmap::empty() const {
+  return num_bits_ == 0;
+}
+
+roaring_bitmap::size_type roaring_bitmap::size() const {
+  return num_bits_;
+}
+
+roaring_bitmap::container_vector const& roaring_bitmap::containers() const {
+  return containers_;
+}
+
+bool roaring_bitmap::operator[](size_type i) const {
+  VAST_ASSERT(i < num_bits_);
+  auto key = i / container_bits;
+  auto x = std::lower_bound(
+    containers_.begin(), containers_.end(), key,
+    [](auto& c, auto k) { return c.key() < k; });
+  return x != containers_.end() && x->key() == key
+         && x->test(i % container_bits);
+}
+
+void roaring_bitmap::append_bit(bool bit) {
+  append_bits(bit, 1);
+}
+
+void roaring_bitmap::append_bits(bool bit, size_type n) {
+  VAST_ASSERT(max_size - num_bits_ >= n);
+  if (bit)
+    append_ones(num_bits_, num_bits_ + n);
+  num_bits_ += n;
+}
+
+void roaring_bitmap::append_block(block_type value, size_type n) {
+  VAST_ASSERT(n > 0);
+  VAST_ASSERT(n <= word_type::width);
+  VAST_ASSERT(max_size - num_bits_ >= n);
+  if (n < word_type::width)
+    value &= word_type::lsb_mask(n);
+  // Append the runs of 1-bits in the block.
+  auto i = size_type{0};
+  while (value != 0) {
+    i += word_type::count_trailing_zeros(value);
+    value >>= word_type::count_trailing_zeros(value);
+    auto ones = word_type::count_trailing_ones(value);
+    append_ones(num_bits_ + i, num_bits_ + i + ones);
+    i += ones;
+    value = ones == word_type::width ? word_type::none : value >> ones;
+  }
+  num_bits_ += n;
+}
+
+void roaring_bitmap::flip() {
+  if (num_bits_ == 0)
+    return;
+  // Complementing turns chunks without 1-bits into chunks of 1-bits only.
+  auto last_key = (num_bits_ - 1) / container_bits;
+  container_vector result;
+  auto x = containers_.begin();
+  for (auto key = size_type{0}; key <= last_key; ++key) {
+    auto n = static_cast<uint32_t>(
+      std::min(container_bits, num_bits_ - key * container_bits));
+    if (x != containers_.end() && x->key() == key) {
+      x->complement(n);
+      if (!x->empty())
+        result.push_back(std::move(*x));
+      ++x;
+    } else {
+      result.emplace_back(key);
+      result.back().append(0, n);
+    }
+  }
+  containers_ = std::move(result);
+}
+
+void roaring_bitmap::append_ones(size_type first, size_type last) {
+  while (first < last) {
+    auto key = first / container_bits;
+    auto base = key * container_bits;
+    auto end = std::min(last, base + container_bits);
+    if (containers_.empty() || containers_.back().key() != key) {
+      // We no longer append to the previous container.
+      if (!containers_.empty())
+        containers_.back().optimize();
+      containers_.emplace_back(key);
+    }
+    containers_.back().append(static_cast<uint32_t>(first - base),
+                              static_cast<uint32_t>(end - base));
+    first = end;
+  }
+}
+
+bool operator==(roaring_bitmap const& x, roaring_bitmap const& y) {
+  return x.num_bits_ == y.num_bits_ && x.containers_ == y.containers_;
+}
+
+roaring_bitmap_range::roaring_bitmap_range(roaring_bitmap const& bm)
+  : bm_{&bm},
+    done_{bm.empty()} {
+  if (!done_)
+    scan();
+}
+
+bool roaring_bitmap_range::done() const {
+  return done_;
+}
+
+void roaring_bitmap_range::next() {
+  VAST_ASSERT(!done());
+  if (next_ == bm_->size())
+    done_ = true;
+  else
+    scan();
+}
+
+void roaring_bitmap_range::scan() {
+  auto& containers = bm_->containers_;
+  auto size = bm_->size();
+  // Returns the key of the i-th container, or the key past the bitmap end.
+  auto key = [&](size_t i) {
+    return i < containers.size() ? containers[i].key()
+                                 : (size - 1) / container_bits + 1;
+  };
+  while (container_ < containers.size()
+         && key(container_) < next_ / container_bits)
+    ++container_;
+  auto in_container = [&](size_t i, roaring_bitmap::size_type pos) {
+    return i < containers.size() && key(i) == pos / container_bits;
+  };
+  // Returns the block index of a position within its container.
+  auto block_index = [](roaring_bitmap::size_type pos) {
+    return static_cast<uint32_t>(pos % container_bits / word_type::width);
+  };
+  auto block = in_container(container_, next_)
+                 ? containers[container_].block(block_index(next_))
+                 : word_type::none;
+  auto remaining = size - next_;
+  if (word_type::all_or_none(block)) {
+    // Extend the sequence of homogeneous blocks, possibly across multiple
+    // containers and gaps between them.
+    auto bit = block != word_type::none;
+    auto end = next_;
+    auto i = container_;
+    while (end < size) {
+      if (in_container(i, end)) {
+        auto k = containers[i].uniform_blocks(block_index(end), bit);
+        end += k * word_type::width;
+        if (k == 0 || end % container_bits != 0)
+          break;
+        ++i;
+      } else if (!bit) {
+        end = key(i) * container_bits;
+      } else {
+        break;
+      }
+    }
+    auto n = std::min(end, size) - next_;
+    if (n >= word_type::width) {
+      n -= n % word_type::width;
+      bits_ = {block, n};
+      next_ += n;
+      return;
+    }
+  }
+  auto n = std::min(remaining, roaring_bitmap::size_type{word_type::width});
+  bits_ = {block, n};
+  next_ += n;
+}
+
+roaring_bitmap_range bit_range(roaring_bitmap const& bm) {
+  return roaring_bitmap_range{bm};
+}
+
+roaring_bitmap container_eval(roaring_bitmap const& lhs,
+                              roaring_bitmap const& rhs,
+                              detail::bitwise_operator op,
+                              roaring_bitmap::size_type n) {
+  VAST_ASSERT(detail::apply(op, word_type::none, word_type::none) == 0);
+  // Since *op* maps two 0-bits to 0, a container without counterpart on the
+  // other side either remains as is or vanishes.
+  auto keep_lhs = detail::apply(op, word_type::all, word_type::none) != 0;
+  auto keep_rhs = detail::apply(op, word_type::none, word_type::all) != 0;
+  roaring_bitmap result;
+  auto& xs = lhs.containers_;
+  auto& ys = rhs.containers_;
+  auto x = xs.begin();
+  auto y = ys.begin();
+  while (x != xs.end() || y != ys.end()) {
+    if (y == ys.end() || (x != xs.end() && x->key() < y->key())) {
+      if (keep_lhs)
+        result.containers_.push_back(*x);
+      ++x;
+    } else if (x == xs.end() || y->key() < x->key()) {
+      if (keep_rhs)
+        result.containers_.push_back(*y);
+      ++y;
+    } else {
+      auto c = eval(*x, *y, op);
+      if (!c.empty())
+        result.containers_.push_back(std::move(c));
+      ++x;
+      ++y;
+    }
+  }
+  // Remove the bits past the result size.
+  auto& cs = result.containers_;
+  while (!cs.empty() && cs.back().key() * container_bits >= n)
+    cs.pop_back();
+  if (!cs.empty()) {
+    auto end = n - cs.back().key() * container_bits;
+    if (end < container_bits) {
+      cs.back().truncate(static_cast<uint32_t>(end));
+      if (cs.back().empty())
+        cs.pop_back();
+    }
+  }
+  result.num_bits_ = n;
+  return result;
+}
+
+} // namespace vast
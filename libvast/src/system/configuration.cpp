@@ -41,9 +41,12 @@ configuration::configuration() {
   add_message_type<schema>("vast::schema");
   add_message_type<type>("vast::type");
   add_message_type<timespan>("vast::timespan");
+  add_message_type<timestamp>("vast::timestamp");
   add_message_type<uuid>("vast::uuid");
   // Containers
+  add_message_type<std::vector<bitmap>>("std::vector<vast::bitmap>");
   add_message_type<std::vector<event>>("std::vector<vast::event>");
+  add_message_type<std::vector<expression>>("std::vector<vast::expression>");
   // Actor-specific messages
   add_message_type<registry>("vast::system::registry");
   add_message_type<registry_entry>("vast::system::registry_entry");
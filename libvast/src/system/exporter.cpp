@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <cmath>
+
 #include <caf/all.hpp>
 
 #include "vast/event.hpp"
@@ -23,31 +26,36 @@ namespace system {
 namespace {
 
 void ship_results(stateful_actor<exporter_state>* self) {
-  if (self->state.results.empty() || self->state.stats.requested == 0)
+  auto& st = self->state;
+  if (st.results.empty() || st.stats.requested == 0)
     return;
-  VAST_DEBUG(self, "relays", self->state.results.size(), "events");
-  message msg;
-  if (self->state.results.size() <= self->state.stats.requested) {
-    self->state.stats.requested -= self->state.results.size();
-    self->state.stats.shipped += self->state.results.size();
-    msg = make_message(std::move(self->state.results));
-  } else {
-    std::vector<event> remainder;
-    remainder.reserve(self->state.results.size() - self->state.stats.requested);
-    auto begin = self->state.results.begin() + self->state.stats.requested;
-    auto end = self->state.results.end();
+  auto n = std::min(static_cast<uint64_t>(st.results.size()),
+                    st.stats.requested);
+  // Never ship more results than the limit permits, even if the sink asked
+  // for more.
+  if (st.limit > 0)
+    n = std::min(n, st.limit > st.stats.shipped ? st.limit - st.stats.shipped
+                                                : 0);
+  if (n == 0)
+    return;
+  VAST_DEBUG(self, "relays", n, "events");
+  std::vector<event> remainder;
+  if (n < st.results.size()) {
+    remainder.reserve(st.results.size() - n);
+    auto begin = st.results.begin() + n;
+    auto end = st.results.end();
     std::move(begin, end, std::back_inserter(remainder));
-    self->state.results.resize(self->state.stats.requested);
-    msg = make_message(std::move(self->state.results));
-    self->state.results = std::move(remainder);
-    self->state.stats.shipped += self->state.stats.requested;
-    self->state.stats.requested = 0;
+    st.results.resize(n);
   }
-  self->send(self->state.sink, msg);
+  st.stats.requested -= n;
+  st.stats.shipped += n;
+  self->send(st.sink, make_message(std::move(st.results)));
+  st.results = std::move(remainder);
 }
 
 void shutdown(stateful_actor<exporter_state>* self) {
-  if (rank(self->state.unprocessed) > 0 || !self->state.results.empty())
+  if (rank(self->state.unprocessed) > 0 || any<1>(self->state.pending)
+      || !self->state.results.empty())
     return;
   timespan runtime = steady_clock::now() - self->state.start;
   self->state.stats.runtime = runtime;
@@ -69,33 +77,161 @@ void shutdown(stateful_actor<exporter_state>* self) {
   self->send_exit(self, exit_reason::normal);
 }
 
+// Estimates the fraction of candidates that pass the candidate check.
+double selectivity(stateful_actor<exporter_state>* self) {
+  if (self->state.stats.processed == 0)
+    return 1.0;
+  auto results = self->state.stats.shipped + self->state.results.size();
+  auto x = double(results) / self->state.stats.processed;
+  return std::max(x, 0.01);
+}
+
+// Forwards pending hits to the archive, but only as many as we expect to
+// need for the outstanding results. Since the hits may include false
+// positives, we compensate with the observed selectivity.
+void forward_hits(stateful_actor<exporter_state>* self) {
+  auto& st = self->state;
+  if (st.stats.requested == 0 || any<1>(st.unprocessed)
+      || !any<1>(st.pending))
+    return;
+  // We compute rank and select on the pending hits on every invocation, which
+  // the skip index reduces to a binary search.
+  st.pending.build_skip_index();
+  auto n = rank(st.pending);
+  auto wanted = std::ceil(st.stats.requested / selectivity(self));
+  bitmap hits;
+  if (wanted >= n) {
+    hits = std::move(st.pending);
+    st.pending = {};
+  } else {
+    // Trim the hits to the first IDs.
+    auto last = select(st.pending, static_cast<bitmap::size_type>(wanted));
+    bitmap prefix{last + 1, true};
+    hits = st.pending & prefix;
+    st.pending -= prefix;
+  }
+  VAST_DEBUG(self, "forwards", rank(hits), "of", n, "hits to archive");
+  st.unprocessed |= hits;
+  // The archive seeks through the hits segment by segment.
+  hits.build_skip_index();
+  self->send(st.archive, std::move(hits));
+}
+
+// Releases the lookup at the index, drops all work in flight, and terminates.
+void cancel(stateful_actor<exporter_state>* self) {
+  auto& st = self->state;
+  if (st.index)
+    self->send(st.index, cancel_atom::value, st.id);
+  st.pending = {};
+  st.unprocessed = {};
+  st.results.clear();
+  shutdown(self);
+}
+
+// Terminates the query early once it has shipped as many results as the
+// limit permits.
+bool enforce_limit(stateful_actor<exporter_state>* self) {
+  auto& st = self->state;
+  if (st.limit == 0 || st.stats.shipped < st.limit)
+    return false;
+  VAST_DEBUG(self, "reached limit of", st.limit, "results");
+  cancel(self);
+  return true;
+}
+
+// Determines how many partitions to ask for next, based on the behavior of
+// the previous ones. If the partitions so far yielded results, we ask for as
+// many as we need to satisfy the outstanding demand, so that broad queries
+// stay throttled to what the sink consumes. Otherwise we double the number
+// of partitions per request, so that selective queries ramp up quickly.
+// Since the index processes partitions in parallel, we back off when they
+// take considerably longer than usual.
+size_t next_batch(stateful_actor<exporter_state>* self, size_t remaining) {
+  auto& st = self->state;
+  auto slow = false;
+  if (st.batch > 0) {
+    timespan elapsed = steady_clock::now() - st.batch_start;
+    auto latency = elapsed / st.batch;
+    if (st.latency == timespan::zero()) {
+      st.latency = latency;
+    } else {
+      slow = latency > 2 * st.latency;
+      st.latency = (3 * st.latency + latency) / 4;
+    }
+    if (st.accountant)
+      self->send(st.accountant, "exporter.partition.latency", latency);
+  }
+  auto max_batch = st.batch == 0 ? size_t{1} : 2 * st.batch;
+  if (slow)
+    max_batch = std::max(st.batch / 2, size_t{1});
+  auto n = max_batch;
+  auto results = st.stats.shipped + st.results.size();
+  if (results > 0 && st.stats.received > 0) {
+    auto per_partition = double(results) / st.stats.received;
+    auto needed = std::ceil(st.stats.requested / per_partition);
+    if (needed < n)
+      n = std::max(static_cast<size_t>(needed), size_t{1});
+  }
+  return std::min(n, remaining);
+}
+
 void request_more_hits(stateful_actor<exporter_state>* self) {
   auto waiting_for_hits =
     self->state.stats.received == self->state.stats.scheduled;
-  auto need_more_results = self->state.stats.requested > 0;
-  auto have_no_inflight_requests = any<1>(self->state.unprocessed);
+  // The hits we already have suffice if they likely yield the outstanding
+  // results.
+  auto candidates = rank(self->state.pending) + rank(self->state.unprocessed);
+  auto need_more_results = self->state.stats.requested > 0
+    && candidates * selectivity(self) < self->state.stats.requested;
+  auto remaining = self->state.stats.expected - self->state.stats.scheduled;
   // If we're (1) no longer waiting for index hits, (2) still need more
-  // results, and (3) have no inflight requests to the archive, we ask
-  // the index for more hits.
-  if (waiting_for_hits && need_more_results && have_no_inflight_requests) {
-    auto remaining = self->state.stats.expected - self->state.stats.received;
-    // TODO: Figure out right amount of partitions to ask for.
-    auto n = std::min(remaining, size_t{2});
+  // results, and (3) have unscheduled partitions left, we ask the index for
+  // more hits.
+  if (waiting_for_hits && need_more_results && remaining > 0) {
+    auto n = next_batch(self, remaining);
     VAST_DEBUG(self, "asks index to process", n, "more partitions");
-    self->send(self->state.index, self->state.id, n);
+    self->state.batch = n;
+    self->state.batch_start = steady_clock::now();
+    // Account for the partitions right away to avoid duplicate requests, and
+    // correct the number once the index tells us how many it scheduled.
+    self->state.stats.scheduled += n;
+    self->request(self->state.index, infinite, self->state.id, n).then(
+      [=](size_t scheduled) {
+        VAST_ASSERT(scheduled <= n);
+        if (scheduled == n)
+          return;
+        VAST_DEBUG(self, "index scheduled only", scheduled, "partitions");
+        self->state.batch = scheduled;
+        self->state.stats.scheduled -= n - scheduled;
+        if (scheduled > 0) {
+          request_more_hits(self);
+        } else {
+          // The index has no more partitions for us.
+          self->state.stats.expected = self->state.stats.scheduled;
+          if (self->state.stats.received == self->state.stats.expected)
+            shutdown(self);
+        }
+      },
+      [=](const error& e) {
+        VAST_ERROR(self, "failed to request more hits:",
+                   self->system().render(e));
+      }
+    );
   }
 }
 
 } // namespace <anonymous>
 
 behavior exporter(stateful_actor<exporter_state>* self, expression expr,
-                  query_options) {
+                  query_options opts) {
   auto eu = self->system().dummy_execution_unit();
   self->state.sink = actor_pool::make(eu, actor_pool::broadcast());
   if (auto a = self->system().registry().get(accountant_atom::value))
     self->state.accountant = actor_cast<accountant_type>(a);
   self->set_exit_handler(
     [=](const exit_msg& msg) {
+      if (self->state.index)
+        self->send(self->state.index, cancel_atom::value, self->state.id);
       self->send(self->state.sink, sys_atom::value, delete_atom::value);
       self->send_exit(self->state.sink, msg.reason);
       self->quit(msg.reason);
@@ -117,10 +253,8 @@ behavior exporter(stateful_actor<exporter_state>* self, expression expr,
                                      + to_string(select(hits, -1) + 1) + ')')));
       if (count > 0) {
         self->state.hits |= hits;
-        self->state.unprocessed |= hits;
-        VAST_DEBUG(self, "forwards hits to archive");
-        // FIXME: restrict according to configured limit.
-        self->send(self->state.archive, std::move(hits));
+        self->state.pending |= hits;
+        forward_hits(self);
       }
       // Figure out if we're done.
       ++self->state.stats.received;
@@ -160,6 +294,9 @@ behavior exporter(stateful_actor<exporter_state>* self, expression expr,
       self->state.stats.processed += candidates.size();
       self->state.unprocessed -= mask;
       ship_results(self);
+      if (enforce_limit(self))
+        return;
+      forward_hits(self);
       request_more_hits(self);
       if (self->state.stats.received == self->state.stats.expected)
         shutdown(self);
@@ -171,6 +308,9 @@ behavior exporter(stateful_actor<exporter_state>* self, expression expr,
       }
       self->state.stats.requested = max_events;
       ship_results(self);
+      if (enforce_limit(self))
+        return;
+      forward_hits(self);
       request_more_hits(self);
     },
     [=](extract_atom, uint64_t requested) {
@@ -183,8 +323,24 @@ behavior exporter(stateful_actor<exporter_state>* self, expression expr,
       VAST_DEBUG(self, "got request to extract", n, "new events in addition to",
                  self->state.stats.requested, "pending results");
       ship_results(self);
+      if (enforce_limit(self))
+        return;
+      forward_hits(self);
       request_more_hits(self);
     },
+    [=](limit_atom, uint64_t limit) {
+      VAST_DEBUG(self, "limits query to", limit, "results");
+      self->state.limit = limit;
+    },
+    [=](deadline_atom, timespan timeout) {
+      VAST_DEBUG(self, "expires query in", timeout);
+      self->state.deadline = system_clock::now() + timeout;
+      self->delayed_send(self, timeout, cancel_atom::value);
+    },
+    [=](cancel_atom) {
+      VAST_DEBUG(self, "cancels query");
+      cancel(self);
+    },
     [=](archive_type const& archive) {
       VAST_DEBUG(self, "registers archive", archive);
       self->state.archive = archive;
@@ -200,7 +356,8 @@ behavior exporter(stateful_actor<exporter_state>* self, expression expr,
     [=](run_atom) {
       VAST_INFO(self, "executes query", expr);
       self->state.start = steady_clock::now();
-      self->request(self->state.index, infinite, expr).then(
+      self->request(self->state.index, infinite, expr, self->state.deadline,
+                    opts).then(
         [=](const uuid& lookup, size_t partitions, size_t scheduled) {
           VAST_DEBUG(self, "got lookup handle", lookup << ", scheduled",
                      scheduled << '/' << partitions, "partitions");
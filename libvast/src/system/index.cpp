@@ -1,9 +1,14 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
 #include <deque>
+#include <limits>
 #include <unordered_set>
 
 #include <caf/all.hpp>
 
 #include "vast/concept/parseable/to.hpp"
+#include "vast/concept/printable/std/chrono.hpp"
 #include "vast/concept/printable/to_string.hpp"
 #include "vast/concept/printable/vast/expression.hpp"
 #include "vast/concept/printable/vast/error.hpp"
@@ -17,8 +22,10 @@
 #include "vast/save.hpp"
 
 #include "vast/system/accountant.hpp"
+#include "vast/system/atoms.hpp"
 #include "vast/system/index.hpp"
 #include "vast/system/partition.hpp"
+#include "vast/system/predicate_cache.hpp"
 #include "vast/system/task.hpp"
 
 #include "vast/detail/cache.hpp"
@@ -39,9 +46,49 @@ void partition_index::add(const std::vector<event> xs, const uuid& partition) {
   };
   auto init = interval{timestamp::max(), timestamp::min()};
   auto result = std::accumulate(xs.begin(), xs.end(), init, fold);
-  // Update index.
-  auto& x = partitions_[partition];
-  x.range = bound(x.range, result);
+  // Update index. Events usually go to the most recent partition, so we
+  // search from the back.
+  auto pred = [&](auto& x) { return x.first == partition; };
+  auto i = std::find_if(partitions_.rbegin(), partitions_.rend(), pred);
+  if (i == partitions_.rend()) {
+    partitions_.emplace_back(partition, partition_synopsis{});
+    i = partitions_.rbegin();
+  }
+  i->second.range = bound(i->second.range, result);
+  i->second.events += xs.size();
+  // Restore the chronological order, which only the updated partition may
+  // have violated by moving its range start backwards.
+  auto before = [](auto& x, auto& y) {
+    return x.second.range.from < y.second.range.from;
+  };
+  for (auto j = i.base() - 1; j != partitions_.begin() && before(*j, *(j - 1));
+       --j)
+    std::iter_swap(j, j - 1);
+}
+
+void partition_index::replace(const std::vector<uuid>& xs, const uuid& y) {
+  auto replaced = [&](auto& x) {
+    return std::find(xs.begin(), xs.end(), x.first) != xs.end();
+  };
+  partition_synopsis merged;
+  for (auto& x : partitions_)
+    if (replaced(x)) {
+      merged.range.from = std::min(merged.range.from, x.second.range.from);
+      merged.range.to = std::max(merged.range.to, x.second.range.to);
+      merged.events += x.second.events;
+    }
+  auto last = std::remove_if(partitions_.begin(), partitions_.end(), replaced);
+  partitions_.erase(last, partitions_.end());
+  auto i = std::upper_bound(partitions_.begin(), partitions_.end(),
+                            merged.range.from, [](auto& from, auto& x) {
+                              return from < x.second.range.from;
+                            });
+  partitions_.emplace(i, y, merged);
+}
+
+const std::vector<std::pair<uuid, partition_index::partition_synopsis>>&
+partition_index::partitions() const {
+  return partitions_;
 }
 
 std::vector<uuid> partition_index::lookup(const expression& expr) const {
@@ -58,31 +105,143 @@ namespace {
 
 void evict(stateful_actor<index_state>* self) {
   // TODO: pick the LRU partition, not just a random one.
-  for (auto& x : self->state.loaded) {
-    if (self->state.evicted.count(x.second) == 0) {
-      VAST_DEBUG(self, "evicts partition", x.first);
-      self->send(x.second, shutdown_atom::value);
-      self->state.evicted.emplace(x.second, x.first);
-      break;
+  auto evict_if = [&](auto pred) {
+    for (auto& x : self->state.loaded) {
+      if (self->state.evicted.count(x.second) == 0 && pred(x.first)) {
+        VAST_DEBUG(self, "evicts partition", x.first);
+        self->send(x.second, shutdown_atom::value);
+        self->state.evicted.emplace(x.second, x.first);
+        // A prefetched partition that goes before its use was loaded in vain.
+        auto unused = self->state.prefetched.erase(x.first) > 0;
+        if (unused && self->state.accountant)
+          self->send(self->state.accountant, "index.prefetch.evicted",
+                     uint64_t{1});
+        return true;
+      }
     }
+    return false;
+  };
+  // Prefetched partitions are about to be needed, so we keep them if we can.
+  auto not_prefetched = [&](const uuid& id) {
+    return self->state.prefetched.count(id) == 0;
+  };
+  if (!evict_if(not_prefetched))
+    evict_if([](const uuid&) { return true; });
+}
+
+// Checks whether a lookup has exceeded its deadline.
+bool expired(const lookup_state& ctx) {
+  return ctx.deadline < system_clock::now();
+}
+
+// Erases a lookup and reports how long it waited for partitions.
+void erase(stateful_actor<index_state>* self,
+           std::unordered_map<uuid, lookup_state>::iterator i) {
+  if (self->state.accountant)
+    self->send(self->state.accountant, "index.lookup.wait", i->second.waited);
+  self->state.lookups.erase(i);
+}
+
+// Removes a lookup from all queued partitions and drops the partitions that
+// no other lookup waits for.
+void cancel(stateful_actor<index_state>* self, const uuid& lookup) {
+  auto l = self->state.lookups.find(lookup);
+  if (l == self->state.lookups.end())
+    return;
+  VAST_DEBUG(self, "cancels lookup", lookup);
+  erase(self, l);
+  auto& scheduled = self->state.scheduled;
+  for (auto& x : scheduled)
+    x.lookups.erase(lookup);
+  auto i = std::remove_if(scheduled.begin(), scheduled.end(),
+                          [](auto& x) { return x.lookups.empty(); });
+  VAST_DEBUG(self, "erases", scheduled.end() - i, "scheduled partitions");
+  scheduled.erase(i, scheduled.end());
+}
+
+// Erases a lookup once the INDEX has dispatched all its partitions.
+void finish_if_done(stateful_actor<index_state>* self, const uuid& lookup) {
+  auto i = self->state.lookups.find(lookup);
+  if (i == self->state.lookups.end() || !i->second.partitions.empty())
+    return;
+  auto waiting = std::any_of(self->state.scheduled.begin(),
+                             self->state.scheduled.end(),
+                             [&](auto& x) { return x.lookups.count(lookup); });
+  if (waiting)
+    return;
+  VAST_DEBUG(self, "completed lookup", lookup);
+  erase(self, i);
+}
+
+// Computes the virtual time at which a lookup gets its next partition. A
+// lookup that was idle doesn't accumulate credit: it starts at the virtual
+// time of the last dispatch.
+double start_time(stateful_actor<index_state>* self, const lookup_state& ctx) {
+  return std::max(ctx.vtime, self->state.vtime);
+}
+
+// Sends the expression of a lookup to a partition. Each dispatch advances the
+// virtual time of the lookup by the inverse of its weight, so that lookups
+// with a higher weight get more partitions under contention.
+void dispatch(stateful_actor<index_state>* self, const actor& part,
+              lookup_state& ctx) {
+  send_as(ctx.sink, part, ctx.expr, ctx.deadline);
+  ctx.vtime = start_time(self, ctx) + 1.0 / ctx.weight;
+}
+
+// Computes how many partitions a lookup may schedule at once: its fair share
+// of the partitions that the INDEX can hold in memory.
+size_t quota(stateful_actor<index_state>* self) {
+  auto n = std::max(self->state.lookups.size(), size_t{1});
+  return std::max(self->state.capacity / n, size_t{1});
+}
+
+// Loads the partitions that a lookup will schedule next, as long as the INDEX
+// has room for them. Thereby, subsequent requests for more hits don't have to
+// wait for the partitions to come from disk.
+void prefetch(stateful_actor<index_state>* self, const uuid& lookup) {
+  auto& ctx = self->state.lookups[lookup];
+  // We schedule partitions from the back.
+  auto n = std::min(ctx.partitions.size(), self->state.prefetch);
+  auto loaded = uint64_t{0};
+  for (auto i = ctx.partitions.rbegin(); n > 0; ++i, --n) {
+    if (self->state.loaded.size() >= self->state.capacity
+        || !self->state.scheduled.empty())
+      break;
+    if (*i == self->state.active.id || self->state.loaded.count(*i) > 0)
+      continue;
+    VAST_DEBUG(self, "prefetches partition", *i);
+    auto part_dir = self->state.dir / to_string(*i);
+    auto p = self->spawn<monitored>(partition, std::move(part_dir),
+                                    self->state.cache);
+    self->state.loaded.emplace(*i, p);
+    self->state.prefetched.insert(*i);
+    self->send(p, prefetch_atom::value, ctx.expr);
+    ++loaded;
   }
+  if (loaded > 0 && self->state.accountant)
+    self->send(self->state.accountant, "index.prefetch.loaded", loaded);
 }
 
-// FIXME: erase lookups that have completed.
 void schedule(stateful_actor<index_state>* self, const uuid& part,
               const uuid& lookup) {
   auto& ctx = self->state.lookups[lookup];
+  if (expired(ctx)) {
+    VAST_DEBUG(self, "skips partition", part, "of expired lookup", lookup);
+    return;
+  }
   // If we're dealing with the active partition, we dispatch immediately.
   if (part == self->state.active.id) {
     VAST_DEBUG(self, "dispatches to active partition", part);
-    send_as(ctx.sink, self->state.active.partition, ctx.expr);
+    dispatch(self, self->state.active.partition, ctx);
     return;
   }
   // If the partition is loaded, we can also dispatch immediately.
   auto l = self->state.loaded.find(part);
   if (l != self->state.loaded.end()) {
     VAST_DEBUG(self, "dispatches to loaded partition", part);
-    send_as(ctx.sink, l->second, ctx.expr);
+    self->state.prefetched.erase(part);
+    dispatch(self, l->second, ctx);
     return;
   }
   // If we have enough room, we can spin up the next partition.
@@ -90,9 +249,10 @@ void schedule(stateful_actor<index_state>* self, const uuid& part,
     VAST_ASSERT(self->state.scheduled.empty());
     VAST_DEBUG(self, "spawns and dispatches partition", part);
     auto part_dir = self->state.dir / to_string(part);
-    auto p = self->spawn<monitored>(partition, std::move(part_dir));
+    auto p = self->spawn<monitored>(partition, std::move(part_dir),
+                                    self->state.cache);
     self->state.loaded.emplace(part, p);
-    send_as(ctx.sink, p, ctx.expr);
+    dispatch(self, p, ctx);
     return;
   }
   // If we're full, we delay dispatching until having evicted a partition.
@@ -104,56 +264,461 @@ void schedule(stateful_actor<index_state>* self, const uuid& part,
     VAST_ASSERT(!self->state.evicted.empty());
     i->lookups.insert(lookup);
   } else {
-    self->state.scheduled.push_back({part, {lookup}});
+    self->state.scheduled.push_back({part, {lookup}, steady_clock::now()});
     evict(self);
   }
 }
 
-// FIXME: erase lookups that have completed.
 void unschedule(stateful_actor<index_state>* self, const actor& part) {
   // Check if we got an evicted partition.
   auto i = self->state.evicted.find(part);
-  if (i != self->state.evicted.end()) {
-    VAST_DEBUG(self, "completed eviction of partition", i->second);
-    self->state.loaded.erase(i->second);
-    self->state.evicted.erase(i);
-    // Fill the hole if we have scheduled partition.
-    if (!self->state.scheduled.empty()) {
-      auto& next = self->state.scheduled.front();
-      VAST_DEBUG(self, "spawns next partition", next.id);
-      auto part_dir = self->state.dir / to_string(next.id);
-      auto p = self->spawn<monitored>(partition, std::move(part_dir));
-      self->state.loaded.emplace(next.id, p);
-      for (auto& id : next.lookups) {
-        VAST_ASSERT(self->state.lookups.count(id) > 0);
-        auto& ctx = self->state.lookups[id];
-        VAST_DEBUG(self, "dispatches expression", ctx.expr);
-        send_as(ctx.sink, p, ctx.expr);
+  if (i == self->state.evicted.end())
+    return;
+  VAST_DEBUG(self, "completed eviction of partition", i->second);
+  self->state.loaded.erase(i->second);
+  self->state.prefetched.erase(i->second);
+  self->state.evicted.erase(i);
+  // Lookups may have expired while their partitions waited in the queue.
+  std::vector<uuid> expired_lookups;
+  for (auto& x : self->state.lookups)
+    if (expired(x.second))
+      expired_lookups.push_back(x.first);
+  for (auto& id : expired_lookups)
+    cancel(self, id);
+  if (self->state.scheduled.empty())
+    return;
+  // Fill the hole with the queued partition of the lookup with the earliest
+  // virtual start time. Among equals, the partition queued first wins.
+  auto start_of = [&](const scheduled_partition_state& x) {
+    auto result = std::numeric_limits<double>::max();
+    for (auto& id : x.lookups) {
+      VAST_ASSERT(self->state.lookups.count(id) > 0);
+      result = std::min(result, start_time(self, self->state.lookups[id]));
+    }
+    return result;
+  };
+  auto next = std::min_element(
+    self->state.scheduled.begin(), self->state.scheduled.end(),
+    [&](auto& x, auto& y) { return start_of(x) < start_of(y); });
+  self->state.vtime = start_of(*next);
+  VAST_DEBUG(self, "spawns next partition", next->id);
+  auto part_dir = self->state.dir / to_string(next->id);
+  auto p = self->spawn<monitored>(partition, std::move(part_dir),
+                                  self->state.cache);
+  self->state.loaded.emplace(next->id, p);
+  auto waited = steady_clock::now() - next->queued;
+  auto lookups = std::move(next->lookups);
+  self->state.scheduled.erase(next);
+  for (auto& id : lookups) {
+    auto& ctx = self->state.lookups[id];
+    VAST_DEBUG(self, "dispatches expression", ctx.expr);
+    ctx.waited += duration_cast<timespan>(waited);
+    dispatch(self, p, ctx);
+    finish_if_done(self, id);
+  }
+  // If we have more pending partitions, try to evict more.
+  if (self->state.scheduled.size() > self->state.evicted.size())
+    evict(self);
+}
+
+// Registers a lookup, schedules its first partitions, and responds with the
+// lookup ID and the number of total and scheduled partitions.
+void start(stateful_actor<index_state>* self, pending_lookup_state& x) {
+  VAST_DEBUG(self, "got lookup:", x.expr);
+  // Identify the relevant partitions.
+  auto id = uuid::random();
+  if (x.deadline < system_clock::now()) {
+    VAST_DEBUG(self, "returns without result: lookup expired");
+    x.promise.deliver(id, size_t{0}, size_t{0});
+    return;
+  }
+  auto partitions = self->state.part_index.lookup(x.expr);
+  if (partitions.empty()) {
+    VAST_DEBUG(self, "returns without result: no partitions qualify");
+    x.promise.deliver(id, size_t{0}, size_t{0});
+    return;
+  }
+  // Construct a new lookup context.
+  VAST_DEBUG(self, "creates new lookup context", id);
+  auto& ctx = self->state.lookups[id];
+  ctx.expr = std::move(x.expr);
+  ctx.sink = x.sink;
+  ctx.deadline = x.deadline;
+  ctx.weight = has_background_option(x.options)
+               ? 1 : std::max(self->state.scheduling.interactive_weight,
+                              size_t{1});
+  ctx.vtime = self->state.vtime;
+  ctx.waited = duration_cast<timespan>(steady_clock::now() - x.arrived);
+  self->monitor(x.sink);
+  auto num_partitions = partitions.size();
+  auto n = std::min({partitions.size(), self->state.taste, quota(self)});
+  // Start processing the most recent partitions to deliver a taste of the
+  // result. TODO: pick them based on accumulated summary statistics.
+  VAST_DEBUG(self, "schedules first", n, "partition(s)");
+  for (auto i = partitions.end() - n; i != partitions.end(); ++i)
+    schedule(self, *i, id);
+  partitions.resize(partitions.size() - n);
+  ctx.partitions = std::move(partitions);
+  prefetch(self, id);
+  finish_if_done(self, id);
+  x.promise.deliver(id, num_partitions, n);
+}
+
+// Starts deferred lookups as long as the admission limit permits.
+// Interactive lookups go first.
+void admit(stateful_actor<index_state>* self) {
+  auto& pending = self->state.admission;
+  auto max = self->state.scheduling.max_lookups;
+  while (!pending.empty() && (max == 0 || self->state.lookups.size() < max)) {
+    auto i = std::find_if(pending.begin(), pending.end(), [](auto& x) {
+      return !has_background_option(x.options);
+    });
+    if (i == pending.end())
+      i = pending.begin();
+    auto x = std::move(*i);
+    pending.erase(i);
+    start(self, x);
+  }
+}
+
+// -- partitioning ------------------------------------------------------------
+
+// Approximates the in-memory size of event data.
+struct size_estimator {
+  template <class T>
+  size_t operator()(T const& x) const {
+    return sizeof(x);
+  }
+
+  size_t operator()(std::string const& x) const {
+    return x.size();
+  }
+
+  size_t operator()(vector const& xs) const {
+    auto result = size_t{0};
+    for (auto& x : xs)
+      result += visit(*this, x);
+    return result;
+  }
+
+  size_t operator()(set const& xs) const {
+    auto result = size_t{0};
+    for (auto& x : xs)
+      result += visit(*this, x);
+    return result;
+  }
+
+  size_t operator()(table const& xs) const {
+    auto result = size_t{0};
+    for (auto& x : xs)
+      result += visit(*this, x.first) + visit(*this, x.second);
+    return result;
+  }
+};
+
+// Computes the beginning of the time window that contains a timestamp.
+timestamp window_of(timestamp ts, timespan window) {
+  return timestamp{(ts.time_since_epoch() / window) * window};
+}
+
+// Moves the active partition out of the way, such that the next batch
+// creates a new one.
+void seal_active(stateful_actor<index_state>* self) {
+  if (self->state.loaded.size() == self->state.capacity) {
+    VAST_DEBUG(self, "evicts active partition");
+    self->send(self->state.active.partition, shutdown_atom::value);
+  } else {
+    VAST_DEBUG(self, "moves active partition to cache");
+    self->state.loaded.emplace(self->state.active.id,
+                               self->state.active.partition);
+  }
+  self->state.active = {};
+}
+
+// Checks whether the active partition must be sealed before ingesting a
+// batch of events.
+bool must_seal(stateful_actor<index_state>* self,
+               std::vector<event> const& xs, size_t bytes) {
+  auto& policy = self->state.policy;
+  auto& active = self->state.active;
+  if (!active.partition || active.events == 0)
+    return false;
+  if (policy.max_events > 0 && active.events + xs.size() > policy.max_events) {
+    VAST_DEBUG(self, "reached event limit of active partition");
+    return true;
+  }
+  if (policy.max_bytes > 0 && active.bytes + bytes > policy.max_bytes) {
+    VAST_DEBUG(self, "reached byte limit of active partition");
+    return true;
+  }
+  if (policy.window > timespan::zero()
+      && window_of(xs.front().timestamp(), policy.window) > active.window) {
+    VAST_DEBUG(self, "reached end of time window of active partition");
+    return true;
+  }
+  return false;
+}
+
+// Relays a batch of events to the active partition, sealing and creating
+// partitions according to the partitioning policy.
+void ingest(stateful_actor<index_state>* self, std::vector<event> xs) {
+  VAST_ASSERT(!xs.empty());
+  auto bytes = size_t{0};
+  if (self->state.policy.max_bytes > 0)
+    for (auto& x : xs)
+      bytes += visit(size_estimator{}, x.data());
+  if (must_seal(self, xs, bytes))
+    seal_active(self);
+  auto& active = self->state.active;
+  if (!active.partition) {
+    auto id = uuid::random();
+    VAST_DEBUG(self, "spawns new active partition", id);
+    auto part_dir = self->state.dir / to_string(id);
+    auto part = self->spawn<monitored>(partition, part_dir,
+                                       self->state.cache);
+    active = {id, part, 0, 0, timestamp{}};
+    if (self->state.policy.window > timespan::zero())
+      active.window = window_of(xs.front().timestamp(),
+                                self->state.policy.window);
+  }
+  active.events += xs.size();
+  active.bytes += bytes;
+  self->state.part_index.add(xs, active.id);
+  self->send(active.partition, std::move(xs));
+}
+
+// -- merging -----------------------------------------------------------------
+
+// The partition index file begins with a magic constant and the version of
+// its layout.
+constexpr uint32_t meta_magic = 0x58444e49; // "INDX"
+constexpr uint32_t meta_version = 1;
+
+// Loads the partition index. A file without the header predates versioning.
+// It lists partitions in a format we can no longer read, so we reject it
+// rather than migrating it.
+expected<void> load_part_index(stateful_actor<index_state>* self) {
+  auto filename = self->state.dir / "meta";
+  uint32_t magic = 0;
+  uint32_t version = 0;
+  auto result = load(filename, magic, version);
+  if (!result)
+    return result;
+  if (magic != meta_magic)
+    return make_error(ec::version_error,
+                      "partition index without format version", filename);
+  if (version != meta_version)
+    return make_error(ec::version_error, "unsupported partition index version",
+                      version, meta_version);
+  return load(filename, magic, version, self->state.part_index);
+}
+
+// Writes the partition index to a new file and renames it, so that a crash
+// leaves either the old or the new partition index behind.
+expected<void> persist(stateful_actor<index_state>* self) {
+  auto filename = self->state.dir / "meta";
+  auto tmp = self->state.dir / "meta.tmp";
+  auto result = save(tmp, meta_magic, meta_version, self->state.part_index);
+  if (!result)
+    return result;
+  if (std::rename(tmp.str().c_str(), filename.str().c_str()) != 0)
+    return make_error(ec::filesystem_error, "failed to rename", tmp);
+  return {};
+}
+
+// Computes the directory in which a merge writes the merged partition. Only
+// a committed merge renames it to the final partition directory, so that a
+// merge interrupted by a crash leaves behind only directories of this form.
+path merge_dir(const path& dir, const uuid& id) {
+  return dir / (to_string(id) + ".merging");
+}
+
+// Deletes the output of merges that didn't commit before the INDEX went down.
+// Partition directories that the partition index doesn't list stay, since a
+// crash loses the partition index of all partitions since the last commit.
+void remove_unfinished_merges(stateful_actor<index_state>* self) {
+  std::vector<path> unfinished;
+  for (auto& entry : directory{self->state.dir})
+    if (entry.is_directory() && entry.extension() == ".merging")
+      unfinished.push_back(entry);
+  for (auto& x : unfinished) {
+    VAST_DEBUG(self, "removes unfinished merge", x);
+    if (!rm(x))
+      VAST_WARNING(self, "failed to remove unfinished merge", x);
+  }
+}
+
+// Discards the merge in progress and excludes its partitions from future
+// merges.
+void abort_merge(stateful_actor<index_state>* self) {
+  auto& st = self->state;
+  auto dir = merge_dir(st.dir, st.merging.id);
+  if (exists(dir))
+    rm(dir);
+  for (auto& x : st.merging.parts)
+    st.unmergeable.insert(x);
+  st.merging = {};
+}
+
+// Merges the first run of adjacent sealed partitions that together fit into
+// a single partition, unless a merge is already in progress. The merge runs
+// in a separate thread and reports back with a merge_atom.
+void start_merge(stateful_actor<index_state>* self) {
+  auto& st = self->state;
+  if (!st.policy.merge || st.policy.max_events == 0
+      || !st.merging.parts.empty())
+    return;
+  // Partitions in memory may still lack their packfile.
+  auto mergeable = [&](auto& x) {
+    return x.first != st.active.id && st.loaded.count(x.first) == 0
+           && st.unmergeable.count(x.first) == 0
+           && x.second.events < st.policy.max_events
+           && exists(st.dir / to_string(x.first) / "pack");
+  };
+  std::vector<uuid> run;
+  auto events = uint64_t{0};
+  for (auto& x : st.part_index.partitions()) {
+    auto ok = mergeable(x);
+    if (!ok || events + x.second.events > st.policy.max_events) {
+      if (run.size() > 1)
+        break;
+      run.clear();
+      events = 0;
+      if (!ok)
+        continue;
+    }
+    run.push_back(x.first);
+    events += x.second.events;
+  }
+  if (run.size() < 2)
+    return;
+  auto id = uuid::random();
+  VAST_DEBUG(self, "merges", run.size(), "partitions with", events,
+             "events into", id);
+  std::vector<path> dirs;
+  for (auto& x : run)
+    dirs.push_back(st.dir / to_string(x));
+  auto dir = merge_dir(st.dir, id);
+  st.merging = {id, std::move(run), false};
+  self->spawn(
+    [=, parent=actor_cast<actor>(self)](blocking_actor* merger) {
+      auto result = merge_partitions(dir, dirs);
+      if (result)
+        merger->send(parent, merge_atom::value, id);
+      else
+        merger->send(parent, merge_atom::value, id, result.error());
+    }
+  );
+}
+
+// Checks whether a lookup has yet to schedule a partition or waits for it to
+// load.
+bool referenced(stateful_actor<index_state>* self, const uuid& part) {
+  for (auto& x : self->state.scheduled)
+    if (x.id == part)
+      return true;
+  for (auto& x : self->state.lookups) {
+    auto& parts = x.second.partitions;
+    if (std::find(parts.begin(), parts.end(), part) != parts.end())
+      return true;
+  }
+  return false;
+}
+
+// Deletes the merged partitions that no lookup needs anymore. We evict
+// loaded partitions first and delete them only after they went down, since
+// they may still read from disk.
+void retire(stateful_actor<index_state>* self) {
+  auto& st = self->state;
+  std::vector<uuid> remaining;
+  for (auto& x : st.retired) {
+    if (referenced(self, x)) {
+      remaining.push_back(x);
+      continue;
+    }
+    auto i = st.loaded.find(x);
+    if (i != st.loaded.end()) {
+      if (st.evicted.count(i->second) == 0) {
+        VAST_DEBUG(self, "evicts merged partition", x);
+        self->send(i->second, shutdown_atom::value);
+        st.evicted.emplace(i->second, x);
       }
-      self->state.scheduled.pop_front();
-      // If we have more pending partitions, try to evict more.
-      if (self->state.scheduled.size() > self->state.evicted.size())
-        evict(self);
+      remaining.push_back(x);
+      continue;
     }
+    st.prefetched.erase(x);
+    auto part_dir = st.dir / to_string(x);
+    if (st.cache)
+      st.cache->invalidate(part_dir);
+    if (!rm(part_dir))
+      VAST_WARNING(self, "failed to remove merged partition", part_dir);
   }
+  st.retired = std::move(remaining);
+}
+
+// Swaps a completed merge into the partition index, so that new lookups use
+// the merged partition. Lookups in progress hold on to the IDs of the
+// original partitions they have yet to schedule, so we delete the original
+// partitions only once no lookup needs them anymore.
+void commit_merge(stateful_actor<index_state>* self) {
+  auto& st = self->state;
+  auto& m = st.merging;
+  if (m.done) {
+    auto tmp = merge_dir(st.dir, m.id);
+    auto part_dir = st.dir / to_string(m.id);
+    if (std::rename(tmp.str().c_str(), part_dir.str().c_str()) != 0) {
+      VAST_ERROR(self, "failed to rename merged partition", tmp);
+      abort_merge(self);
+      start_merge(self);
+      retire(self);
+      return;
+    }
+    VAST_DEBUG(self, "replaces", m.parts.size(), "partitions with", m.id);
+    st.part_index.replace(m.parts, m.id);
+    auto result = persist(self);
+    if (!result)
+      VAST_ERROR(self, "failed to persist partition index:",
+                 self->system().render(result.error()));
+    if (st.accountant)
+      self->send(st.accountant, "index.partitions.merged",
+                 static_cast<uint64_t>(m.parts.size()));
+    st.retired.insert(st.retired.end(), m.parts.begin(), m.parts.end());
+    m = {};
+    start_merge(self);
+  }
+  retire(self);
 }
 
 } // namespace <anonymous>
 
 behavior index(stateful_actor<index_state>* self, const path& dir,
-               size_t max_events, size_t max_parts, size_t taste_parts) {
-  VAST_ASSERT(max_events > 0);
+               partition_policy policy, size_t max_parts, size_t taste_parts,
+               size_t cache_size, scheduling_policy scheduling) {
   VAST_ASSERT(max_parts > 0);
-  VAST_DEBUG(self, "caps partitions at", max_events, "events");
+  if (policy.max_events > 0)
+    VAST_DEBUG(self, "caps partitions at", policy.max_events, "events");
+  if (policy.max_bytes > 0)
+    VAST_DEBUG(self, "caps partitions at", policy.max_bytes, "bytes");
+  if (policy.window > timespan::zero())
+    VAST_DEBUG(self, "partitions events in time windows of", policy.window);
   VAST_DEBUG(self, "keeps at most", max_parts, "partitions in memory");
+  if (scheduling.max_lookups > 0)
+    VAST_DEBUG(self, "admits at most", scheduling.max_lookups, "lookups");
+  if (cache_size > 0) {
+    VAST_DEBUG(self, "caches at most", cache_size, "predicate results");
+    self->state.cache = std::make_shared<predicate_cache>(cache_size);
+  }
+  self->state.policy = policy;
+  self->state.scheduling = scheduling;
   self->state.capacity = max_parts;
+  self->state.taste = taste_parts;
+  self->state.prefetch = taste_parts;
   self->state.dir = dir;
-  auto accountant = accountant_type{};
   if (auto a = self->system().registry().get(accountant_atom::value))
-    accountant = actor_cast<accountant_type>(a);
+    self->state.accountant = actor_cast<accountant_type>(a);
   // Read persistent state.
   if (exists(self->state.dir / "meta")) {
-    auto result = load(self->state.dir / "meta", self->state.part_index);
+    auto result = load_part_index(self);
     if (!result) {
       VAST_ERROR(self, "failed to load partition index:",
                  self->system().render(result.error()));
@@ -161,6 +726,8 @@ behavior index(stateful_actor<index_state>* self, const path& dir,
       return {};
     }
   }
+  if (exists(self->state.dir))
+    remove_unfinished_merges(self);
   self->set_exit_handler(
     [=](const exit_msg& msg) {
       auto can_terminate = [=] {
@@ -199,8 +766,7 @@ behavior index(stateful_actor<index_state>* self, const path& dir,
             return;
           }
         }
-        auto result = save(self->state.dir / "meta",
-                           self->state.part_index);
+        auto result = persist(self);
         if (!result) {
           VAST_ERROR(self, "failed to persist partition index:",
                      self->system().render(result.error()));
@@ -214,98 +780,128 @@ behavior index(stateful_actor<index_state>* self, const path& dir,
   );
   self->set_down_handler(
     [=](const down_msg& msg) {
-      auto i = std::find_if(
-        self->state.lookups.begin(),
-        self->state.lookups.end(),
-        [&](auto& x) { return x.second.sink == msg.source; });
-      if (i != self->state.lookups.end()) {
-        // A lookup actor went down. We can remove all queued partitions where
-        // this actor was the only lookup.
-        auto is_only_lookup = [&](auto& x) {
-          return x.lookups.size() == 1 && x.lookups.count(i->first) > 0;
-        };
-        auto j = std::remove_if(self->state.scheduled.begin(),
-                                self->state.scheduled.end(), is_only_lookup);
-        auto n = self->state.scheduled.end() - j;
-        VAST_DEBUG(self, "erases", n, "scheduled lookups");
-        self->state.scheduled.erase(j, self->state.scheduled.end());
+      std::vector<uuid> orphans;
+      for (auto& x : self->state.lookups)
+        if (x.second.sink == msg.source)
+          orphans.push_back(x.first);
+      auto& pending = self->state.admission;
+      auto i = std::remove_if(pending.begin(), pending.end(), [&](auto& x) {
+        return x.sink == msg.source;
+      });
+      auto deferred = pending.end() - i;
+      pending.erase(i, pending.end());
+      if (!orphans.empty() || deferred > 0) {
+        // A lookup actor went down, so nobody needs its results anymore.
+        for (auto& id : orphans)
+          cancel(self, id);
       } else {
-        // A partition went down.
+        // A partition went down, possibly leaving a sealed partition behind.
         unschedule(self, actor_cast<actor>(msg.source));
+        start_merge(self);
       }
+      admit(self);
+      commit_merge(self);
     }
   );
+  auto lookup = [=](expression const& expr, timestamp deadline,
+                    query_options options) {
+    auto sender = actor_cast<actor>(self->current_sender());
+    pending_lookup_state x{expr, deadline, options, sender,
+                           self->make_response_promise(),
+                           steady_clock::now()};
+    auto max = self->state.scheduling.max_lookups;
+    if (max > 0 && self->state.lookups.size() >= max) {
+      VAST_DEBUG(self, "defers lookup:", expr);
+      self->monitor(sender);
+      self->state.admission.push_back(std::move(x));
+      return;
+    }
+    start(self, x);
+    commit_merge(self);
+  };
+  start_merge(self);
   return {
-    [=](const std::vector<event>& events) {
+    [=](std::vector<event>& events) {
+      VAST_ASSERT(!events.empty());
       VAST_DEBUG(self, "got", events.size(), "events ["
                  << events.front().id() << ',' << (events.back().id() + 1)
                  << ')');
-      auto partition_full = self->state.active.events > 0
-        && self->state.active.events + events.size() > max_events;
-      if (partition_full || !self->state.active.partition) {
-        if (partition_full) {
-          VAST_DEBUG(self, "encountered full partition");
-          if (self->state.loaded.size() == self->state.capacity) {
-            VAST_DEBUG(self, "evicts active partition");
-            self->send(self->state.active.partition, shutdown_atom::value);
-          } else {
-            VAST_DEBUG(self, "moves active partition to cache");
-            self->state.loaded.emplace(self->state.active.id,
-                                       self->state.active.partition);
-          }
+      auto window = self->state.policy.window;
+      if (window == timespan::zero()) {
+        ingest(self, std::move(events));
+        return;
+      }
+      // Split the batch into runs of events within the same time window.
+      auto first = events.begin();
+      while (first != events.end()) {
+        auto w = window_of(first->timestamp(), window);
+        auto last = std::find_if(first + 1, events.end(), [&](auto& e) {
+          return window_of(e.timestamp(), window) != w;
+        });
+        if (first == events.begin() && last == events.end()) {
+          ingest(self, std::move(events));
+          return;
         }
-        auto id = uuid::random();
-        VAST_DEBUG(self, "spawns new active partition", id);
-        auto part_dir = self->state.dir / to_string(id);
-        auto part = self->spawn<monitored>(partition, part_dir);
-        self->state.active = {id, part, 0};
+        ingest(self, std::vector<event>(std::make_move_iterator(first),
+                                        std::make_move_iterator(last)));
+        first = last;
       }
-      self->state.active.events += events.size();
-      self->state.part_index.add(events, self->state.active.id);
-      auto msg = self->current_mailbox_element()->move_content_to_message();
-      self->send(self->state.active.partition, msg);
     },
-    [=](expression const& expr) -> result<uuid, size_t, size_t> {
-      auto sender = actor_cast<actor>(self->current_sender());
-      VAST_DEBUG(self, "got lookup:", expr);
-      // Identify the relevant partitions.
-      auto id = uuid::random();
-      auto partitions = self->state.part_index.lookup(expr);
-      if (partitions.empty()) {
-        VAST_DEBUG(self, "returns without result: no partitions qualify");
-        return {id, 0, 0};
-      }
-      // Construct a new lookup context.
-      VAST_DEBUG(self, "creates new lookup context", id);
-      auto ctx = self->state.lookups.insert({id, {expr, sender, {}}});
-      self->monitor(sender);
-      VAST_ASSERT(ctx.second);
-      // TODO: make initial value configurable and figure out a more meaningful
-      // way to select the first N partitions, e.g., based on accumulated
-      // summary statics.
-      auto num_partitions = partitions.size();
-      auto n = std::min(partitions.size(), taste_parts);
-      // Start processing to deliver a taste of the result.
-      VAST_DEBUG(self, "schedules first", n, "partition(s)");
-      for (auto i = partitions.end() - n; i != partitions.end(); ++i)
-        schedule(self, *i, id);
-      partitions.resize(partitions.size() - n);
-      ctx.first->second.partitions = std::move(partitions);
-      return {id, num_partitions, n};
+    [=](expression const& expr) {
+      lookup(expr, timestamp::max(), no_query_options);
     },
-    [=](uuid const& id, size_t n) {
-      auto& ctx = self->state.lookups[id];
+    [=](expression const& expr, timestamp deadline) {
+      lookup(expr, deadline, no_query_options);
+    },
+    [=](expression const& expr, timestamp deadline, query_options options) {
+      lookup(expr, deadline, options);
+    },
+    [=](uuid const& id, size_t n) -> size_t {
+      auto l = self->state.lookups.find(id);
+      if (l == self->state.lookups.end()) {
+        VAST_DEBUG(self, "ignores request for unknown lookup", id);
+        return 0;
+      }
+      auto& ctx = l->second;
       VAST_DEBUG(self, "processes lookup", id << ':', ctx.expr);
-      if (n == 0) {
-        VAST_DEBUG(self, "cancels lookup");
-        self->state.lookups.erase(id);
-        return;
+      if (n == 0 || expired(ctx)) {
+        cancel(self, id);
+        admit(self);
+        commit_merge(self);
+        return 0;
       }
-      n = std::min(ctx.partitions.size(), n);
+      // Scheduling more partitions than we can hold in memory would only
+      // cause them to evict each other. When multiple lookups compete, each
+      // gets its fair share.
+      n = std::min({ctx.partitions.size(), n, quota(self)});
       VAST_DEBUG(self, "schedules", n, "more partitions");
       for (auto i = ctx.partitions.end() - n; i != ctx.partitions.end(); ++i)
         schedule(self, *i, id);
       ctx.partitions.resize(ctx.partitions.size() - n);
+      prefetch(self, id);
+      finish_if_done(self, id);
+      admit(self);
+      commit_merge(self);
+      return n;
+    },
+    [=](cancel_atom, uuid const& id) {
+      cancel(self, id);
+      admit(self);
+      commit_merge(self);
+    },
+    [=](merge_atom, uuid const& id) {
+      VAST_ASSERT(self->state.merging.id == id);
+      VAST_DEBUG(self, "completed merge into partition", id);
+      self->state.merging.done = true;
+      commit_merge(self);
+    },
+    [=](merge_atom, uuid const& id, error const& e) {
+      VAST_ASSERT(self->state.merging.id == id);
+      VAST_WARNING(self, "failed to merge partitions:",
+                   self->system().render(e));
+      // Don't try the same partitions again.
+      abort_merge(self);
+      start_merge(self);
     },
   };
 }
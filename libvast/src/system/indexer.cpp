@@ -1,5 +1,9 @@
+#include <unordered_map>
+#include <vector>
+
 #include <caf/all.hpp>
 
+#include "vast/bitmap_formula.hpp"
 #include "vast/concept/parseable/to.hpp"
 #include "vast/concept/parseable/vast/type.hpp"
 #include "vast/concept/printable/stream.hpp"
@@ -14,365 +18,661 @@
 #include "vast/load.hpp"
 #include "vast/logger.hpp"
 #include "vast/offset.hpp"
+#include "vast/packfile.hpp"
 #include "vast/save.hpp"
+#include "vast/time.hpp"
 #include "vast/value_index.hpp"
 
+#include "vast/system/accountant.hpp"
 #include "vast/system/atoms.hpp"
 #include "vast/system/indexer.hpp"
+#include "vast/system/predicate_cache.hpp"
 
 using namespace caf;
 
 namespace vast {
 namespace system {
-namespace {
 
-struct value_indexer_state {
-  path filename;
-  vast::type type;
-  std::unique_ptr<value_index> idx;
-  value_index::size_type last_flush = 0;
-  const char* name = "value-indexer";
-};
+column_index::column_index(kind_type kind, path filename, type index_type,
+                           offset off)
+  : kind_{kind},
+    filename_{std::move(filename)},
+    type_{std::move(index_type)},
+    offset_{std::move(off)} {
+}
 
-// Wraps a value index into an actor.
-template <class Extract>
-behavior value_indexer(stateful_actor<value_indexer_state>* self,
-                       path filename, type index_type, Extract extract) {
-  self->state.type = std::move(index_type);
-  self->state.filename = std::move(filename);
-  if (exists(self->state.filename)) {
+expected<void> column_index::init(packfile const* pack) {
+  auto packed = pack && pack->contains(filename_);
+  if (packed || exists(filename_)) {
     // Materialize the index when encountering persistent state.
-    detail::value_index_inspect_helper tmp{self->state.type, self->state.idx};
-    auto result = load(self->state.filename, self->state.last_flush, tmp);
-    if (!result) {
-      VAST_ERROR(self, "failed to load bitmap index:",
-                 self->system().render(result.error()));
-      self->quit(result.error());
-    } else {
-      VAST_DEBUG(self, "loaded value index with offset",
-                 self->state.idx->offset());
-    }
+    detail::value_index_inspect_helper tmp{type_, idx_};
+    auto result = packed ? pack->load(filename_, last_flush_, tmp)
+                         : load(filename_, last_flush_, tmp);
+    if (!result)
+      return result;
   } else {
     // Otherwise construct a new one.
-    self->state.idx = value_index::make(self->state.type);
-    if (!self->state.idx)
-      self->quit(make_error(ec::unspecified, "failed to construct index"));
+    idx_ = value_index::make(type_);
+    if (!idx_)
+      return make_error(ec::unspecified, "failed to construct index");
   }
-  return {
-    [=](std::vector<event> const& events) {
-      VAST_TRACE(self, "got", events.size(), "events");
-      for (auto& e : events) {
-        VAST_ASSERT(e.id() != invalid_event_id);
-        if (auto data = extract(e)) {
-          auto result = self->state.idx->push_back(*data, e.id());
-          if (!result) {
-            VAST_ERROR(self->system().render(result.error()));
-            self->quit(result.error());
-            break;
-          }
-        }
-      }
-    },
-    [=](predicate const& pred) -> result<bitmap> {
-      VAST_TRACE(self, "got predicate:", pred);
-      return self->state.idx->lookup(pred.op, get<data>(pred.rhs));
-    },
-    [=](shutdown_atom) {
-      // Flush index to disk.
-      auto offset = self->state.idx->offset();
-      if (offset == self->state.last_flush) {
-        // Nothing to write.
-        self->quit(exit_reason::user_shutdown);
-        return;
-      }
-      // Create parent directory if it doesn't exist.
-      auto dir = self->state.filename.parent();
-      if (!exists(dir)) {
-        auto result = mkdir(dir);
-        if (!result) {
-          self->quit(result.error());
-          return;
-        }
-      }
-      VAST_DEBUG(self, "flushes index ("
-                 << (offset - self->state.last_flush) << '/' << offset,
-                 "new/total bits)");
-      self->state.last_flush = offset;
-      detail::value_index_inspect_helper tmp{self->state.type, self->state.idx};
-      auto result = save(self->state.filename, self->state.last_flush, tmp);
-      if (result)
-        self->quit(exit_reason::user_shutdown);
-      else
-        self->quit(result.error());
-    },
-  };
+  return {};
 }
 
-// In the current event indexing design, all indexers receive all events and
-// pick the aspect of the event that's relevant to them. For event meta data
-// indexers, every event is relevant. Event data indexers concern themselves
-// only with a specific aspect of an event.
-
-behavior time_indexer(stateful_actor<value_indexer_state>* self,
-                      path const& p) {
-  // TODO: add type attributes to tune index, e.g., for seconds granularity.
-  auto t = timestamp_type{};
-  auto extract = [](event const& e) { return optional<data>{e.timestamp()}; };
-  return value_indexer(self, p, t, extract);
+expected<void> column_index::add(event const& e) {
+  VAST_ASSERT(idx_);
+  VAST_ASSERT(e.id() != invalid_event_id);
+  switch (kind_) {
+    case time_column:
+      return idx_->push_back(e.timestamp(), e.id());
+    case data_column:
+      break;
+  }
+  if (offset_.empty())
+    return idx_->push_back(e.data(), e.id());
+  auto v = get_if<vector>(e.data());
+  if (!v)
+    return {};
+  if (auto x = get(*v, offset_))
+    return idx_->push_back(*x, e.id());
+  // If there is no data at a given offset, it means that an intermediate
+  // record is nil but we're trying to access a deeper field.
+  return idx_->push_back(nil, e.id());
 }
 
-behavior type_indexer(stateful_actor<value_indexer_state>* self,
-                      path const& p) {
-  auto t = string_type{};
-  auto extract = [](event const& e) { return optional<data>{e.type().name()}; };
-  return value_indexer(self, p, t, extract);
+expected<bitmap> column_index::lookup(relational_operator op,
+                                      data const& x) const {
+  VAST_ASSERT(idx_);
+  return idx_->lookup(op, x);
 }
 
-// Indexes the data from non-record event type.
-behavior flat_data_indexer(stateful_actor<value_indexer_state>* self,
-                           path dir, type event_type) {
-  auto extract = [=](event const& e) -> optional<data const&> {
-    if (e.type() != event_type)
-      return {};
-    return e.data();
-  };
-  return value_indexer(self, dir, event_type, extract);
+bitmap column_index::ids() const {
+  VAST_ASSERT(idx_);
+  return idx_->mask();
 }
 
-// Indexes a field of data from record event type.
-behavior field_data_indexer(stateful_actor<value_indexer_state>* self,
-                            path dir, type event_type, type value_type,
-                            offset off) {
-  auto extract = [=](event const& e) -> optional<data const&> {
-    if (e.type() != event_type)
-      return {};
-    auto v = get_if<vector>(e.data());
-    if (!v)
-      return {};
-    if (auto x = get(*v, off))
-      return *x;
-    // If there is no data at a given offset, it means that an intermediate
-    // record is nil but we're trying to access a deeper field.
-    static const auto nil_data = data{nil};
-    return nil_data;
-  };
-  return value_indexer(self, dir, value_type, extract);
+expected<void> column_index::flush() {
+  VAST_ASSERT(idx_);
+  auto offset = idx_->offset();
+  if (offset == last_flush_)
+    return {}; // Nothing to write.
+  // Create parent directory if it doesn't exist.
+  auto dir = filename_.parent();
+  if (!exists(dir)) {
+    auto result = mkdir(dir);
+    if (!result)
+      return result;
+  }
+  last_flush_ = offset;
+  // We flush an index when its indexer shuts down or its partition gets
+  // sealed, so the bitmaps are final and we can pick the most compact ones.
+  idx_->optimize();
+  detail::value_index_inspect_helper tmp{type_, idx_};
+  return save(filename_, last_flush_, tmp);
 }
 
-// Tests whether a type has a "skip" attribute.
-bool skip(type const& t) {
-  auto& attrs = t.attributes();
-  auto pred = [](auto& x) { return x.key == "skip"; };
-  return std::find_if(attrs.begin(), attrs.end(), pred) != attrs.end();
+expected<void> column_index::merge(column_index const& other) {
+  VAST_ASSERT(idx_);
+  VAST_ASSERT(other.idx_);
+  return idx_->merge(*other.idx_);
 }
 
-// Loads indexes for a predicate.
-struct loader {
-  using result_type = std::vector<actor>;
+path const& column_index::filename() const {
+  return filename_;
+}
 
-  template <class T>
-  result_type operator()(T const&) {
-    return {};
+namespace {
+
+using event_indexer_actor = stateful_actor<event_indexer_state>;
+
+// The type of the event timestamp column, which selects an exact time index.
+type time_column_type() {
+  return timestamp_type{}.attributes({{"index", "time"}});
+}
+
+// Checks whether the indexer operates on persistent state only.
+bool frozen(event_indexer_actor* self) {
+  return self->state.pack || exists(self->state.dir);
+}
+
+// Checks whether a column exists, without materializing it.
+bool has_column(event_indexer_actor* self, path const& p) {
+  if (self->state.columns.count(p) > 0)
+    return true;
+  if (!frozen(self))
+    return false;
+  auto& pack = self->state.pack;
+  return (pack && pack->contains(p)) || exists(p);
+}
+
+// Computes the location of the column for a data extractor.
+path column_path(event_indexer_actor* self, data_extractor const& dx) {
+  auto p = self->state.dir / "data";
+  if (!dx.offset.empty()) {
+    auto k = get<record_type>(dx.type).resolve(dx.offset);
+    VAST_ASSERT(k);
+    for (auto& key : *k)
+      p /= key;
   }
+  return p;
+}
 
-  template <class T, class U>
-  result_type operator()(T const&, U const&) {
-    return {};
+// Retrieves a column, materializing it from persistent state if needed.
+// Returns nullptr if the indexer has no such column and an error if the
+// column exists but fails to load.
+expected<column_index*>
+locate(event_indexer_actor* self, column_index::kind_type kind,
+       path const& p, type const& t, offset const& off = {}) {
+  auto i = self->state.columns.find(p);
+  if (i != self->state.columns.end())
+    return &i->second;
+  if (!has_column(self, p))
+    return nullptr;
+  auto& pack = self->state.pack;
+  VAST_DEBUG(self, "loads value index at", p);
+  auto col = column_index{kind, p, t, off};
+  auto result = col.init(pack.get());
+  if (!result)
+    return result.error();
+  return &self->state.columns.emplace(p, std::move(col)).first->second;
+}
+
+// Retrieves the column of event timestamps.
+expected<column_index*> locate_time_column(event_indexer_actor* self) {
+  auto p = self->state.dir / "meta" / "time";
+  return locate(self, column_index::time_column, p, time_column_type());
+}
+
+// Retrieves the column that a data extractor refers to.
+expected<column_index*> locate_data_column(event_indexer_actor* self,
+                                           data_extractor const& dx) {
+  auto p = column_path(self, dx);
+  if (dx.offset.empty())
+    return locate(self, column_index::data_column, p, dx.type);
+  auto t = get<record_type>(dx.type).at(dx.offset);
+  VAST_ASSERT(t);
+  return locate(self, column_index::data_column, p, *t, dx.offset);
+}
+
+// Retrieves the IDs of all events of the indexer. Every event has a
+// timestamp, so the time column covers them all.
+expected<bitmap> ids(event_indexer_actor* self) {
+  auto col = locate_time_column(self);
+  if (!col)
+    return col.error();
+  return *col ? (*col)->ids() : bitmap{};
+}
+
+// An estimate of the fraction of events that match an expression. Only the
+// flag *empty* is exact: it holds if the expression certainly matches no
+// event, e.g., because it refers to a column the indexer doesn't have.
+struct selectivity {
+  double fraction;
+  bool empty;
+};
+
+// Estimates the selectivity of a resolved expression, without performing a
+// lookup. The fractions only need to be good enough to rank the operands of a
+// conjunction, so we rely on cheap heuristics for the operator and use exact
+// values where the indexer knows them for free.
+struct selectivity_estimator {
+  using result_type = selectivity;
+
+  result_type operator()(none) const {
+    return {0.0, true};
   }
 
-  result_type operator()(disjunction const& d) {
-    result_type result;
+  result_type operator()(conjunction const& c) const {
+    result_type result{1.0, false};
+    for (auto& op : c) {
+      auto x = visit(*this, op);
+      result.fraction = std::min(result.fraction, x.fraction);
+      result.empty |= x.empty;
+    }
+    return result;
+  }
+
+  result_type operator()(disjunction const& d) const {
+    result_type result{0.0, true};
     for (auto& op : d) {
       auto x = visit(*this, op);
-      result.insert(result.end(),
-                    std::make_move_iterator(x.begin()),
-                    std::make_move_iterator(x.end()));
+      result.fraction += x.fraction;
+      result.empty &= x.empty;
     }
+    result.fraction = std::min(result.fraction, 1.0);
     return result;
   }
 
-  result_type operator()(predicate const& p) {
+  result_type operator()(negation const& n) const {
+    // The complement of an estimate is no longer exact.
+    return {1.0 - visit(*this, n.expr()).fraction, false};
+  }
+
+  result_type operator()(predicate const& p) const {
+    op = p.op;
     return visit(*this, p.lhs, p.rhs);
   }
 
-  result_type operator()(attribute_extractor const& ex, data const& x) {
-    result_type result;
-    auto p = self->state.dir / "meta";
+  result_type operator()(attribute_extractor const& ex, data const& x) const {
+    if (ex.attr == "type") {
+      // All events of an indexer have the same type.
+      if (is<std::string>(x)) {
+        auto match = vast::evaluate(self->state.event_type.name(), op, x);
+        return {match ? 1.0 : 0.0, !match};
+      }
+    } else if (ex.attr != "time") {
+      return {0.0, true};
+    }
+    return {estimate(op, x), false};
+  }
+
+  result_type operator()(data_extractor const& dx, data const& x) const {
+    // Predicates on columns we don't have cannot match.
+    if (dx.type != self->state.event_type
+        || !has_column(self, column_path(self, dx)))
+      return {0.0, true};
+    return {estimate(op, x), false};
+  }
+
+  template <class T, class U>
+  result_type operator()(T const&, U const&) const {
+    return {0.0, true};
+  }
+
+  static double estimate(relational_operator op, data const& x) {
+    switch (op) {
+      case equal:
+        return is<none>(x) ? 0.1 : 0.01;
+      case not_equal:
+        return is<none>(x) ? 0.9 : 0.99;
+      case match:
+      case in:
+      case ni:
+        return 0.05;
+      case not_match:
+      case not_in:
+      case not_ni:
+        return 0.95;
+      case less:
+      case less_equal:
+      case greater:
+      case greater_equal:
+        return 0.33;
+    }
+    return 1.0;
+  }
+
+  event_indexer_actor* self;
+  mutable relational_operator op;
+};
+
+// The results of the predicates evaluated for a batch of expressions.
+using predicate_memo = std::unordered_map<predicate, bitmap>;
+
+// Evaluates a resolved expression over the value indexes of an event indexer.
+struct evaluator {
+  using result_type = expected<bitmap>;
+
+  result_type operator()(none) const {
+    return bitmap{};
+  }
+
+  result_type operator()(conjunction const& c) const {
+    // Evaluate the most selective operands first, so that we can stop as soon
+    // as the intermediate result becomes empty. Only an operand that certainly
+    // matches nothing lets us skip the evaluation altogether, since the
+    // estimated fractions are mere heuristics.
+    std::vector<std::pair<double, size_t>> order;
+    order.reserve(c.size());
+    for (size_t i = 0; i < c.size(); ++i) {
+      auto estimate = visit(selectivity_estimator{self, {}}, c[i]);
+      if (estimate.empty) {
+        VAST_DEBUG(self, "skips conjunction with unsatisfiable operand", c[i]);
+        return bitmap{};
+      }
+      order.emplace_back(estimate.fraction, i);
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [](auto& x, auto& y) { return x.first < y.first; });
+    auto result = visit(*this, c[order[0].second]);
+    if (!result || result->empty() || all<0>(*result))
+      return result;
+    for (size_t i = 1; i < order.size(); ++i) {
+      auto x = visit(*this, c[order[i].second]);
+      if (!x)
+        return x;
+      *result &= *x;
+      if (result->empty() || all<0>(*result)) { // short-circuit
+        VAST_DEBUG(self, "skips", order.size() - i - 1,
+                   "remaining conjunction operand(s)");
+        return bitmap{};
+      }
+    }
+    return result;
+  }
+
+  result_type operator()(disjunction const& d) const {
+    // Collect the operands first and then combine them in a single pass,
+    // instead of materializing the union after every operand.
+    std::vector<bitmap> xs;
+    xs.reserve(d.size());
+    for (auto& op : d) {
+      auto x = visit(*this, op);
+      if (!x)
+        return x;
+      xs.push_back(std::move(*x));
+      if (all<1>(xs.back())) // short-circuit
+        break;
+    }
+    if (xs.empty())
+      return bitmap{};
+    auto result = bitmap_formula<bitmap>{xs[0]};
+    for (size_t i = 1; i < xs.size(); ++i)
+      result = result | xs[i];
+    return eval(result);
+  }
+
+  result_type operator()(negation const& n) const {
+    auto result = visit(*this, n.expr());
+    if (!result)
+      return result;
+    // Complement only within the IDs of the indexer.
+    auto all = ids(self);
+    if (!all)
+      return all;
+    return *all - *result;
+  }
+
+  result_type operator()(predicate const& p) const {
+    // Expressions of the same batch share the results of common predicates.
+    if (memo) {
+      auto i = memo->find(p);
+      if (i != memo->end()) {
+        ++self->state.shared_predicates;
+        return i->second;
+      }
+    }
+    auto result = lookup(p);
+    if (memo && result)
+      memo->emplace(p, *result);
+    return result;
+  }
+
+  result_type lookup(predicate const& p) const {
+    // Only sealed partitions are immutable, hence cacheable.
+    auto& cache = self->state.cache;
+    if (!cache || !self->state.pack) {
+      op = p.op;
+      return visit(*this, p.lhs, p.rhs);
+    }
+    if (auto hit = cache->lookup(self->state.dir, p)) {
+      ++self->state.cache_hits;
+      return std::move(*hit);
+    }
+    ++self->state.cache_misses;
+    op = p.op;
+    auto result = visit(*this, p.lhs, p.rhs);
+    if (result)
+      cache->add(self->state.dir, p, *result);
+    return result;
+  }
+
+  result_type operator()(attribute_extractor const& ex, data const& x) const {
     if (ex.attr == "time") {
       VAST_ASSERT(is<timestamp>(x));
-      p /= ex.attr;
-      VAST_DEBUG(self, "loads time index at", p);
-      auto& a = self->state.indexers[p];
-      if (!a)
-        a = self->spawn<monitored>(time_indexer, p);
-      result.push_back(a);
+      auto col = locate_time_column(self);
+      if (!col)
+        return col.error();
+      if (!*col)
+        return bitmap{};
+      return (*col)->lookup(op, x);
     } else if (ex.attr == "type") {
+      // All events of an indexer have the same type, so the predicate either
+      // matches all events or none.
       VAST_ASSERT(is<std::string>(x));
-      p /= ex.attr;
-      VAST_DEBUG(self, "loads type index at", p);
-      auto& a = self->state.indexers[p];
-      if (!a)
-        a = self->spawn<monitored>(type_indexer, p);
-      result.push_back(a);
-    } else {
-      VAST_WARNING(self, "got unsupported attribute:", ex.attr);
+      if (!vast::evaluate(self->state.event_type.name(), op, x))
+        return bitmap{};
+      return ids(self);
     }
-    return result;
+    VAST_WARNING(self, "got unsupported attribute:", ex.attr);
+    return bitmap{};
   }
 
-  result_type operator()(data_extractor const& dx, data const&) {
-    result_type result;
-    if (dx.offset.empty()) {
-      auto p = self->state.dir / "data";
-      VAST_DEBUG(self, "loads value index for", self->state.event_type.name());
-      auto& a = self->state.indexers[p];
-      if (!a)
-        a = self->spawn<monitored>(flat_data_indexer, p,
-                                   self->state.event_type);
-      result.push_back(a);
-    } else {
-      auto r = get<record_type>(dx.type);
-      auto k = r.resolve(dx.offset);
-      VAST_ASSERT(k);
-      auto t = r.at(dx.offset);
-      VAST_ASSERT(t);
-      auto p = self->state.dir / "data";
-      for (auto& x : *k)
-        p /= x;
-      VAST_DEBUG(self, "loads value index for", *k);
-      auto& a = self->state.indexers[p];
-      if (!a)
-        a = self->spawn<monitored>(field_data_indexer, p, dx.type, *t,
-                                   dx.offset);
-      result.push_back(a);
-    }
-    return result;
+  result_type operator()(data_extractor const& dx, data const& x) const {
+    if (dx.type != self->state.event_type)
+      return bitmap{};
+    auto col = locate_data_column(self, dx);
+    if (!col)
+      return col.error();
+    if (!*col)
+      return bitmap{};
+    return (*col)->lookup(op, x);
+  }
+
+  template <class T, class U>
+  result_type operator()(T const&, U const&) const {
+    return bitmap{};
   }
 
-  stateful_actor<event_indexer_state>* self;
+  event_indexer_actor* self;
+  mutable relational_operator op;
+  predicate_memo* memo;
 };
 
+// Materializes the columns that a resolved expression refers to, without
+// evaluating it.
+struct materializer {
+  void operator()(none) const {
+    // nop
+  }
+
+  void operator()(conjunction const& c) const {
+    for (auto& op : c)
+      visit(*this, op);
+  }
+
+  void operator()(disjunction const& d) const {
+    for (auto& op : d)
+      visit(*this, op);
+  }
+
+  void operator()(negation const& n) const {
+    visit(*this, n.expr());
+  }
+
+  void operator()(predicate const& p) const {
+    visit(*this, p.lhs, p.rhs);
+  }
+
+  void operator()(attribute_extractor const& ex, data const&) const {
+    // Type queries rely on the IDs of the time column.
+    if (ex.attr == "time" || ex.attr == "type")
+      check(locate_time_column(self));
+  }
+
+  void operator()(data_extractor const& dx, data const&) const {
+    if (dx.type == self->state.event_type)
+      check(locate_data_column(self, dx));
+  }
+
+  // Prefetching is best-effort: a later query reports the failure.
+  void check(expected<column_index*> const& col) const {
+    if (!col)
+      VAST_WARNING(self, "failed to prefetch value index:",
+                   self->system().render(col.error()));
+  }
+
+  template <class T, class U>
+  void operator()(T const&, U const&) const {
+    // nop
+  }
+
+  event_indexer_actor* self;
+};
+
+// Resolves an expression for the indexer's type and evaluates it.
+expected<bitmap> evaluate(event_indexer_actor* self, expression const& expr,
+                          predicate_memo* memo = nullptr) {
+  auto resolved = visit(type_resolver{self->state.event_type}, expr);
+  if (!resolved)
+    return resolved.error();
+  return visit(evaluator{self, {}, memo}, *resolved);
+}
+
+// Reports the cache activity since the last report to the accountant.
+void report(event_indexer_actor* self, accountant_type const& accountant) {
+  if (!accountant)
+    return;
+  if (self->state.cache_hits > 0)
+    self->send(accountant, "indexer.cache.hits", self->state.cache_hits);
+  if (self->state.cache_misses > 0)
+    self->send(accountant, "indexer.cache.misses", self->state.cache_misses);
+  if (self->state.shared_predicates > 0)
+    self->send(accountant, "indexer.predicates.shared",
+               self->state.shared_predicates);
+  self->state.cache_hits = 0;
+  self->state.cache_misses = 0;
+  self->state.shared_predicates = 0;
+}
+
 } // namespace <anonymous>
 
+std::vector<column_index> make_columns(path const& dir,
+                                       type const& event_type) {
+  std::vector<column_index> result;
+  // Create the index for event timestamps. We don't need an index for
+  // event types, because all events of an indexer have the same type.
+  result.emplace_back(column_index::time_column, dir / "meta" / "time",
+                      time_column_type());
+  // Create indexes for event data.
+  if (has_attribute(event_type, "skip"))
+    return result;
+  auto r = get_if<record_type>(event_type);
+  if (!r) {
+    result.emplace_back(column_index::data_column, dir / "data", event_type);
+    return result;
+  }
+  for (auto& f : record_type::each{*r}) {
+    auto& value_type = f.trace.back()->type;
+    if (has_attribute(value_type, "skip"))
+      continue;
+    auto p = dir / "data";
+    for (auto& k : f.key())
+      p /= k;
+    result.emplace_back(column_index::data_column, p, value_type, f.offset);
+  }
+  return result;
+}
+
 behavior event_indexer(stateful_actor<event_indexer_state>* self,
-                       path dir, type event_type) {
+                       path dir, type event_type,
+                       std::shared_ptr<packfile const> pack,
+                       std::shared_ptr<predicate_cache> cache) {
   self->state.dir = dir;
   self->state.event_type = event_type;
+  self->state.pack = std::move(pack);
+  self->state.cache = std::move(cache);
+  auto accountant = accountant_type{};
+  if (auto a = self->system().registry().get(accountant_atom::value))
+    accountant = actor_cast<accountant_type>(a);
   VAST_DEBUG(self, "operates for event", event_type);
-  // If the directory doesn't exist yet, we're in "construction" mode,
-  // where we spawn all indexers to be able to handle incoming events directly.
-  // Otherwise we deal with a "frozen" indexer that only spawns indexers as
-  // needed for answering queries.
-  if (!exists(dir)) {
-    VAST_DEBUG(self, "didn't find persistent state, spawning new indexers");
-    // Spawn indexers for event meta data.
-    auto p = dir / "meta" / "time";
-    auto a = self->spawn<monitored>(time_indexer, p);
-    self->state.indexers.emplace(p, a);
-    p = dir / "meta" / "type";
-    a = self->spawn<monitored>(type_indexer, p);
-    self->state.indexers.emplace(p, a);
-    // Spawn indexers for event data.
-    if (skip(event_type)) {
-      VAST_DEBUG(self, "skips event:", event_type);
-    } else {
-      auto r = get_if<record_type>(event_type);
-      if (!r) {
-        p = dir / "data";
-        VAST_DEBUG(self, "spawns data indexer");
-        a = self->spawn<monitored>(flat_data_indexer, p, event_type);
-        self->state.indexers.emplace(p, a);
-      } else {
-        for (auto& f : record_type::each{*r}) {
-          auto& value_type = f.trace.back()->type;
-          if (skip(value_type)) {
-            VAST_DEBUG(self, "skips record field:", f.key());
-          } else {
-            p = dir / "data";
-            for (auto& k : f.key())
-              p /= k;
-            VAST_DEBUG(self, "spawns field indexer at offset", f.offset,
-                       "with type", value_type);
-            a = self->spawn<monitored>(field_data_indexer, p, event_type,
-                                       value_type, f.offset);
-            self->state.indexers.emplace(p, a);
-          }
-        }
+  // If neither a packfile nor the directory exist, we're in "construction"
+  // mode, where we create all value indexes to be able to handle incoming
+  // events directly. Otherwise we deal with a "frozen" indexer that only
+  // loads value indexes as needed for answering queries.
+  if (!frozen(self)) {
+    VAST_DEBUG(self, "didn't find persistent state, creating new indexes");
+    for (auto& col : make_columns(dir, event_type)) {
+      VAST_DEBUG(self, "creates value index at", col.filename());
+      auto result = col.init(nullptr);
+      if (!result) {
+        VAST_ERROR(self, self->system().render(result.error()));
+        self->quit(result.error());
+        return {};
       }
+      auto p = col.filename();
+      self->state.columns.emplace(std::move(p), std::move(col));
     }
   }
-  // We monitor all indexers so that we can control the shutdown process
-  // explicitly.
-  auto remove_indexer = [=](auto& indexer) {
-    auto i = std::find_if(self->state.indexers.begin(),
-                          self->state.indexers.end(),
-                          [&](auto& p) { return p.second == indexer; });
-    VAST_ASSERT(i != self->state.indexers.end());
-    self->state.indexers.erase(i);
+  auto lookup = [=](expression const& expr) -> result<bitmap> {
+    VAST_DEBUG(self, "got expression:", expr);
+    auto hits = evaluate(self, expr);
+    report(self, accountant);
+    if (!hits)
+      return hits.error();
+    return std::move(*hits);
   };
-  self->set_down_handler(
-    [=](down_msg const& msg) { remove_indexer(msg.source); }
-  );
   return {
-    [=](std::vector<event> const&) {
-      auto msg = self->current_mailbox_element()->move_content_to_message();
-      for (auto& x : self->state.indexers)
-        self->send(x.second, msg);
+    [=](std::vector<event> const& events) {
+      VAST_TRACE(self, "got", events.size(), "events");
+      for (auto& e : events) {
+        if (e.type() != self->state.event_type)
+          continue;
+        for (auto& x : self->state.columns) {
+          auto result = x.second.add(e);
+          if (!result) {
+            VAST_ERROR(self, self->system().render(result.error()));
+            self->quit(result.error());
+            return;
+          }
+        }
+      }
+    },
+    [=](expression const& expr) {
+      return lookup(expr);
+    },
+    [=](expression const& expr, timestamp deadline) -> result<bitmap> {
+      if (deadline < std::chrono::system_clock::now()) {
+        VAST_DEBUG(self, "drops expired query:", expr);
+        return bitmap{};
+      }
+      return lookup(expr);
+    },
+    [=](std::vector<expression> const& exprs) -> result<std::vector<bitmap>> {
+      VAST_DEBUG(self, "got batch of", exprs.size(), "expressions");
+      predicate_memo memo;
+      std::vector<bitmap> result;
+      result.reserve(exprs.size());
+      for (auto& expr : exprs) {
+        auto hits = evaluate(self, expr, &memo);
+        if (!hits)
+          return hits.error();
+        result.push_back(std::move(*hits));
+      }
+      VAST_DEBUG(self, "evaluated", memo.size(), "distinct predicates");
+      report(self, accountant);
+      return result;
     },
-    [=](predicate const& pred) {
+    [=](predicate const& pred) -> result<bitmap> {
       VAST_DEBUG(self, "got predicate:", pred);
-      auto rp = self->make_response_promise<bitmap>();
       // For now, we require that the predicate is part of a normalized
       // expression, i.e., LHS an extractor type and RHS of type data.
-      auto rhs = get_if<data>(pred.rhs);
-      VAST_ASSERT(rhs);
-      auto resolved = type_resolver{self->state.event_type}(pred);
-      if (!resolved) {
-        VAST_DEBUG(self, "failed to resolve predicate:",
-                   self->system().render(resolved.error()));
-        rp.deliver(resolved.error());
-        return;
-      }
-
-      auto indexers = visit(loader{self}, *resolved);
-      // Forward predicate to all available indexers.
-      if (indexers.empty()) {
-        VAST_DEBUG(self, "did not find matching indexers for", pred);
-        rp.deliver(bitmap{});
-        return;
-      }
-      VAST_DEBUG(self, "asks", indexers.size(), "indexers");
-      // Manual map-reduce over the indexers.
-      auto n = std::make_shared<size_t>(indexers.size());
-      auto reducer = self->system().spawn([=]() mutable -> behavior {
-        auto result = std::make_shared<bitmap>();
-        return {
-          [=](const bitmap& bm) mutable {
-            if (!bm.empty())
-              *result |= bm;
-            if (--*n == 0)
-              rp.deliver(std::move(*result));
-          },
-          [=](error& e) mutable {
-            rp.deliver(std::move(e));
-          }
-        };
-      });
-      auto msg = self->current_mailbox_element()->move_content_to_message();
-      for (auto& x : indexers)
-        send_as(reducer, x, msg);
+      VAST_ASSERT(get_if<data>(pred.rhs));
+      auto hits = evaluate(self, expression{pred});
+      report(self, accountant);
+      if (!hits)
+        return hits.error();
+      return std::move(*hits);
+    },
+    [=](prefetch_atom, expression const& expr) {
+      VAST_DEBUG(self, "prefetches value indexes for:", expr);
+      auto resolved = visit(type_resolver{self->state.event_type}, expr);
+      if (resolved)
+        visit(materializer{self}, *resolved);
     },
     [=](shutdown_atom) {
-      for (auto& i : self->state.indexers)
-        self->send(i.second, shutdown_atom::value);
-      // Wait until all indexers have terminated.
-      self->set_down_handler(
-        [=](down_msg const& msg) {
-          remove_indexer(msg.source);
-          if (self->state.indexers.empty())
-            self->quit(exit_reason::user_shutdown);
+      // Flush indexes to disk.
+      for (auto& x : self->state.columns) {
+        VAST_DEBUG(self, "flushes index", x.first);
+        auto result = x.second.flush();
+        if (!result) {
+          VAST_ERROR(self, "failed to flush index:",
+                     self->system().render(result.error()));
+          self->quit(result.error());
+          return;
         }
-      );
+      }
+      self->quit(exit_reason::user_shutdown);
     },
   };
 }
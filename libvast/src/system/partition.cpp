@@ -1,3 +1,9 @@
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
 #include <caf/all.hpp>
 
 #include "vast/bitmap.hpp"
@@ -15,6 +21,7 @@
 #include "vast/expression_visitors.hpp"
 #include "vast/load.hpp"
 #include "vast/logger.hpp"
+#include "vast/packfile.hpp"
 #include "vast/save.hpp"
 #include "vast/time.hpp"
 
@@ -39,118 +46,261 @@ auto to_digest(const T& x) {
   return to_string(std::hash<T>{}(x));
 }
 
-struct collector_state {
-  bitmap hits;
-  size_t got = 0;
-  predicate pred;
-  std::string name = "collector";
-};
+// Restricts an expression resolved for a given type to the operands that the
+// type's INDEXER can answer. A predicate qualifies only if it refers to a
+// meta data attribute or a field with a value index. The result is `none` if
+// the INDEXER cannot contribute any hits.
+struct router {
+  expression operator()(none) const {
+    return {};
+  }
 
-// Encapsulates a single predicate that is part of one or more expressions.
-// The COLLECTOR receives hits from INDEXERs and relays them to the EVALUATORs
-// after having received all hits for the given predicate.
-behavior collector(stateful_actor<collector_state>* self, predicate pred,
-                   actor evaluator, size_t expected) {
-  self->state.name += '[' + to_string(pred) + ']';
-  self->state.pred = std::move(pred);
-  return {
-    [=](const bitmap& hits) {
-      VAST_DEBUG(self, "got", rank(hits), "hits,",
-                 (self->state.got + 1) << '/' << expected, "bitmaps");
-      self->state.hits |= hits;
-      if (++self->state.got == expected) {
-        VAST_DEBUG(self, "relays", rank(self->state.hits), "to evaluator");
-        self->send(evaluator, std::move(self->state.pred), self->state.hits);
-        self->quit();
-      }
+  expression operator()(conjunction const& c) const {
+    conjunction result;
+    for (auto& op : c) {
+      auto x = visit(*this, op);
+      if (is<none>(x))
+        return {}; // A single unsatisfiable operand dooms the conjunction.
+      result.push_back(std::move(x));
     }
-  };
-}
+    if (result.size() == 1)
+      return std::move(result[0]);
+    return result;
+  }
 
-struct bitmap_evaluator {
-  bitmap_evaluator(const std::unordered_map<predicate, bitmap>& bitmaps)
-    : bitmaps{bitmaps} {
-    // nop
+  expression operator()(disjunction const& d) const {
+    disjunction result;
+    for (auto& op : d) {
+      auto x = visit(*this, op);
+      if (!is<none>(x))
+        result.push_back(std::move(x));
+    }
+    if (result.empty())
+      return {};
+    if (result.size() == 1)
+      return std::move(result[0]);
+    return result;
   }
 
-  bitmap operator()(none) const {
-    return {};
+  expression operator()(negation const& n) const {
+    // The complement of an unsatisfiable expression is not unsatisfiable, so
+    // we must route negations verbatim.
+    return n;
   }
 
-  bitmap operator()(conjunction const& c) const {
-    auto bm = visit(*this, c[0]);
-    if (bm.empty() || all<0>(bm))
+  expression operator()(predicate const& p) const {
+    if (auto ex = get_if<attribute_extractor>(p.lhs)) {
+      if (ex->attr == "time")
+        return p;
+      if (ex->attr == "type") {
+        auto str = get_if<std::string>(p.rhs);
+        if (!str)
+          return {};
+        if (p.op == equal)
+          return *str == event_type.name() ? expression{p} : expression{};
+        if (p.op == not_equal)
+          return *str != event_type.name() ? expression{p} : expression{};
+        return p;
+      }
       return {};
-    for (size_t i = 1; i < c.size(); ++i) {
-      bm &= visit(*this, c[i]);
-      if (bm.empty() || all<0>(bm)) // short-circuit
+    }
+    if (auto dx = get_if<data_extractor>(p.lhs)) {
+      if (dx->type != event_type || has_attribute(event_type, "skip"))
         return {};
+      if (!dx->offset.empty()) {
+        auto t = get<record_type>(event_type).at(dx->offset);
+        if (!t || has_attribute(*t, "skip"))
+          return {};
+      }
+      return p;
     }
-    return bm;
+    return {};
   }
 
-  bitmap operator()(disjunction const& d) const {
-    bitmap bm;
-    for (auto& op : d) {
-      bm |= visit(*this, op);
-      if (all<1>(bm)) // short-circuit
-        break;
+  type const& event_type;
+};
+
+// For each known type, checks whether an expression could match. If so,
+// locates or loads the corresponding INDEXER and pairs it with the operands
+// that it can answer.
+std::vector<std::pair<actor, expression>>
+route(stateful_actor<partition_state>* self, path const& dir,
+      std::shared_ptr<predicate_cache> const& cache, expression const& expr) {
+  std::vector<std::pair<actor, expression>> result;
+  for (auto& x : self->state.indexers) {
+    auto resolved = visit(type_resolver{x.first}, expr);
+    if (!resolved)
+      continue;
+    auto routed = visit(router{x.first}, *resolved);
+    if (!is<none>(routed) && visit(matcher{x.first}, routed)) {
+      VAST_DEBUG(self, "routes", routed, "to indexer for type", x.first);
+      if (!x.second) {
+        VAST_DEBUG(self, "loads event-indexer for type", x.first);
+        auto indexer_dir = dir / to_digest(x.first);
+        x.second = self->spawn(event_indexer, indexer_dir, x.first,
+                               self->state.pack, cache);
+      }
+      result.emplace_back(x.second, std::move(routed));
     }
-    return bm;
   }
+  return result;
+}
 
-  bitmap operator()(negation const& n) const {
-    auto bm = visit(*this, n.expr());
-    bm.flip();
-    return bm;
-  }
+// The queries that a partition evaluates together, along with their
+// intermediate results.
+struct query_batch {
+  std::vector<pending_query> queries;
+  std::vector<bitmap> hits;
+  std::vector<size_t> remaining; // The number of outstanding INDEXER results.
+};
 
-  bitmap operator()(predicate const& pred) const {
-    auto i = bitmaps.find(pred);
-    return i != bitmaps.end() ? i->second : bitmap{};
+// Recursively collects all regular files below a directory.
+void collect_files(path const& dir, std::vector<path>& files) {
+  for (auto& p : directory{dir})
+    if (p.is_directory())
+      collect_files(p, files);
+    else if (p.is_regular_file())
+      files.push_back(p);
+}
+
+// Bundles all files of a partition into a single packfile and removes the
+// loose files only after the packfile is complete.
+expected<void> seal(path const& dir) {
+  auto filename = dir / "pack";
+  auto tmp = dir / "pack.tmp"; // Left behind by an interrupted seal.
+  std::vector<path> files;
+  collect_files(dir, files);
+  packfile::writer writer;
+  for (auto& file : files) {
+    if (file == filename || file == tmp)
+      continue;
+    // Blob names are relative to the partition directory.
+    auto name = file.str().substr(dir.str().size() + 1);
+    writer.add(std::move(name), file);
   }
+  auto result = writer.write(filename);
+  if (!result)
+    return result;
+  for (auto& p : directory{dir})
+    if (p != filename && !rm(p))
+      return make_error(ec::filesystem_error, "failed to remove", p);
+  return {};
+}
 
-  const std::unordered_map<predicate, bitmap>& bitmaps;
-};
+// The meta data of a partition begins with a magic constant and the version
+// of the on-disk format. The version covers the serialization of the value
+// indexes and their bitmaps, and must change whenever they do.
+constexpr uint32_t meta_magic = 0x54524150; // "PART"
+constexpr uint32_t meta_version = 1;
 
-struct evaluator_state {
-  bitmap hits;
-  std::unordered_map<predicate, bitmap> predicates;
-  const char* name = "evaluator";
-};
+expected<void> save_meta(path const& dir,
+                         std::vector<std::pair<std::string, type>> const& xs) {
+  return save(dir / "meta", meta_magic, meta_version, xs);
+}
 
-// Wraps a query expression in an actor. Upon receiving hits from COLLECTORs,
-// re-evaluates the expression and relays new hits to its sinks.
-behavior evaluator(stateful_actor<evaluator_state>* self,
-                   expression expr, size_t num_predicates, actor sink) {
-  return {
-    [=](predicate& pred, bitmap& hits) {
-      self->state.predicates.emplace(std::move(pred), std::move(hits));
-      auto expr_hits = visit(bitmap_evaluator{self->state.predicates}, expr);
-      auto delta = expr_hits - self->state.hits;
-      VAST_DEBUG(self, "evaluated",
-                 self->state.predicates.size() << '/' << num_predicates,
-                 "predicates, yielding",
-                 rank(delta) << '/' << rank(expr_hits),
-                 "new/total hits for", expr);
-      if (any<1>(delta)) {
-        VAST_DEBUG(self, "relays", rank(delta), "new hits to sink");
-        self->state.hits |= delta;
-        self->send(sink, std::move(delta));
+// Loads the meta data of a partition from its packfile, or from the loose
+// file if *pack* is `nullptr`. Partitions of a different format fail here
+// rather than later while deserializing their value indexes.
+expected<void> load_meta(path const& dir, packfile const* pack,
+                         std::vector<std::pair<std::string, type>>& xs) {
+  auto p = dir / "meta";
+  uint32_t magic = 0;
+  uint32_t version = 0;
+  auto result = pack ? pack->load(p, magic, version) : load(p, magic, version);
+  if (!result)
+    return result;
+  if (magic != meta_magic)
+    return make_error(ec::version_error, "partition without format version",
+                      dir);
+  if (version != meta_version)
+    return make_error(ec::version_error, "unsupported partition version",
+                      version, meta_version);
+  return pack ? pack->load(p, magic, version, xs)
+              : load(p, magic, version, xs);
+}
+
+} // namespace <anonymous>
+
+expected<void> merge_partitions(path const& dir,
+                                std::vector<path> const& parts) {
+  if (exists(dir))
+    return make_error(ec::filesystem_error, "partition exists already", dir);
+  // Load the columns of all partitions. A sealed partition has a column for
+  // each field of each of its types, and every event shows up in the time
+  // column of its type. This tells us the first ID of each partition.
+  struct source {
+    std::shared_ptr<packfile> pack;
+    std::unordered_map<type, std::vector<column_index>> columns;
+    event_id first = invalid_event_id;
+  };
+  std::vector<source> sources;
+  std::vector<std::pair<std::string, type>> meta;
+  for (auto& part : parts) {
+    source src;
+    auto pack = packfile::open(part / "pack");
+    if (!pack)
+      return pack.error();
+    src.pack = std::move(*pack);
+    std::vector<std::pair<std::string, type>> indexers;
+    auto result = load_meta(part, src.pack.get(), indexers);
+    if (!result)
+      return result;
+    for (auto& x : indexers) {
+      auto cols = make_columns(part / x.first, x.second);
+      for (auto& col : cols) {
+        result = col.init(src.pack.get());
+        if (!result)
+          return result;
       }
-      // We're done with evaluation if all predicates have reported their hits.
-      if (self->state.predicates.size() == num_predicates) {
-        VAST_DEBUG(self, "completed expression evaluation");
-        self->send(sink, done_atom::value);
-        self->quit();
+      auto ids = cols.front().ids();
+      auto first = select(ids, 1);
+      if (first != bitmap::word_type::npos)
+        src.first = std::min(src.first, first);
+      src.columns.emplace(x.second, std::move(cols));
+      auto pred = [&](auto& y) { return y.first == x.first; };
+      if (std::none_of(meta.begin(), meta.end(), pred))
+        meta.push_back(std::move(x));
+    }
+    sources.push_back(std::move(src));
+  }
+  // Value indexes only grow at the end, so we merge in ID order.
+  std::sort(sources.begin(), sources.end(),
+            [](auto& x, auto& y) { return x.first < y.first; });
+  auto result = mkdir(dir);
+  if (!result)
+    return result;
+  for (auto& x : meta) {
+    auto cols = make_columns(dir / x.first, x.second);
+    for (auto& col : cols) {
+      result = col.init(nullptr);
+      if (!result)
+        return result;
+    }
+    for (auto& src : sources) {
+      auto i = src.columns.find(x.second);
+      if (i == src.columns.end())
+        continue;
+      VAST_ASSERT(i->second.size() == cols.size());
+      for (size_t j = 0; j < cols.size(); ++j) {
+        result = cols[j].merge(i->second[j]);
+        if (!result)
+          return result;
       }
     }
-  };
+    for (auto& col : cols) {
+      result = col.flush();
+      if (!result)
+        return result;
+    }
+  }
+  result = save_meta(dir, meta);
+  if (!result)
+    return result;
+  return seal(dir);
 }
 
-} // namespace <anonymous>
-
-behavior partition(stateful_actor<partition_state>* self, path dir) {
+behavior partition(stateful_actor<partition_state>* self, path dir,
+                   std::shared_ptr<predicate_cache> cache) {
   auto accountant = accountant_type{};
   if (auto a = self->system().registry().get(accountant_atom::value))
     accountant = actor_cast<accountant_type>(a);
@@ -159,7 +309,19 @@ behavior partition(stateful_actor<partition_state>* self, path dir) {
   // them as we need them.
   if (exists(dir)) {
     std::vector<std::pair<std::string, type>> indexers;
-    auto result = load(dir / "meta", indexers);
+    auto result = expected<void>{no_error};
+    if (exists(dir / "pack")) {
+      // A sealed partition resides in a single packfile.
+      auto pack = packfile::open(dir / "pack");
+      if (pack) {
+        self->state.pack = std::move(*pack);
+        result = load_meta(dir, self->state.pack.get(), indexers);
+      } else {
+        result = pack.error();
+      }
+    } else {
+      result = load_meta(dir, nullptr, indexers);
+    }
     if (!result) {
       VAST_ERROR(self, self->system().render(result.error()));
       self->quit(result.error());
@@ -169,6 +331,83 @@ behavior partition(stateful_actor<partition_state>* self, path dir) {
     for (auto& x : indexers)
       self->state.indexers.emplace(x.second, actor{});
   }
+  // Queues an expression for evaluation. All expressions that arrive before
+  // the subsequent run_atom form a batch.
+  auto enqueue = [=](expression const& expr, timestamp deadline) {
+    VAST_DEBUG(self, "got expression:", expr);
+    if (self->state.pending.empty())
+      self->send(self, run_atom::value);
+    self->state.pending.push_back({expr, deadline,
+                                   self->make_response_promise<bitmap>(),
+                                   steady_clock::now()});
+  };
+  // Evaluates all pending expressions. Each INDEXER evaluates the entire
+  // expressions in-process over its value indexes. Since INDEXERs run in
+  // parallel on the scheduler's worker threads, we only have to combine
+  // their results.
+  auto run = [=] {
+    auto batch = std::make_shared<query_batch>();
+    batch->queries = std::move(self->state.pending);
+    self->state.pending.clear();
+    auto n = batch->queries.size();
+    VAST_DEBUG(self, "evaluates batch of", n, "expression(s)");
+    batch->hits.resize(n);
+    batch->remaining.resize(n, 0);
+    // Group the operands by INDEXER, so that each INDEXER receives a single
+    // message for the entire batch.
+    std::unordered_map<actor, std::pair<std::vector<expression>,
+                                        std::vector<size_t>>> work;
+    for (size_t i = 0; i < n; ++i) {
+      auto& q = batch->queries[i];
+      // A query that expired while we were loading or waiting in the mailbox
+      // has no consumer for the result anymore.
+      if (q.deadline < system_clock::now()) {
+        VAST_DEBUG(self, "drops expired query:", q.expr);
+        continue;
+      }
+      for (auto& x : route(self, dir, cache, q.expr)) {
+        auto& w = work[x.first];
+        w.first.push_back(std::move(x.second));
+        w.second.push_back(i);
+        ++batch->remaining[i];
+      }
+    }
+    for (size_t i = 0; i < n; ++i)
+      if (batch->remaining[i] == 0)
+        batch->queries[i].promise.deliver(bitmap{});
+    for (auto& w : work) {
+      auto ids = std::move(w.second.second);
+      self->request(w.first, infinite, std::move(w.second.first)).then(
+        [=](std::vector<bitmap>& xs) {
+          VAST_ASSERT(xs.size() == ids.size());
+          for (size_t j = 0; j < ids.size(); ++j) {
+            auto i = ids[j];
+            if (batch->remaining[i] == 0)
+              continue; // A previous error already completed the request.
+            auto& q = batch->queries[i];
+            batch->hits[i] |= xs[j];
+            if (--batch->remaining[i] > 0)
+              continue;
+            timespan runtime = steady_clock::now() - q.start;
+            VAST_DEBUG(self, "answered", q.expr, "in", runtime);
+            if (accountant)
+              self->send(accountant, "partition.query.runtime", runtime);
+            q.promise.deliver(std::move(batch->hits[i]));
+          }
+        },
+        [=](error& e) {
+          VAST_ERROR(self, "failed to evaluate expressions:",
+                     self->system().render(e));
+          for (auto i : ids) {
+            if (batch->remaining[i] == 0)
+              continue;
+            batch->remaining[i] = 0;
+            batch->queries[i].promise.deliver(e);
+          }
+        }
+      );
+    }
+  };
   return {
     [=](std::vector<event> const& events) {
       VAST_ASSERT(!events.empty());
@@ -179,7 +418,8 @@ behavior partition(stateful_actor<partition_state>* self, path dir) {
         auto& i = self->state.indexers[e.type()];
         if (!i) {
           VAST_DEBUG(self, "creates event-indexer for type", e.type());
-          i = self->spawn(event_indexer, dir / to_digest(e.type()), e.type());
+          i = self->spawn(event_indexer, dir / to_digest(e.type()), e.type(),
+                          self->state.pack, cache);
         }
         indexers.insert(i);
       }
@@ -189,67 +429,54 @@ behavior partition(stateful_actor<partition_state>* self, path dir) {
         self->send(indexer, msg);
     },
     [=](expression const& expr) {
-      VAST_DEBUG(self, "got expression:", expr);
-      auto start = steady_clock::now();
-      auto rp = self->make_response_promise<bitmap>();
-      // For each known type, check whether the expression could match.
-      // If so, locate/load the corresponding indexer.
-      std::vector<actor> indexers;
-      for (auto& x : self->state.indexers) {
-        auto resolved = visit(type_resolver{x.first}, expr);
-        if (resolved && visit(matcher{x.first}, *resolved)) {
-          VAST_DEBUG(self, "found matching type for expression:", x.first);
-          if (!x.second) {
-            VAST_DEBUG(self, "loads event-indexer for type", x.first);
-            auto indexer_dir = dir / to_digest(x.first);
-            x.second = self->spawn(event_indexer, indexer_dir, x.first);
-          }
-          indexers.push_back(x.second);
-        }
-      }
-      if (indexers.empty()) {
-        VAST_DEBUG(self, "did not find a matching type in",
-                   self->state.indexers.size(), "indexer(s)");
-        rp.deliver(bitmap{});
-        return;
-      }
-      // Spawn a sink that accumulates the stream of bitmaps from the evaluator
-      // and ultimately responds to the user with the result.
-      auto accumulator = self->system().spawn(
-        [=](event_based_actor* job) mutable -> behavior {
-          auto result = std::make_shared<bitmap>();
-          return {
-            [=](const bitmap& hits) mutable {
-              VAST_ASSERT(any<1>(hits));
-              *result |= hits;
-            },
-            [=](done_atom) mutable {
-              auto stop = steady_clock::now();
-              rp.deliver(std::move(*result));
-              timespan runtime = stop - start;
-              VAST_DEBUG(self, "answered", expr, "in", runtime);
-              if (accountant)
-                job->send(accountant, "partition.query.runtime", runtime);
-              job->quit();
-            }
-          };
-        }
-      );
-      // Spawn a dedicated actor responsible for expression evaluation. This
-      // actor re-evaluates the expression whenever it receives new hits from
-      // a collector.
-      auto predicates = visit(predicatizer{}, expr);
-      auto eval = self->spawn(evaluator, expr, predicates.size(), accumulator);
-      for (auto& pred : predicates) {
-        // FIXME: locate the smallest subset of indexers (checking whether the
-        // predicate could match the type of the indexer) instead of querying
-        // all indexers.
-        auto coll = self->spawn(collector, pred, eval, indexers.size());
-        for (auto& x : indexers)
-          send_as(coll, x, pred);
-      }
+      enqueue(expr, timestamp::max());
+    },
+    [=](expression const& expr, timestamp deadline) {
+      enqueue(expr, deadline);
+    },
+    [=](run_atom) {
+      run();
+    },
+    [=](prefetch_atom, expression const& expr) {
+      VAST_DEBUG(self, "prefetches indexers for:", expr);
+      for (auto& x : route(self, dir, cache, expr))
+        self->send(x.first, prefetch_atom::value, std::move(x.second));
     },
     [=](shutdown_atom) {
+      // Evaluate pending queries before the INDEXERs go away.
+      if (!self->state.pending.empty())
+        run();
+      // A partition loaded from a packfile has no new state to write.
+      auto sealed = self->state.pack != nullptr;
+      std::vector<std::pair<std::string, type>> meta;
+      meta.reserve(self->state.indexers.size());
+      for (auto& x : self->state.indexers)
+        meta.emplace_back(to_digest(x.first), x.first);
+      // Once all indexers have flushed their state, we persist the meta data
+      // and bundle everything into a packfile.
+      auto persist = [=]() -> expected<void> {
+        if (sealed)
+          return {};
+        if (!exists(dir)) {
+          auto result = mkdir(dir);
+          if (!result)
+            return result;
+        }
+        auto result = save_meta(dir, meta);
+        if (!result)
+          return result;
+        VAST_DEBUG(self, "seals partition in", dir / "pack");
+        return seal(dir);
+      };
+      auto finish = [=] {
+        auto result = persist();
+        if (result) {
+          self->quit(exit_reason::user_shutdown);
+        } else {
+          VAST_ERROR(self, self->system().render(result.error()));
+          self->quit(result.error());
+        }
+      };
       for (auto i = self->state.indexers.begin();
            i != self->state.indexers.end(); )
         if (!i->second)
@@ -257,6 +484,7 @@ behavior partition(stateful_actor<partition_state>* self, path dir) {
         else
           ++i;
       if (self->state.indexers.empty()) {
+        // No INDEXER came to life, hence there's nothing to persist.
         self->quit(exit_reason::user_shutdown);
         return;
       }
@@ -272,20 +500,9 @@ behavior partition(stateful_actor<partition_state>* self, path dir) {
           VAST_ASSERT(i != self->state.indexers.end());
           self->state.indexers.erase(i);
           if (self->state.indexers.empty())
-            self->quit(exit_reason::user_shutdown);
+            finish();
         }
       );
-      // Save persistent state.
-      // TODO: only do so when the partition got dirty.
-      std::vector<std::pair<std::string, type>> indexers;
-      indexers.reserve(self->state.indexers.size());
-      for (auto& x : self->state.indexers)
-        indexers.emplace_back(to_digest(x.first), x.first);
-      if (!exists(dir))
-        mkdir(dir);
-      auto result = save(dir / "meta", indexers);
-      if (!result)
-        self->quit(result.error());
     },
   };
 }
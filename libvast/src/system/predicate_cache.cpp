@@ -0,0 +1,66 @@
+#include <vector>
+
+#include "vast/system/predicate_cache.hpp"
+
+namespace vast {
+namespace system {
+
+predicate_cache::predicate_cache(size_t capacity) : cache_{capacity} {
+}
+
+optional<bitmap> predicate_cache::lookup(path const& dir,
+                                         predicate const& pred) {
+  std::lock_guard<std::mutex> guard{mutex_};
+  auto i = cache_.find(predicate_cache_key{dir, pred});
+  if (i == cache_.end()) {
+    ++misses_;
+    return {};
+  }
+  ++hits_;
+  return i->second;
+}
+
+void predicate_cache::add(path dir, predicate pred, bitmap bm) {
+  std::lock_guard<std::mutex> guard{mutex_};
+  auto key = predicate_cache_key{std::move(dir), std::move(pred)};
+  auto i = cache_.find(key);
+  if (i != cache_.end())
+    i->second = std::move(bm);
+  else
+    cache_.emplace(std::move(key), std::move(bm));
+}
+
+size_t predicate_cache::invalidate(path const& dir) {
+  std::lock_guard<std::mutex> guard{mutex_};
+  auto& prefix = dir.str();
+  auto below = [&](path const& p) {
+    auto& str = p.str();
+    return str.compare(0, prefix.size(), prefix) == 0
+      && (str.size() == prefix.size() || str[prefix.size()] == '/');
+  };
+  std::vector<predicate_cache_key> victims;
+  for (auto& x : cache_)
+    if (below(x.first.dir))
+      victims.push_back(x.first);
+  for (auto& x : victims)
+    cache_.erase(x);
+  return victims.size();
+}
+
+uint64_t predicate_cache::hits() const {
+  std::lock_guard<std::mutex> guard{mutex_};
+  return hits_;
+}
+
+uint64_t predicate_cache::misses() const {
+  std::lock_guard<std::mutex> guard{mutex_};
+  return misses_;
+}
+
+size_t predicate_cache::size() const {
+  std::lock_guard<std::mutex> guard{mutex_};
+  return cache_.size();
+}
+
+} // namespace system
+} // namespace vast
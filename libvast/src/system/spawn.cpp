@@ -4,6 +4,7 @@
 
 #include "vast/concept/parseable/to.hpp"
 #include "vast/concept/parseable/vast/expression.hpp"
+#include "vast/concept/parseable/vast/time.hpp"
 #include "vast/concept/printable/vast/expression.hpp"
 #include "vast/data.hpp"
 #include "vast/expression.hpp"
@@ -43,11 +44,15 @@ expected<actor> spawn_archive(local_actor* self, options& opts) {
 
 expected<actor> spawn_exporter(local_actor* self, options& opts) {
   auto limit = uint64_t{0};
+  std::string timeout;
   auto r = opts.params.extract_opts({
     {"continuous,c", "marks a query as continuous"},
     {"historical,h", "marks a query as historical"},
     {"unified,u", "marks a query as unified"},
+    {"background,b", "marks a query as low-priority batch job"},
     {"limit,l", "limit the number of results", limit},
+    {"timeout,t", "abort the query after a duration, e.g., '30 seconds'",
+     timeout},
   }, nullptr, true);
   if (!r.error.empty())
     return make_error(ec::syntax_error, r.error);
@@ -63,6 +68,14 @@ expected<actor> spawn_exporter(local_actor* self, options& opts) {
   expr = normalize_and_validate(*expr);
   if (!expr)
     return expr.error();
+  // Parse the timeout.
+  auto runtime = timespan::zero();
+  if (!timeout.empty()) {
+    auto t = to<timespan>(timeout);
+    if (!t || *t <= timespan::zero())
+      return make_error(ec::syntax_error, "invalid timeout", timeout);
+    runtime = *t;
+  }
   // Parse query options.
   auto query_opts = no_query_options;
   if (r.opts.count("continuous") > 0)
@@ -74,9 +87,15 @@ expected<actor> spawn_exporter(local_actor* self, options& opts) {
   // Default to historical if no options provided.
   if (query_opts == no_query_options)
     query_opts = historical;
+  if (r.opts.count("background") > 0)
+    query_opts = query_opts + background;
   auto exp = self->spawn(exporter, std::move(*expr), query_opts);
-  if (limit > 0)
+  if (runtime > timespan::zero())
+    anon_send(exp, deadline_atom::value, runtime);
+  if (limit > 0) {
+    anon_send(exp, limit_atom::value, limit);
     anon_send(exp, extract_atom::value, limit);
+  }
   else
     anon_send(exp, extract_atom::value);
   return exp;
@@ -94,19 +113,40 @@ expected<actor> spawn_importer(local_actor* self, options& opts) {
 }
 
 expected<actor> spawn_index(local_actor* self, options& opts) {
-  size_t max_events = 1 << 20;
+  auto policy = partition_policy{};
+  size_t max_mb = 0;
+  std::string window;
   size_t max_parts = 10;
   size_t taste_parts = 5;
+  size_t cache_size = 4096;
+  auto scheduling = scheduling_policy{};
   auto r = opts.params.extract_opts({
-    {"max-events,e", "maximum events per partition", max_events},
+    {"max-events,e", "maximum events per partition (0 = unlimited)",
+     policy.max_events},
+    {"max-size,s", "maximum partition size in MB (0 = unlimited)", max_mb},
+    {"window,w", "time window per partition, e.g., '1 hour'", window},
+    {"merge,m", "merge small sealed partitions in the background"},
     {"max-parts,p", "maximum number of in-memory partitions", max_parts},
-    {"taste-parts,p", "number of immediately scheduled partitions", taste_parts}
+    {"taste-parts,t", "number of immediately scheduled partitions",
+     taste_parts},
+    {"cache-size,c", "maximum number of cached predicate results "
+                     "(0 = disabled)", cache_size},
+    {"max-lookups,l", "maximum number of concurrent lookups (0 = unlimited)",
+     scheduling.max_lookups},
   });
   opts.params = r.remainder;
   if (!r.error.empty())
     return make_error(ec::syntax_error, r.error);
-  return self->spawn(index, opts.dir / opts.label, max_events, max_parts,
-                     taste_parts);
+  policy.max_bytes = max_mb << 20; // MB'ify.
+  policy.merge = r.opts.count("merge") > 0;
+  if (!window.empty()) {
+    auto w = to<timespan>(window);
+    if (!w || *w <= timespan::zero())
+      return make_error(ec::syntax_error, "invalid time window", window);
+    policy.window = *w;
+  }
+  return self->spawn(index, opts.dir / opts.label, policy, max_parts,
+                     taste_parts, cache_size, scheduling);
 }
 
 expected<actor> spawn_metastore(local_actor* self, options& opts) {
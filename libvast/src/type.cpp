@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <tuple>
 
 #include "vast/concept/printable/to_string.hpp"
@@ -453,6 +454,12 @@ bool is_container(const data& x) {
   return is<vector>(x) || is<set>(x) || is<table>(x);
 }
 
+bool has_attribute(const type& t, const std::string& key) {
+  auto& attrs = t.attributes();
+  auto pred = [&](auto& x) { return x.key == key; };
+  return std::find_if(attrs.begin(), attrs.end(), pred) != attrs.end();
+}
+
 namespace {
 
 struct type_congruence_checker {
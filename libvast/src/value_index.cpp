@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <cmath>
+#include <typeinfo>
 
 #include "vast/base.hpp"
 #include "vast/concept/parseable/numeric/integral.hpp"
@@ -16,13 +18,14 @@ optional<std::string> extract_attribute(type const& t, std::string const& key) {
   return {};
 }
 
-optional<base> parse_base(type const& t) {
+// Bit-sliced indexes use a default base of 2, i.e., one component per bit.
+optional<base> parse_base(type const& t, size_t default_base = 10) {
   if (auto a = extract_attribute(t, "base")) {
     if (auto b = to<base>(*a))
       return *b;
     return {};
   }
-  return base::uniform<64>(10);
+  return base::uniform<64>(default_base);
 }
 
 } // namespace <anonymous>
@@ -37,15 +40,21 @@ std::unique_ptr<value_index> value_index::make(type const& t) {
       return std::make_unique<arithmetic_index<boolean>>();
     }
     result_type operator()(integer_type const& t) const {
-      auto b = parse_base(t);
+      auto bitslice = uses_bitslice_encoding(t);
+      auto b = parse_base(t, bitslice ? 2 : 10);
       if (!b)
         return nullptr;
+      if (bitslice)
+        return std::make_unique<bitslice_index<integer>>(std::move(*b));
       return std::make_unique<arithmetic_index<integer>>(std::move(*b));
     }
     result_type operator()(count_type const& t) const {
-      auto b = parse_base(t);
+      auto bitslice = uses_bitslice_encoding(t);
+      auto b = parse_base(t, bitslice ? 2 : 10);
       if (!b)
         return nullptr;
+      if (bitslice)
+        return std::make_unique<bitslice_index<count>>(std::move(*b));
       return std::make_unique<arithmetic_index<count>>(std::move(*b));
     }
     result_type operator()(real_type const& t) const {
@@ -55,12 +64,17 @@ std::unique_ptr<value_index> value_index::make(type const& t) {
       return std::make_unique<arithmetic_index<real>>(std::move(*b));
     }
     result_type operator()(timespan_type const& t) const {
-      auto b = parse_base(t);
+      auto bitslice = uses_bitslice_encoding(t);
+      auto b = parse_base(t, bitslice ? 2 : 10);
       if (!b)
         return nullptr;
+      if (bitslice)
+        return std::make_unique<bitslice_index<timespan>>(std::move(*b));
       return std::make_unique<arithmetic_index<timespan>>(std::move(*b));
     }
     result_type operator()(timestamp_type const& t) const {
+      if (time_index::applies(t))
+        return std::make_unique<time_index>();
       auto b = parse_base(t);
       if (!b)
         return nullptr;
@@ -85,7 +99,9 @@ std::unique_ptr<value_index> value_index::make(type const& t) {
     result_type operator()(subnet_type const&) const {
       return std::make_unique<subnet_index>();
     }
-    result_type operator()(port_type const&) const {
+    result_type operator()(port_type const& t) const {
+      if (uses_bitslice_encoding(t))
+        return std::make_unique<bitslice_port_index>();
       return std::make_unique<port_index>();
     }
     result_type operator()(enumeration_type const&) const {
@@ -174,10 +190,211 @@ value_index::lookup(relational_operator op, data const& x) const {
   return (*result - none_) & mask_;
 }
 
+expected<void> value_index::merge(value_index const& other) {
+  if (typeid(*this) != typeid(other))
+    return make_error(ec::type_clash, "cannot merge different value indexes");
+  auto off = offset();
+  auto first = select(other.mask_, 1);
+  if (first == ewah_bitmap::word_type::npos)
+    return {};
+  if (first < off)
+    // Can only merge at the end.
+    return make_error(ec::unspecified, first, '<', off);
+  if (!merge_impl(other))
+    return make_error(ec::unspecified, "merge_impl");
+  // The nested index lags behind by the number of trailing nils.
+  if (any<1>(other.mask_ - other.none_))
+    nils_ = other.nils_;
+  else
+    nils_ += other.offset() - off;
+  mask_.append_bits(false, first - off);
+  mask_.append_from(other.mask_, first);
+  none_.append_bits(false, first - off);
+  none_.append_from(other.none_, first);
+  return {};
+}
+
+void value_index::optimize() {
+  optimize_impl();
+}
+
 value_index::size_type value_index::offset() const {
   return mask_.size(); // none_ would work just as well.
 }
 
+ewah_bitmap const& value_index::mask() const {
+  return mask_;
+}
+
+
+constexpr size_t time_index::block_size;
+
+bool time_index::applies(timestamp_type const& t) {
+  auto a = extract_attribute(t, "index");
+  return a && *a == "time";
+}
+
+void time_index::append(value_type x) {
+  if (values_.size() % block_size == 0)
+    zones_.push_back({x, x, true});
+  auto& z = zones_.back();
+  if (values_.size() % block_size != 0 && x < values_.back())
+    z.sorted = false;
+  z.min = std::min(z.min, x);
+  z.max = std::max(z.max, x);
+  values_.push_back(x);
+}
+
+bool time_index::push_back_impl(data const& x, size_type skip) {
+  auto t = get_if<timestamp>(x);
+  if (!t)
+    return false;
+  auto value = t->time_since_epoch().count();
+  // The base class masks out skipped positions, so any value works for them.
+  // Repeating the new value keeps sorted runs intact.
+  for (auto i = 0u; i < skip; ++i)
+    append(value);
+  append(value);
+  return true;
+}
+
+namespace {
+
+template <class T>
+bool satisfies(T x, relational_operator op, T y) {
+  switch (op) {
+    default:
+      return false;
+    case equal:
+      return x == y;
+    case not_equal:
+      return x != y;
+    case less:
+      return x < y;
+    case less_equal:
+      return x <= y;
+    case greater:
+      return x > y;
+    case greater_equal:
+      return x >= y;
+  }
+}
+
+} // namespace <anonymous>
+
+expected<bitmap>
+time_index::lookup_impl(relational_operator op, data const& x) const {
+  auto t = get_if<timestamp>(x);
+  if (!t)
+    return make_error(ec::type_clash, x);
+  switch (op) {
+    default:
+      return make_error(ec::unsupported_operator, op);
+    case equal:
+    case not_equal:
+    case less:
+    case less_equal:
+    case greater:
+    case greater_equal:
+      break;
+  }
+  auto v = t->time_since_epoch().count();
+  bitmap result;
+  for (auto i = 0u; i < zones_.size(); ++i) {
+    auto& z = zones_[i];
+    auto first = values_.begin() + i * block_size;
+    auto last = values_.begin() + std::min(values_.size(),
+                                           (i + 1) * block_size);
+    auto n = static_cast<size_type>(last - first);
+    // Resolve the entire block from its zone map if possible.
+    auto all = false;
+    auto none = false;
+    switch (op) {
+      default:
+        break;
+      case equal:
+        all = z.min == v && z.max == v;
+        none = v < z.min || v > z.max;
+        break;
+      case not_equal:
+        all = v < z.min || v > z.max;
+        none = z.min == v && z.max == v;
+        break;
+      case less:
+        all = z.max < v;
+        none = z.min >= v;
+        break;
+      case less_equal:
+        all = z.max <= v;
+        none = z.min > v;
+        break;
+      case greater:
+        all = z.min > v;
+        none = z.max <= v;
+        break;
+      case greater_equal:
+        all = z.min >= v;
+        none = z.max < v;
+        break;
+    }
+    if (all || none) {
+      result.append_bits(all, n);
+      continue;
+    }
+    if (!z.sorted) {
+      for (auto j = first; j != last; ++j)
+        result.append_bit(satisfies(*j, op, v));
+      continue;
+    }
+    // In a sorted block, the values equal to v form a contiguous range.
+    auto lower = static_cast<size_type>(std::lower_bound(first, last, v)
+                                        - first);
+    auto upper = static_cast<size_type>(std::upper_bound(first, last, v)
+                                        - first);
+    switch (op) {
+      default:
+        break;
+      case equal:
+        result.append_bits(false, lower);
+        result.append_bits(true, upper - lower);
+        result.append_bits(false, n - upper);
+        break;
+      case not_equal:
+        result.append_bits(true, lower);
+        result.append_bits(false, upper - lower);
+        result.append_bits(true, n - upper);
+        break;
+      case less:
+        result.append_bits(true, lower);
+        result.append_bits(false, n - lower);
+        break;
+      case less_equal:
+        result.append_bits(true, upper);
+        result.append_bits(false, n - upper);
+        break;
+      case greater:
+        result.append_bits(false, upper);
+        result.append_bits(true, n - upper);
+        break;
+      case greater_equal:
+        result.append_bits(false, lower);
+        result.append_bits(true, n - lower);
+        break;
+    }
+  }
+  return result;
+}
+
+bool time_index::merge_impl(value_index const& other) {
+  auto& x = static_cast<time_index const&>(other);
+  for (auto i = values_.size(); i < x.values_.size(); ++i)
+    append(x.values_[i]);
+  return true;
+}
+
+void time_index::optimize_impl() {
+  // Stores no bitmaps.
+}
 
 string_index::string_index(size_t max_length) : max_length_{max_length} {
 }
@@ -272,6 +489,25 @@ string_index::lookup_impl(relational_operator op, data const& x) const {
   }
 }
 
+bool string_index::merge_impl(value_index const& other) {
+  auto& x = static_cast<string_index const&>(other);
+  if (x.length_.coder().storage().empty())
+    return true;
+  init();
+  length_.merge(x.length_);
+  if (x.chars_.size() > chars_.size())
+    chars_.resize(x.chars_.size(), char_bitmap_index{8});
+  for (auto i = 0u; i < x.chars_.size(); ++i)
+    chars_[i].merge(x.chars_[i]);
+  return true;
+}
+
+void string_index::optimize_impl() {
+  length_.optimize();
+  for (auto& x : chars_)
+    x.optimize();
+}
+
 void address_index::init() {
   if (bytes_[0].coder().storage().empty())
     // Initialize on first to make deserialization feasible.
@@ -343,6 +579,23 @@ address_index::lookup_impl(relational_operator op, data const& x) const {
   return make_error(ec::type_clash, x);
 }
 
+bool address_index::merge_impl(value_index const& other) {
+  auto& x = static_cast<address_index const&>(other);
+  if (x.bytes_[0].coder().storage().empty())
+    return true;
+  init();
+  for (auto i = 0u; i < bytes_.size(); ++i)
+    bytes_[i].merge(x.bytes_[i]);
+  v4_.merge(x.v4_);
+  return true;
+}
+
+void address_index::optimize_impl() {
+  for (auto& x : bytes_)
+    x.optimize();
+  v4_.optimize();
+}
+
 void subnet_index::init() {
   if (length_.coder().storage().empty())
     length_ = prefix_index{128 + 1}; // Valid prefixes range from /0 to /128.
@@ -410,15 +663,40 @@ subnet_index::lookup_impl(relational_operator op, data const& x) const {
   }
 }
 
+bool subnet_index::merge_impl(value_index const& other) {
+  auto& x = static_cast<subnet_index const&>(other);
+  if (x.length_.coder().storage().empty())
+    return true;
+  init();
+  length_.merge(x.length_);
+  return !!network_.merge(x.network_);
+}
 
-void port_index::init() {
+void subnet_index::optimize_impl() {
+  network_.optimize();
+  length_.optimize();
+}
+
+bool uses_bitslice_encoding(type const& t) {
+  auto a = extract_attribute(t, "index");
+  return a && *a == "bitslice";
+}
+
+template <class NumberCoder>
+void basic_port_index<NumberCoder>::init() {
   if (num_.coder().storage().empty()) {
-    num_ = number_index{base::uniform(10, 5)}; // [0, 2^16)
+    // [0, 2^16)
+    auto b = is_bitslice_coder<typename NumberCoder::coder_type>{}
+               ? base::uniform(2, 16)
+               : base::uniform(10, 5);
+    num_ = number_index{std::move(b)};
     proto_ = protocol_index{4}; // unknown, tcp, udp, icmp
   }
 }
 
-bool port_index::push_back_impl(data const& x, size_type skip) {
+template <class NumberCoder>
+bool basic_port_index<NumberCoder>::push_back_impl(data const& x,
+                                                   size_type skip) {
   if (auto p = get_if<port>(x)) {
     init();
     num_.push_back(p->number(), skip);
@@ -428,8 +706,10 @@ bool port_index::push_back_impl(data const& x, size_type skip) {
   return false;
 }
 
+template <class NumberCoder>
 expected<bitmap>
-port_index::lookup_impl(relational_operator op, data const& x) const {
+basic_port_index<NumberCoder>::lookup_impl(relational_operator op,
+                                           data const& x) const {
   if (op == in || op == not_in)
     return make_error(ec::unsupported_operator, op);
   if (offset() == 0)
@@ -445,6 +725,25 @@ port_index::lookup_impl(relational_operator op, data const& x) const {
   return n;
 }
 
+template <class NumberCoder>
+bool basic_port_index<NumberCoder>::merge_impl(value_index const& other) {
+  auto& x = static_cast<basic_port_index const&>(other);
+  if (x.num_.coder().storage().empty())
+    return true;
+  init();
+  num_.merge(x.num_);
+  proto_.merge(x.proto_);
+  return true;
+}
+
+template <class NumberCoder>
+void basic_port_index<NumberCoder>::optimize_impl() {
+  num_.optimize();
+  proto_.optimize();
+}
+
+template class basic_port_index<multi_level_coder<range_coder<bitmap>>>;
+template class basic_port_index<multi_level_coder<bitslice_coder<bitmap>>>;
 
 sequence_index::sequence_index(vast::type t, size_t max_size)
   : max_size_{max_size},
@@ -480,21 +779,46 @@ sequence_index::lookup_impl(relational_operator op, data const& x) const {
     return make_error(ec::unsupported_operator, op);
   if (elements_.empty())
     return bitmap{};
-  auto result = elements_[0]->lookup(equal, x);
-  if (!result)
-    return result;
-  for (auto i = 1u; i < elements_.size(); ++i) {
-    auto mbm = elements_[i]->lookup(equal, x);
-    if (mbm)
-      *result |= *mbm;
-    else
+  std::vector<bitmap> xs;
+  xs.reserve(elements_.size());
+  for (auto& element : elements_) {
+    auto mbm = element->lookup(equal, x);
+    if (!mbm)
       return mbm;
+    xs.push_back(std::move(*mbm));
   }
+  auto result = nary_or(xs.begin(), xs.end());
   if (op == not_in)
-    result->flip();
+    result.flip();
   return result;
 }
 
+bool sequence_index::merge_impl(value_index const& other) {
+  auto& x = static_cast<sequence_index const&>(other);
+  if (x.size_.coder().storage().empty())
+    return true;
+  init();
+  size_.merge(x.size_);
+  if (x.elements_.size() > elements_.size()) {
+    auto old = elements_.size();
+    elements_.resize(x.elements_.size());
+    for (auto i = old; i < elements_.size(); ++i) {
+      elements_[i] = value_index::make(value_type_);
+      VAST_ASSERT(elements_[i]);
+    }
+  }
+  for (auto i = 0u; i < x.elements_.size(); ++i)
+    if (!elements_[i]->merge(*x.elements_[i]))
+      return false;
+  return true;
+}
+
+void sequence_index::optimize_impl() {
+  size_.optimize();
+  for (auto& x : elements_)
+    x->optimize();
+}
+
 void serialize(caf::serializer& sink, sequence_index const& idx) {
   sink & static_cast<value_index const&>(idx);
   sink & idx.value_type_;
@@ -1,6 +1,12 @@
+#include <cstring>
+
 #include "vast/bitmap.hpp"
+#include "vast/bitmap_formula.hpp"
 #include "vast/ewah_bitmap.hpp"
 #include "vast/null_bitmap.hpp"
+#include "vast/roaring_bitmap.hpp"
+#include "vast/load.hpp"
+#include "vast/save.hpp"
 #include "vast/concept/printable/to_string.hpp"
 #include "vast/concept/printable/vast/bitmap.hpp"
 
@@ -82,6 +88,15 @@ struct bitmap_test_harness {
     s = "00001110111111111111111111111000111011111111111111111111"
         "1111111111100000000000000000000000000000000001111111";
     CHECK_EQUAL(to_string(xy), s);
+    MESSAGE("homogeneous blocks followed by an inhomogeneous partial block");
+    Bitmap c;
+    c.append_bits(true, 146);
+    c.append_bit(false);
+    c.append_bits(true, 30);
+    s.assign(146, '1');
+    s += '0';
+    s.append(30, '1');
+    CHECK_EQUAL(to_string(c), s);
   }
 
   void test_bitwise_simple() {
@@ -158,6 +173,15 @@ struct bitmap_test_harness {
     auto begin = bitmaps.begin();
     auto end = bitmaps.end();
     CHECK_EQUAL(nary_and(begin, end), x & y & z0 & z1);
+    CHECK_EQUAL(nary_and(begin, begin + 2), x & y);
+    MESSAGE("nary OR");
+    CHECK_EQUAL(nary_or(begin, end), x | y | z0 | z1);
+    CHECK_EQUAL(nary_or(begin + 1, begin + 3), y | z0);
+    MESSAGE("nary XOR");
+    CHECK_EQUAL(nary_xor(begin, end), x ^ y ^ z0 ^ z1);
+    MESSAGE("nary with less than two bitmaps");
+    CHECK_EQUAL(nary_or(begin, begin + 1), x);
+    CHECK_EQUAL(nary_or(begin, begin), Bitmap{});
   }
 
   void test_rank() {
@@ -322,6 +346,55 @@ struct bitmap_test_harness {
     CHECK(!any<1>(Bitmap{1000, false}));
   }
 
+  void test_inplace() {
+    MESSAGE("in-place operations with RHS past the end of LHS");
+    Bitmap lhs;
+    lhs.append_bits(true, 10);
+    lhs.append_bits(false, 100);
+    lhs.append_bit(true);
+    Bitmap rhs;
+    rhs.append_bits(false, 200);
+    rhs.append_bits(true, 5);
+    auto appended = lhs;
+    appended.append_bits(false, 89);
+    appended.append_bits(true, 5);
+    auto z = lhs;
+    z |= rhs;
+    CHECK_EQUAL(z, appended);
+    z = lhs;
+    z ^= rhs;
+    CHECK_EQUAL(z, appended);
+    z = lhs;
+    z &= rhs;
+    CHECK_EQUAL(z, Bitmap(205, false));
+    z = lhs;
+    z -= rhs;
+    auto difference = lhs;
+    difference.append_bits(false, 17); // Up to the next block boundary.
+    CHECK_EQUAL(z, difference);
+    MESSAGE("in-place operations with LHS without 1-bits");
+    z = Bitmap(300, false);
+    z |= lhs;
+    auto padded = lhs;
+    padded.append_bits(false, 189);
+    CHECK_EQUAL(z, padded);
+    z = Bitmap(50, false);
+    z &= rhs;
+    CHECK_EQUAL(z, Bitmap(205, false));
+    MESSAGE("accumulation");
+    Bitmap acc;
+    for (auto i = 0u; i < 10; ++i) {
+      Bitmap hits;
+      hits.append_bits(false, i * 100);
+      hits.append_bits(true, 3);
+      acc |= hits;
+    }
+    CHECK_EQUAL(acc.size(), 903u);
+    CHECK_EQUAL(rank<1>(acc), 30u);
+    CHECK(acc[900]);
+    CHECK(!acc[899]);
+  }
+
   void execute() {
     test_append();
     test_construction();
@@ -330,6 +403,7 @@ struct bitmap_test_harness {
     test_bitwise_or();
     test_bitwise_nand();
     test_bitwise_nary();
+    test_inplace();
     test_rank();
     test_select();
     test_span();
@@ -369,6 +443,14 @@ TEST(wah_bitmap) {
 
 FIXTURE_SCOPE_END()
 
+FIXTURE_SCOPE(roaring_bitmap_tests, bitmap_test_harness<roaring_bitmap>)
+
+TEST(roaring_bitmap) {
+  execute();
+}
+
+FIXTURE_SCOPE_END()
+
 FIXTURE_SCOPE(bitmap_tests, bitmap_test_harness<bitmap>)
 
 TEST(bitmap) {
@@ -764,6 +846,266 @@ TEST(EWAH block append) {
   CHECK_EQUAL(to_block_string(bm), str);
 }
 
+TEST(EWAH word-wise evaluation) {
+  MESSAGE("kernel: " << detail::bitwise_kernel());
+  // Long literal runs span multiple vector iterations and scratch buffers.
+  ewah_bitmap bm1;
+  ewah_bitmap bm2;
+  for (auto i = 0u; i < 1000; ++i) {
+    bm1.append_block(0x0123456789abcdefULL * (i + 1));
+    bm2.append_block(i % 3 == 0 ? 0 : 0xfedcba9876543210ULL ^ i);
+  }
+  bm1.append_bits(true, 640);
+  bm2.append_block(0xf0f0, 17);
+  bm2.append_bits(false, 1000);
+  bm1.append_block(0xabcd, 42);
+  auto check = [&](auto op, auto lhs_fill, auto rhs_fill) {
+    constexpr bool fill_lhs = decltype(lhs_fill)::value;
+    constexpr bool fill_rhs = decltype(rhs_fill)::value;
+    auto x = word_eval<fill_lhs, fill_rhs>(bm1, bm2, op);
+    auto y = detail::block_eval<fill_lhs, fill_rhs>(bm1, bm2, op);
+    CHECK_EQUAL(x, y);
+    x = word_eval<fill_lhs, fill_rhs>(bm2, bm1, op);
+    y = detail::block_eval<fill_lhs, fill_rhs>(bm2, bm1, op);
+    CHECK_EQUAL(x, y);
+  };
+  check(and_operation{}, std::false_type{}, std::false_type{});
+  check(or_operation{}, std::true_type{}, std::true_type{});
+  check(xor_operation{}, std::true_type{}, std::true_type{});
+  check(nand_operation{}, std::true_type{}, std::false_type{});
+  check(nor_operation{}, std::true_type{}, std::true_type{});
+}
+
+TEST(EWAH skip index) {
+  // Mix fills, literals, and markers without clean blocks.
+  ewah_bitmap bm;
+  null_bitmap ref;
+  for (auto i = 0u; i < 500; ++i) {
+    auto block = 0x0123456789abcdefULL * (i + 1);
+    bm.append_block(block);
+    ref.append_block(block);
+    bm.append_bits(i % 2 == 0, 64 * (i % 5) + i % 7);
+    ref.append_bits(i % 2 == 0, 64 * (i % 5) + i % 7);
+  }
+  bm.flip();
+  ref.flip();
+  auto indexed = bm;
+  indexed.build_skip_index(3);
+  REQUIRE(indexed.skip_index() != nullptr);
+  CHECK_EQUAL(indexed.skip_index()->count(), rank(ref));
+  for (auto i = 1u; i < ref.size(); i += 97) {
+    CHECK_EQUAL(rank<1>(indexed, i), rank<1>(ref, i));
+    CHECK_EQUAL(rank<0>(indexed, i), rank<0>(ref, i));
+  }
+  MESSAGE("select");
+  for (auto i = 1u; i < rank(ref) + 2; i += 89) {
+    CHECK_EQUAL(select<1>(indexed, i), select<1>(ref, i));
+    CHECK_EQUAL(select<0>(indexed, i), select<0>(ref, i));
+  }
+  CHECK_EQUAL(select(indexed, -1), select(ref, -1));
+  MESSAGE("seek");
+  auto xs = select(indexed);
+  auto ys = select(ref);
+  while (xs && ys) {
+    CHECK_EQUAL(xs.get(), ys.get());
+    xs.skip(1000);
+    ys.skip(1000);
+  }
+  CHECK(!xs && !ys);
+  MESSAGE("type erasure");
+  bitmap erased{indexed};
+  CHECK_EQUAL(rank(erased), rank(ref));
+  CHECK_EQUAL(select(erased, 4242), select(ref, 4242));
+  MESSAGE("modification discards the index");
+  indexed.append_bit(true);
+  CHECK(indexed.skip_index() == nullptr);
+}
+
+TEST(EWAH bitmap view) {
+  ewah_bitmap x;
+  ewah_bitmap y;
+  for (auto i = 0u; i < 100; ++i) {
+    x.append_block(0x0123456789abcdefULL * (i + 1));
+    x.append_bits(i % 2 == 0, 64 * (i % 4) + 3);
+    y.append_bits(i % 3 == 0, 200);
+    y.append_block(0xf0f0f0f0, 37);
+  }
+  x.build_skip_index(4);
+  MESSAGE("view of an owning bitmap");
+  ewah_bitmap_view vx{x};
+  CHECK(vx.skip_index() == x.skip_index());
+  ewah_bitmap copy;
+  copy.append(vx);
+  CHECK_EQUAL(copy, x);
+  MESSAGE("view of a flat buffer");
+  std::vector<char> buf;
+  save_flat(buf, x);
+  auto offset = buf.size();
+  save_flat(buf, y);
+  auto view = make_ewah_bitmap_view(buf.data(), buf.size());
+  REQUIRE(view);
+  CHECK_EQUAL(view->size(), x.size());
+  CHECK_EQUAL(view->data(), reinterpret_cast<ewah_bitmap::block_type const*>(
+                              buf.data() + 16));
+  auto vy = make_ewah_bitmap_view(buf.data() + offset, buf.size() - offset);
+  REQUIRE(vy);
+  MESSAGE("bitwise operations");
+  CHECK_EQUAL(binary_and(*view, *vy), x & y);
+  CHECK_EQUAL(binary_or(*view, *vy), x | y);
+  CHECK_EQUAL(binary_xor(*view, *vy), x ^ y);
+  CHECK_EQUAL(binary_nand(*view, *vy), x - y);
+  CHECK_EQUAL(binary_and(*view, y), x & y);
+  MESSAGE("rank and select");
+  CHECK_EQUAL(rank<1>(*view), rank<1>(x));
+  CHECK_EQUAL(rank<0>(*view, 4242), rank<0>(x, 4242));
+  CHECK_EQUAL(select<1>(*view, 1000), select<1>(x, 1000));
+  CHECK_EQUAL(select<0>(*vy, 77), select<0>(y, 77));
+  CHECK_EQUAL(select<1>(*vy, -1), select<1>(y, -1));
+  MESSAGE("invalid buffers");
+  CHECK(!make_ewah_bitmap_view(buf.data(), offset - 8));
+  CHECK(!make_ewah_bitmap_view(buf.data() + 1, buf.size() - 1));
+  auto corrupt = buf;
+  auto num_bits = x.size() + 64;
+  std::memcpy(corrupt.data(), &num_bits, sizeof(num_bits));
+  CHECK(!make_ewah_bitmap_view(corrupt.data(), corrupt.size()));
+}
+
+TEST(bitmap formula) {
+  ewah_bitmap x;
+  ewah_bitmap y;
+  ewah_bitmap z;
+  for (auto i = 0u; i < 100; ++i) {
+    x.append_block(0x0123456789abcdefULL * (i + 1));
+    x.append_bits(i % 2 == 0, 64 * (i % 4) + 3);
+    y.append_bits(i % 3 == 0, 200);
+    y.append_block(0xf0f0f0f0, 37);
+  }
+  z.append_bits(true, 1000);
+  z.append_bits(false, 1000);
+  using formula = bitmap_formula<ewah_bitmap>;
+  MESSAGE("single bitmap");
+  CHECK_EQUAL(eval(formula{x}), x);
+  CHECK_EQUAL(eval(~formula{x}), ~x);
+  CHECK_EQUAL(eval(formula{y.size(), true}), ewah_bitmap(y.size(), true));
+  MESSAGE("binary operations");
+  CHECK_EQUAL(eval(formula{x} & y), x & y);
+  CHECK_EQUAL(eval(formula{x} | y), x | y);
+  CHECK_EQUAL(eval(formula{x} ^ y), x ^ y);
+  CHECK_EQUAL(eval(formula{x} - y), x - y);
+  MESSAGE("nested operations with inputs of different size");
+  auto f = (formula{x} & ~formula{z}) | (formula{y} ^ z);
+  CHECK_EQUAL(f.inputs(), 3u);
+  CHECK_EQUAL(f.size(), std::max(x.size(), y.size()));
+  CHECK_EQUAL(eval(f), (x & ~z) | (y ^ z));
+  auto g = ~(formula{x.size(), true} & z) | x;
+  CHECK_EQUAL(eval(g), ~(ewah_bitmap(x.size(), true) & z) | x);
+}
+
+TEST(bitmap optimization) {
+  bitmap dense;
+  bitmap sparse;
+  bitmap runs{null_bitmap{}};
+  for (auto i = 0u; i < 1000; ++i) {
+    dense.append_block(0x0123456789abcdefULL * (i + 1));
+    sparse.append_bits(false, 999);
+    sparse.append_bit(true);
+  }
+  for (auto i = 0u; i < 10; ++i)
+    runs.append_bits(i % 2 == 0, 1u << 20);
+  auto check = [](bitmap& bm, auto representation) {
+    auto str = to_string(bm);
+    bm.optimize();
+    CHECK(get_if<decltype(representation)>(bm) != nullptr);
+    CHECK_EQUAL(to_string(bm), str);
+  };
+  MESSAGE("incompressible bitmaps become null bitmaps");
+  check(dense, null_bitmap{});
+  MESSAGE("sparse bitmaps become roaring bitmaps");
+  check(sparse, roaring_bitmap{});
+  MESSAGE("bitmaps with long runs become EWAH bitmaps");
+  check(runs, ewah_bitmap{});
+  MESSAGE("optimized bitmaps remain appendable");
+  sparse.append_bits(true, 100);
+  CHECK_EQUAL(rank<1>(sparse), 1100u);
+  CHECK_EQUAL(sparse.size(), 1000100u);
+  MESSAGE("optimized bitmaps combine across representations");
+  bitmap x;
+  bitmap y;
+  bitmap z;
+  for (auto i = 0u; i < 100; ++i) {
+    x.append_block(0x0123456789abcdefULL * (i + 1));
+    y.append_bits(false, 999);
+    y.append_bit(true);
+  }
+  // The null bitmap ends in a fill that does not end at a block boundary.
+  x.append_bits(true, 101);
+  for (auto i = 0u; i < 4; ++i)
+    z.append_bits(i % 2 == 0, 1u << 16);
+  z.append_bits(true, 37);
+  x.optimize();
+  y.optimize();
+  z.optimize();
+  REQUIRE(get_if<null_bitmap>(x) != nullptr);
+  REQUIRE(get_if<roaring_bitmap>(y) != nullptr);
+  REQUIRE(get_if<ewah_bitmap>(z) != nullptr);
+  auto to_ewah = [](bitmap const& bm) {
+    ewah_bitmap result;
+    result.append(bm);
+    return bitmap{std::move(result)};
+  };
+  for (auto& lhs : {x, y, z}) {
+    auto l = to_ewah(lhs);
+    CHECK_EQUAL(lhs, l);
+    for (auto& rhs : {x, y, z}) {
+      auto r = to_ewah(rhs);
+      CHECK_EQUAL(lhs & rhs, l & r);
+      CHECK_EQUAL(lhs | rhs, l | r);
+      CHECK_EQUAL(lhs ^ rhs, l ^ r);
+      CHECK_EQUAL(lhs - rhs, l - r);
+      auto diff = lhs;
+      diff -= rhs;
+      CHECK_EQUAL(diff, l - r);
+    }
+  }
+  CHECK_NOT_EQUAL(x, y);
+}
+
+TEST(mixed bitmap representations) {
+  // A null bitmap ends in a fill that does not end at a block boundary.
+  bitmap x{null_bitmap{}};
+  x.append_block(0xf0f0f0f0f0f0f0f0);
+  x.append_bits(true, 100);
+  bitmap y{ewah_bitmap{}};
+  y.append_bits(false, 64);
+  y.append_block(0x00ff00ff00ff00ff);
+  y.append_bits(true, 200);
+  bitmap z{roaring_bitmap{}};
+  z.append_bits(false, 150);
+  z.append_bit(true);
+  z.append_bits(false, 100);
+  auto to_ewah = [](bitmap const& bm) {
+    ewah_bitmap result;
+    for (auto b : bit_range(bm))
+      if (b.size() > ewah_bitmap::word_type::width)
+        result.append_bits(b.data() != 0, b.size());
+      else
+        result.append_block(b.data(), b.size());
+    return result;
+  };
+  auto ex = to_ewah(x);
+  auto ey = to_ewah(y);
+  auto ez = to_ewah(z);
+  CHECK_EQUAL(to_string(x & y), to_string(ex & ey));
+  CHECK_EQUAL(to_string(y & x), to_string(ey & ex));
+  CHECK_EQUAL(to_string(x | z), to_string(ex | ez));
+  CHECK_EQUAL(to_string(z ^ x), to_string(ez ^ ex));
+  auto xs = std::vector<bitmap>{x, y, z};
+  CHECK_EQUAL(to_string(nary_or(xs.begin(), xs.end())),
+              to_string(ex | ey | ez));
+  CHECK_EQUAL(to_string(nary_and(xs.begin(), xs.end())),
+              to_string(ex & ey & ez));
+}
+
 TEST(EWAH RLE print 1) {
   ewah_bitmap bm;
   bm.append_bit(false);
@@ -792,3 +1134,77 @@ TEST(EWAH RLE print 2) {
   //CHECK_EQUAL(str, "1F1T421F2T");
   CHECK_EQUAL(str, "1F1T62F320F39F2T");
 }
+
+TEST(roaring containers) {
+  using kind = roaring_bitmap::container_type::kind;
+  auto chunk = roaring_bitmap::size_type{1} << 16;
+  roaring_bitmap bm;
+  // Sparse IDs end up in an array container.
+  for (auto i = 0u; i < 100; ++i) {
+    bm.append_bits(false, 999);
+    bm.append_bit(true);
+  }
+  // A long run of 1s spanning multiple chunks ends up in run containers.
+  bm.append_bits(true, 100000);
+  // Random-looking blocks end up in a bitset container.
+  bm.append_bits(false, 4 * chunk - bm.size());
+  auto ones = roaring_bitmap::size_type{100 + 100000 + 1};
+  for (auto i = 0u; i < 1024; ++i) {
+    auto block = 0x5555555555555555ULL * (i % 3 + 1) ^ i;
+    bm.append_block(block);
+    ones += roaring_bitmap::word_type::popcount(block);
+  }
+  bm.append_bits(false, 1 << 20);
+  bm.append_bit(true);
+  auto& cs = bm.containers();
+  REQUIRE_EQUAL(cs.size(), 6u);
+  CHECK(cs[0].representation() == kind::array);
+  CHECK_EQUAL(cs[0].cardinality(), 65u);
+  CHECK(cs[1].representation() == kind::runs);
+  CHECK(cs[2].representation() == kind::runs);
+  CHECK_EQUAL(cs[2].cardinality(), chunk);
+  CHECK(cs[3].representation() == kind::runs);
+  CHECK(cs[4].representation() == kind::bitset);
+  CHECK(cs[5].representation() == kind::array);
+  CHECK_EQUAL(cs[5].key(), 21u);
+  CHECK_EQUAL(rank(bm), ones);
+  MESSAGE("random access");
+  CHECK(bm[999]);
+  CHECK(!bm[1000]);
+  CHECK(bm[99999]);
+  CHECK(bm[100000]);
+  CHECK(bm[199999]);
+  CHECK(!bm[bm.size() - 2]);
+  CHECK(bm[bm.size() - 1]);
+  MESSAGE("flip");
+  auto flipped = ~bm;
+  CHECK(!flipped[999]);
+  CHECK(flipped[bm.size() - 2]);
+  CHECK_EQUAL(rank(bm) + rank(flipped), bm.size());
+  CHECK_EQUAL(~flipped, bm);
+  MESSAGE("bitwise operations");
+  roaring_bitmap sparse;
+  sparse.append_bits(false, 999);
+  sparse.append_bit(true);
+  sparse.append_bits(false, 150000);
+  sparse.append_bit(true);
+  auto conj = bm & sparse;
+  CHECK_EQUAL(conj.size(), bm.size());
+  CHECK_EQUAL(rank(conj), 2u);
+  CHECK_EQUAL(select(conj, 1), 999u);
+  CHECK_EQUAL(select(conj, 2), 151000u);
+  CHECK_EQUAL(bm | sparse, bm);
+  CHECK_EQUAL(rank(bm - sparse), rank(bm) - 2);
+  MESSAGE("serialization");
+  std::vector<char> buf;
+  save(buf, bm);
+  roaring_bitmap copy;
+  load(buf, copy);
+  CHECK_EQUAL(copy, bm);
+  bitmap erased{bm};
+  buf.clear();
+  save(buf, erased);
+  bitmap erased_copy;
+  load(buf, erased_copy);
+  CHECK_EQUAL(erased_copy, erased);
+}
@@ -6,6 +6,7 @@
 #include "vast/detail/order.hpp"
 #include "vast/load.hpp"
 #include "vast/null_bitmap.hpp"
+#include "vast/roaring_bitmap.hpp"
 #include "vast/save.hpp"
 
 #define SUITE coder
@@ -131,6 +132,22 @@ TEST(range-coder) {
   CHECK_EQUAL(to_string(c.decode(greater_equal, 7)), "010000000000001");
 }
 
+TEST(range-coder with roaring bitmaps) {
+  range_coder<roaring_bitmap> c{8};
+  c.encode(4);
+  c.encode(7);
+  c.encode(4);
+  c.encode(3, 5);
+  c.encode(3);
+  c.encode(0);
+  c.encode(1);
+  CHECK_EQUAL(to_string(c.decode(less, 4)), "00011111111");
+  CHECK_EQUAL(to_string(c.decode(equal, 3)), "00011111100");
+  CHECK_EQUAL(to_string(c.decode(greater_equal, 3)), "11111111100");
+  c.encode(7, 1, 3);
+  CHECK_EQUAL(to_string(c.decode(greater_equal, 7)), "010000000000001");
+}
+
 TEST(bitslice-coder) {
   bitslice_coder<null_bitmap> c{6};
   c.encode(4);
@@ -312,6 +329,43 @@ TEST(multi-level range coder) {
   }
 }
 
+TEST(multi-level bitslice coder) {
+  using coder_type = multi_level_coder<bitslice_coder<null_bitmap>>;
+  auto c = coder_type{base::uniform(10, 3)};
+  c.encode(0);
+  c.encode(6);
+  c.encode(9);
+  c.encode(10);
+  c.encode(77);
+  c.encode(99);
+  c.encode(100);
+  c.encode(255);
+  c.encode(254);
+  CHECK_EQUAL(to_string(c.decode(less,          0))  , "000000000");
+  CHECK_EQUAL(to_string(c.decode(less,          10)) , "111000000");
+  CHECK_EQUAL(to_string(c.decode(less,          255)), "111111101");
+  CHECK_EQUAL(to_string(c.decode(less_equal,    9))  , "111000000");
+  CHECK_EQUAL(to_string(c.decode(less_equal,    100)), "111111100");
+  CHECK_EQUAL(to_string(c.decode(greater,       8))  , "001111111");
+  CHECK_EQUAL(to_string(c.decode(greater,       254)), "000000010");
+  CHECK_EQUAL(to_string(c.decode(greater_equal, 0))  , "111111111");
+  CHECK_EQUAL(to_string(c.decode(greater_equal, 100)), "000000111");
+  CHECK_EQUAL(to_string(c.decode(equal,         77)) , "000010000");
+  CHECK_EQUAL(to_string(c.decode(equal,         8))  , "000000000");
+  CHECK_EQUAL(to_string(c.decode(not_equal,     254)), "111111110");
+  MESSAGE("one component per bit");
+  c = coder_type{base::uniform(2, 8)};
+  for (auto i = 0u; i < 256; ++i)
+    c.encode(i);
+  CHECK_EQUAL(c.storage().size(), 8u);
+  CHECK_EQUAL(c.storage()[0].storage().size(), 1u);
+  auto str = std::string(256, '0');
+  for (auto i = 0u; i < 256; ++i) {
+    str[i] = '1';
+    CHECK_EQUAL(to_string(c.decode(less_equal, i)), str);
+  }
+}
+
 TEST(serialization range coder) {
   range_coder<null_bitmap> x{100}, y;
   x.encode(42);
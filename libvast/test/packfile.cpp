@@ -0,0 +1,61 @@
+#include <fstream>
+#include <string>
+
+#include "vast/packfile.hpp"
+#include "vast/save.hpp"
+
+#define SUITE packfile
+#include "test.hpp"
+#include "fixtures/filesystem.hpp"
+
+using namespace std::string_literals;
+using namespace vast;
+
+FIXTURE_SCOPE(packfile_tests, fixtures::filesystem)
+
+TEST(packfile roundtrip) {
+  MESSAGE("create loose files");
+  auto xs = std::vector<int>{1, 2, 3, 4, 5};
+  auto str = "foobarbazqux"s;
+  REQUIRE(mkdir(directory / "a" / "b"));
+  REQUIRE(save(directory / "a" / "b" / "xs", xs));
+  REQUIRE(save(directory / "str", str));
+  MESSAGE("pack files");
+  packfile::writer writer;
+  writer.add("a/b/xs", directory / "a" / "b" / "xs");
+  writer.add("str", directory / "str");
+  REQUIRE(writer.write(directory / "pack"));
+  // The writer renames its temporary file once complete.
+  CHECK(!exists(directory / "pack.tmp"));
+  MESSAGE("open packfile");
+  auto pack = packfile::open(directory / "pack");
+  REQUIRE(pack);
+  auto& p = **pack;
+  REQUIRE_EQUAL(p.toc().size(), 2u);
+  CHECK(p.contains("a/b/xs"));
+  CHECK(p.contains(directory / "a" / "b" / "xs"));
+  CHECK(p.contains(directory / "str"));
+  CHECK(!p.contains(directory / "a"));
+  CHECK(!p.contains("foo"));
+  for (auto& x : p.toc())
+    CHECK_EQUAL(x.second.offset % packfile::alignment, 0u);
+  MESSAGE("load blobs");
+  std::vector<int> ys;
+  std::string s;
+  REQUIRE(p.load(directory / "a" / "b" / "xs", ys));
+  REQUIRE(p.load("str", s));
+  CHECK_EQUAL(xs, ys);
+  CHECK_EQUAL(str, s);
+  CHECK(!p.load("foo", s));
+}
+
+TEST(packfile invalid) {
+  auto filename = directory / "garbage";
+  std::ofstream ofs{filename.str()};
+  ofs << "this is not a packfile";
+  ofs.close();
+  CHECK(!packfile::open(filename));
+  CHECK(!packfile::open(directory / "nonexistent"));
+}
+
+FIXTURE_SCOPE_END()
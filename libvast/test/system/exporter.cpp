@@ -18,7 +18,9 @@ using namespace std::chrono;
 FIXTURE_SCOPE(exporter_tests, fixtures::actor_system_and_events)
 
 TEST(exporter) {
-  auto i = self->spawn(system::index, directory / "index", 1000, 5, 5);
+  auto i = self->spawn(system::index, directory / "index",
+                       system::partition_policy{1000}, 5, 5, 100,
+                       system::scheduling_policy{});
   auto a = self->spawn(system::archive, directory / "archive", 1, 1024);
   MESSAGE("ingesting conn.log");
   self->send(i, bro_conn_log);
@@ -48,4 +50,78 @@ TEST(exporter) {
   self->send_exit(a, exit_reason::user_shutdown);
 }
 
+TEST(exporter with limit) {
+  auto i = self->spawn(system::index, directory / "index",
+                       system::partition_policy{1000}, 5, 5, 100,
+                       system::scheduling_policy{});
+  auto a = self->spawn(system::archive, directory / "archive", 1, 1024);
+  MESSAGE("ingesting conn.log");
+  self->send(i, bro_conn_log);
+  self->send(a, bro_conn_log);
+  auto expr = to<expression>("service == \"http\" && :addr == 212.227.96.110");
+  REQUIRE(expr);
+  MESSAGE("issueing query with a limit of 5 results");
+  auto e = self->spawn(system::exporter, *expr, historical);
+  self->send(e, a);
+  self->send(e, system::index_atom::value, i);
+  self->send(e, system::sink_atom::value, self);
+  self->send(e, system::limit_atom::value, uint64_t{5});
+  self->send(e, system::run_atom::value);
+  self->send(e, system::extract_atom::value, uint64_t{5});
+  MESSAGE("waiting for results");
+  std::vector<event> results;
+  self->do_receive(
+    [&](std::vector<event>& xs) {
+      std::move(xs.begin(), xs.end(), std::back_inserter(results));
+    },
+    error_handler()
+  ).until([&] { return results.size() >= 5; });
+  CHECK_EQUAL(results.size(), 5u);
+  CHECK_EQUAL(results.front().id(), 105u);
+  MESSAGE("exporter terminates after reaching the limit");
+  self->wait_for(e);
+  self->send_exit(i, exit_reason::user_shutdown);
+  self->send_exit(a, exit_reason::user_shutdown);
+}
+
+TEST(exporter with limit below the requested results) {
+  auto i = self->spawn(system::index, directory / "index",
+                       system::partition_policy{1000}, 5, 5, 100,
+                       system::scheduling_policy{});
+  auto a = self->spawn(system::archive, directory / "archive", 1, 1024);
+  MESSAGE("ingesting conn.log");
+  self->send(i, bro_conn_log);
+  self->send(a, bro_conn_log);
+  auto expr = to<expression>("service == \"http\" && :addr == 212.227.96.110");
+  REQUIRE(expr);
+  MESSAGE("issueing query with a limit of 5 results and extracting all");
+  auto e = self->spawn(system::exporter, *expr, historical);
+  self->send(e, a);
+  self->send(e, system::index_atom::value, i);
+  self->send(e, system::sink_atom::value, self);
+  self->send(e, system::limit_atom::value, uint64_t{5});
+  self->send(e, system::run_atom::value);
+  self->send(e, system::extract_atom::value);
+  MESSAGE("waiting for the exporter to terminate");
+  self->wait_for(e);
+  std::vector<event> results;
+  auto more = true;
+  while (more)
+    self->receive(
+      [&](std::vector<event>& xs) {
+        std::move(xs.begin(), xs.end(), std::back_inserter(results));
+      },
+      [&](const uuid&, const system::query_statistics&) {
+        // nop
+      },
+      after(seconds(0)) >> [&] {
+        more = false;
+      }
+    );
+  CHECK_EQUAL(results.size(), 5u);
+  CHECK_EQUAL(results.front().id(), 105u);
+  self->send_exit(i, exit_reason::user_shutdown);
+  self->send_exit(a, exit_reason::user_shutdown);
+}
+
 FIXTURE_SCOPE_END()
@@ -1,8 +1,18 @@
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 #include "vast/bitmap.hpp"
 #include "vast/concept/parseable/to.hpp"
 #include "vast/concept/parseable/vast/expression.hpp"
+#include "vast/concept/printable/to_string.hpp"
+#include "vast/concept/printable/vast/uuid.hpp"
+#include "vast/error.hpp"
 #include "vast/query_options.hpp"
+#include "vast/save.hpp"
 
+#include "vast/system/atoms.hpp"
 #include "vast/system/index.hpp"
 
 #define SUITE index
@@ -22,7 +32,9 @@ FIXTURE_SCOPE(index_tests, fixtures::actor_system_and_events)
 TEST(index) {
   directory /= "index";
   MESSAGE("spawing");
-  auto index = self->spawn(system::index, directory, 1000, 5, 10);
+  auto index = self->spawn(system::index, directory,
+                           system::partition_policy{1000}, 5, 10, 100,
+                           system::scheduling_policy{});
   MESSAGE("indexing logs");
   self->send(index, bro_conn_log);
   self->send(index, bro_dns_log);
@@ -56,8 +68,13 @@ TEST(index) {
   self->send_exit(index, exit_reason::user_shutdown);
   self->wait_for(index);
   CHECK(exists(directory / "meta"));
+  // The output of a merge that didn't commit.
+  auto unfinished = directory / (to_string(uuid::random()) + ".merging");
+  REQUIRE(mkdir(unfinished));
   MESSAGE("reloading index");
-  index = self->spawn(system::index, directory, 1000, 2, 2);
+  index = self->spawn(system::index, directory,
+                      system::partition_policy{1000}, 2, 2, 100,
+                      system::scheduling_policy{});
   MESSAGE("issueing queries");
   self->send(index, *expr);
   self->receive(
@@ -72,7 +89,10 @@ TEST(index) {
         error_handler()
       );
       // Evict one partition.
-      self->send(index, id, size_t{1});
+      self->request(index, infinite, id, size_t{1}).receive(
+        [&](size_t n) { CHECK_EQUAL(n, 1u); },
+        error_handler()
+      );
       self->receive(
         [&](const bitmap& hits) { all |= hits; },
         error_handler()
@@ -83,6 +103,255 @@ TEST(index) {
   );
   self->send_exit(index, exit_reason::user_shutdown);
   self->wait_for(index);
+  CHECK(!exists(unfinished));
+}
+
+TEST(index recovery) {
+  directory /= "index";
+  auto index = self->spawn(system::index, directory,
+                           system::partition_policy{1000}, 5, 10, 0,
+                           system::scheduling_policy{});
+  self->send(index, bro_conn_log);
+  self->send(index, bro_dns_log);
+  self->send(index, bro_http_log);
+  self->send_exit(index, exit_reason::user_shutdown);
+  self->wait_for(index);
+  std::vector<path> partitions;
+  for (auto& entry : vast::directory{directory})
+    if (entry.is_directory())
+      partitions.push_back(entry);
+  REQUIRE_EQUAL(partitions.size(), 3u);
+  MESSAGE("restarting without a partition index");
+  // After a crash, the partition index may lack the partitions since the last
+  // time the INDEX persisted it.
+  REQUIRE(rm(directory / "meta"));
+  index = self->spawn(system::index, directory,
+                      system::partition_policy{1000}, 5, 10, 0,
+                      system::scheduling_policy{});
+  self->send_exit(index, exit_reason::user_shutdown);
+  self->wait_for(index);
+  for (auto& x : partitions)
+    CHECK(exists(x / "pack"));
+}
+
+TEST(index format version) {
+  directory /= "index";
+  MESSAGE("writing a partition index of the unversioned layout");
+  REQUIRE(mkdir(directory));
+  std::unordered_map<uuid, system::partition_index::interval> old;
+  old[uuid::random()] = {};
+  REQUIRE(save(directory / "meta", old));
+  self->spawn<monitored>(system::index, directory,
+                         system::partition_policy{1000}, 5, 10, 0,
+                         system::scheduling_policy{});
+  self->receive(
+    [&](const down_msg& msg) {
+      CHECK_EQUAL(msg.reason.code(), static_cast<uint8_t>(ec::version_error));
+    }
+  );
+}
+
+TEST(index time windows) {
+  directory /= "index";
+  MESSAGE("spawing with daily partitions");
+  auto policy = system::partition_policy{0, 0, hours{24}};
+  auto index = self->spawn(system::index, directory, policy, 5, 10, 0,
+                           system::scheduling_policy{});
+  // The conn.log spans two days, starting on 2009-11-18. Events arriving
+  // late for the first day go into the partition of the second day.
+  self->send(index, bro_conn_log);
+  self->send(index, bro_dns_log);
+  auto expr = to<expression>("&time > 1970-01-01");
+  REQUIRE(expr);
+  self->send(index, *expr);
+  self->receive(
+    [&](const uuid&, size_t total, size_t scheduled) {
+      CHECK_EQUAL(total, 2u);
+      size_t i = 0;
+      bitmap all;
+      self->receive_for(i, scheduled)(
+        [&](const bitmap& hits) { all |= hits; },
+        error_handler()
+      );
+      CHECK_EQUAL(rank(all), bro_conn_log.size() + bro_dns_log.size());
+    },
+    error_handler()
+  );
+  MESSAGE("restricting the query to the second day");
+  expr = to<expression>("&time > 2009-11-19+06:00:00");
+  REQUIRE(expr);
+  self->send(index, *expr);
+  self->receive(
+    [&](const uuid&, size_t total, size_t) {
+      CHECK_EQUAL(total, 1u);
+    },
+    error_handler()
+  );
+  self->send_exit(index, exit_reason::user_shutdown);
+  self->wait_for(index);
+}
+
+TEST(index cancellation) {
+  directory /= "index";
+  auto index = self->spawn(system::index, directory,
+                           system::partition_policy{1000}, 5, 1, 0,
+                           system::scheduling_policy{});
+  self->send(index, bro_conn_log);
+  self->send(index, bro_dns_log);
+  self->send(index, bro_http_log);
+  auto expr = to<expression>(":addr == 74.125.19.100");
+  REQUIRE(expr);
+  MESSAGE("looking up with an expired deadline");
+  self->send(index, *expr, timestamp{});
+  self->receive(
+    [&](const uuid&, size_t total, size_t scheduled) {
+      CHECK_EQUAL(total, 0u);
+      CHECK_EQUAL(scheduled, 0u);
+    },
+    error_handler()
+  );
+  MESSAGE("canceling a lookup");
+  self->send(index, *expr, timestamp::max());
+  self->receive(
+    [&](const uuid& id, size_t total, size_t scheduled) {
+      CHECK_EQUAL(total, 3u);
+      REQUIRE_EQUAL(scheduled, 1u);
+      self->receive([&](const bitmap&) {}, error_handler());
+      self->send(index, system::cancel_atom::value, id);
+      // The index no longer schedules partitions for the lookup.
+      self->request(index, infinite, id, size_t{1}).receive(
+        [&](size_t n) { CHECK_EQUAL(n, 0u); },
+        error_handler()
+      );
+    },
+    error_handler()
+  );
+  self->send_exit(index, exit_reason::user_shutdown);
+  self->wait_for(index);
+}
+
+TEST(index admission) {
+  directory /= "index";
+  auto scheduling = system::scheduling_policy{};
+  scheduling.max_lookups = 1;
+  auto index = self->spawn(system::index, directory,
+                           system::partition_policy{1000}, 5, 1, 0,
+                           scheduling);
+  self->send(index, bro_conn_log);
+  self->send(index, bro_dns_log);
+  self->send(index, bro_http_log);
+  auto expr = to<expression>(":addr == 74.125.19.100");
+  REQUIRE(expr);
+  auto first = uuid::nil();
+  self->request(index, infinite, *expr).receive(
+    [&](const uuid& id, size_t total, size_t) {
+      CHECK_EQUAL(total, 3u);
+      first = id;
+    },
+    error_handler()
+  );
+  MESSAGE("deferring lookups beyond the admission limit");
+  auto background_lookup = self->request(index, infinite, *expr,
+                                         timestamp::max(), background);
+  auto interactive_lookup = self->request(index, infinite, *expr,
+                                          timestamp::max(), historical);
+  self->send(index, system::cancel_atom::value, first);
+  MESSAGE("admitting interactive lookups first");
+  auto second = uuid::nil();
+  interactive_lookup.receive(
+    [&](const uuid& id, size_t total, size_t scheduled) {
+      CHECK_EQUAL(total, 3u);
+      CHECK_EQUAL(scheduled, 1u);
+      second = id;
+    },
+    error_handler()
+  );
+  self->send(index, system::cancel_atom::value, second);
+  background_lookup.receive(
+    [&](const uuid& id, size_t total, size_t) {
+      CHECK_NOT_EQUAL(id, second);
+      CHECK_EQUAL(total, 3u);
+    },
+    error_handler()
+  );
+  self->send_exit(index, exit_reason::user_shutdown);
+  self->wait_for(index);
+}
+
+TEST(index prefetching) {
+  directory /= "index";
+  auto index = self->spawn(system::index, directory,
+                           system::partition_policy{1000}, 5, 1, 0,
+                           system::scheduling_policy{});
+  self->send(index, bro_conn_log);
+  self->send(index, bro_dns_log);
+  self->send(index, bro_http_log);
+  self->send_exit(index, exit_reason::user_shutdown);
+  self->wait_for(index);
+  // The INDEX reports prefetching to the accountant.
+  scoped_actor accountant{system};
+  system.registry().put(system::accountant_atom::value,
+                        actor_cast<strong_actor_ptr>(accountant));
+  auto metrics = [&] {
+    std::map<std::string, uint64_t> result;
+    auto done = false;
+    while (!done)
+      accountant->receive(
+        [&](const std::string& key, uint64_t x) { result[key] += x; },
+        after(std::chrono::seconds(0)) >> [&] { done = true; }
+      );
+    return result;
+  };
+  auto all = to<expression>("&time > 1970-01-01");
+  REQUIRE(all);
+  // The partitions hold the conn, dns, and http log in this order.
+  auto conn = to<expression>("&time < 2009-11-18+08:05:00");
+  REQUIRE(conn);
+  MESSAGE("prefetching the next partition of a lookup");
+  index = self->spawn(system::index, directory,
+                      system::partition_policy{1000}, 2, 1, 0,
+                      system::scheduling_policy{});
+  self->request(index, infinite, *all).receive(
+    [&](const uuid&, size_t total, size_t scheduled) {
+      CHECK_EQUAL(total, 3u);
+      CHECK_EQUAL(scheduled, 1u);
+    },
+    error_handler()
+  );
+  self->receive([&](const bitmap&) {}, error_handler());
+  CHECK_EQUAL(metrics()["index.prefetch.loaded"], 1u);
+  MESSAGE("evicting partitions that were not prefetched first");
+  // The memory holds the partition of the http log and the prefetched
+  // partition of the dns log. Loading the partition of the conn log evicts
+  // the former.
+  self->request(index, infinite, *conn).receive(
+    [&](const uuid&, size_t total, size_t scheduled) {
+      CHECK_EQUAL(total, 1u);
+      CHECK_EQUAL(scheduled, 1u);
+    },
+    error_handler()
+  );
+  self->receive([&](const bitmap&) {}, error_handler());
+  CHECK_EQUAL(metrics()["index.prefetch.evicted"], 0u);
+  self->send_exit(index, exit_reason::user_shutdown);
+  self->wait_for(index);
+  MESSAGE("prefetching only as many partitions as fit into memory");
+  index = self->spawn(system::index, directory,
+                      system::partition_policy{1000}, 2, 2, 0,
+                      system::scheduling_policy{});
+  self->request(index, infinite, *all).receive(
+    [&](const uuid&, size_t total, size_t scheduled) {
+      CHECK_EQUAL(total, 3u);
+      CHECK_EQUAL(scheduled, 2u);
+    },
+    error_handler()
+  );
+  size_t i = 0;
+  self->receive_for(i, size_t{2})([&](const bitmap&) {}, error_handler());
+  CHECK_EQUAL(metrics()["index.prefetch.loaded"], 0u);
+  self->send_exit(index, exit_reason::user_shutdown);
+  self->wait_for(index);
+  system.registry().erase(system::accountant_atom::value);
 }
 
 FIXTURE_SCOPE_END()
@@ -1,3 +1,5 @@
+#include <fstream>
+
 #include "vast/concept/parseable/to.hpp"
 #include "vast/concept/parseable/vast/expression.hpp"
 #include "vast/concept/printable/stream.hpp"
@@ -20,11 +22,11 @@ FIXTURE_SCOPE(indexer_tests, fixtures::actor_system_and_events)
 TEST(indexer) {
   directory /= "indexer";
   const auto conn_log_type = bro_conn_log[0].type();
-  auto i = self->spawn(system::event_indexer, directory, conn_log_type);
+  auto i = self->spawn(system::event_indexer, directory, conn_log_type,
+                       nullptr, nullptr);
   MESSAGE("ingesting events");
   self->send(i, bro_conn_log);
-  // Event indexers operate with predicates, whereas partitions take entire
-  // expressions.
+  // Event indexers answer both predicates and entire expressions.
   MESSAGE("querying");
   auto pred = to<predicate>("id.resp_p == 995/?");
   REQUIRE(pred);
@@ -54,7 +56,8 @@ TEST(indexer) {
   CHECK(exists(directory / "data" / "id" / "orig_h"));
   CHECK(exists(directory / "meta" / "time"));
   MESSAGE("respawning indexer from file system");
-  i = self->spawn(system::event_indexer, directory, conn_log_type);
+  i = self->spawn(system::event_indexer, directory, conn_log_type,
+                  nullptr, nullptr);
   // Same as above: submit the query and verify the result.
   self->request(i, infinite, *pred).receive(
     [&](bitmap& bm) {
@@ -62,8 +65,7 @@ TEST(indexer) {
     },
     error_handler()
   );
-  // Test another query that involves a map-reduce computation of value
-  // indexers.
+  // Test another query that spans multiple value indexes.
   pred = to<predicate>(":addr == 65.55.184.16");
   REQUIRE(pred);
   self->request(i, infinite, *pred).receive(
@@ -72,6 +74,87 @@ TEST(indexer) {
     },
     error_handler()
   );
+  MESSAGE("evaluating an expression in-process");
+  auto expr = to<expression>(":addr == 65.55.184.16 && id.resp_p == 995/?");
+  REQUIRE(expr);
+  self->request(i, infinite, *expr).receive(
+    [&](const bitmap& bm) {
+      CHECK_EQUAL(rank(bm), 0u);
+    },
+    error_handler()
+  );
+  expr = to<expression>(":addr == 65.55.184.16 || id.resp_p == 995/?");
+  REQUIRE(expr);
+  self->request(i, infinite, *expr).receive(
+    [&](const bitmap& bm) {
+      CHECK_EQUAL(rank(bm), 55u);
+    },
+    error_handler()
+  );
+  MESSAGE("reordering conjunction operands by selectivity");
+  expr = to<expression>("&time > 1970-01-01 && &type == \"bro::conn\" "
+                        "&& id.resp_p == 995/?");
+  REQUIRE(expr);
+  self->request(i, infinite, *expr).receive(
+    [&](const bitmap& bm) {
+      CHECK_EQUAL(rank(bm), 53u);
+    },
+    error_handler()
+  );
+  expr = to<expression>("&time > 1970-01-01 && &type == \"bro::http\"");
+  REQUIRE(expr);
+  self->request(i, infinite, *expr).receive(
+    [&](const bitmap& bm) {
+      CHECK_EQUAL(rank(bm), 0u);
+    },
+    error_handler()
+  );
+  // The estimate of the negation is 0, yet the operand matches.
+  expr = to<expression>("&time > 1970-01-01 "
+                        "&& ! (id.resp_p != 995/? || id.resp_p != 995/?)");
+  REQUIRE(expr);
+  self->request(i, infinite, *expr).receive(
+    [&](const bitmap& bm) {
+      CHECK_EQUAL(rank(bm), 53u);
+    },
+    error_handler()
+  );
+  MESSAGE("answering type queries without a type index");
+  CHECK(!exists(directory / "meta" / "type"));
+  expr = to<expression>("&type == \"bro::conn\"");
+  REQUIRE(expr);
+  self->request(i, infinite, *expr).receive(
+    [&](const bitmap& bm) {
+      CHECK_EQUAL(rank(bm), bro_conn_log.size());
+    },
+    error_handler()
+  );
+  expr = to<expression>("! (&type == \"bro::http\")");
+  REQUIRE(expr);
+  self->request(i, infinite, *expr).receive(
+    [&](const bitmap& bm) {
+      CHECK_EQUAL(rank(bm), bro_conn_log.size());
+    },
+    error_handler()
+  );
+  MESSAGE("reporting value indexes that fail to load");
+  self->send(i, system::shutdown_atom::value);
+  self->wait_for(i);
+  std::ofstream{(directory / "data" / "id" / "resp_p").str()};
+  i = self->spawn(system::event_indexer, directory, conn_log_type,
+                  nullptr, nullptr);
+  pred = to<predicate>("id.resp_p == 995/?");
+  REQUIRE(pred);
+  self->request(i, infinite, *pred).receive(
+    [&](const bitmap&) {
+      FAIL("expected an error");
+    },
+    [&](const caf::error& e) {
+      MESSAGE(self->system().render(e));
+    }
+  );
+  self->send(i, system::shutdown_atom::value);
+  self->wait_for(i);
 }
 
 FIXTURE_SCOPE_END()
@@ -1,8 +1,12 @@
 #include "vast/bitmap.hpp"
 #include "vast/concept/parseable/to.hpp"
 #include "vast/concept/parseable/vast/expression.hpp"
+#include "vast/error.hpp"
+#include "vast/packfile.hpp"
+#include "vast/save.hpp"
 
 #include "vast/system/partition.hpp"
+#include "vast/system/predicate_cache.hpp"
 #include "vast/system/task.hpp"
 
 #define SUITE system
@@ -19,7 +23,7 @@ struct partition_fixture : fixtures::actor_system_and_events {
   partition_fixture() {
     directory /= "partition";
     MESSAGE("ingesting conn.log");
-    partition = self->spawn(system::partition, directory);
+    partition = self->spawn(system::partition, directory, cache);
     self->send(partition, bro_conn_log);
     MESSAGE("ingesting http.log");
     self->send(partition, bro_http_log);
@@ -48,20 +52,31 @@ struct partition_fixture : fixtures::actor_system_and_events {
     self->send(partition, system::shutdown_atom::value);
     self->wait_for(partition);
     REQUIRE(exists(directory));
-    REQUIRE(exists(directory / "547119946" / "data" / "id" / "orig_h"));
-    REQUIRE(exists(directory / "547119946" / "meta" / "time"));
-    REQUIRE(exists(directory / "547119946" / "meta" / "type"));
+    REQUIRE(exists(directory / "pack"));
+    CHECK(!exists(directory / "547119946"));
+    CHECK(!exists(directory / "meta"));
     MESSAGE("respawning partition and sending query again");
-    partition = self->spawn(system::partition, directory);
+    partition = self->spawn(system::partition, directory, cache);
     self->request(partition, infinite, *expr).receive(
       [&](const bitmap& hits) {
         REQUIRE_EQUAL(hits, result);
       },
       error_handler()
     );
+    MESSAGE("answering the query again from the cache");
+    auto cache_hits = cache->hits();
+    self->request(partition, infinite, *expr).receive(
+      [&](const bitmap& hits) {
+        REQUIRE_EQUAL(hits, result);
+      },
+      error_handler()
+    );
+    CHECK(cache->hits() > cache_hits);
     return result;
   }
 
+  std::shared_ptr<system::predicate_cache> cache =
+    std::make_shared<system::predicate_cache>(100);
   actor partition;
 };
 
@@ -92,9 +107,94 @@ TEST(partition queries - attribute extractors) {
   CHECK_EQUAL(rank(hits), 4896u + 8462u);
 }
 
+TEST(partition queries - routing) {
+  MESSAGE("predicates only reach the indexers of types they refer to");
+  auto hits = query("&type == \"bro::http\" "
+                    "|| (conn_state == \"SF\" && id.resp_p == 443/?)");
+  CHECK_EQUAL(rank(hits), 4896u + 38u);
+}
+
 TEST(partition queries - mixed) {
   auto hits = query("service == \"http\" && :addr == 212.227.96.110");
   CHECK_EQUAL(rank(hits), 28u);
 }
 
+TEST(partition queries - batch) {
+  MESSAGE("sending queries with common predicates at once");
+  auto x = to<expression>("conn_state == \"SF\" && id.resp_p == 443/?");
+  auto y = to<expression>("conn_state == \"SF\" || &type == \"bro::http\"");
+  REQUIRE(x);
+  REQUIRE(y);
+  auto rx = self->request(partition, infinite, *x);
+  auto ry = self->request(partition, infinite, *y);
+  auto rz = self->request(partition, infinite, *x);
+  bitmap hits;
+  rx.receive([&](bitmap& xs) { hits = std::move(xs); }, error_handler());
+  CHECK_EQUAL(rank(hits), 38u);
+  ry.receive(
+    [&](const bitmap& ys) { CHECK_GREATER(rank(ys), 4896u); },
+    error_handler()
+  );
+  rz.receive([&](const bitmap& zs) { CHECK_EQUAL(zs, hits); }, error_handler());
+}
+
+TEST(partition merge) {
+  auto root = directory.parent();
+  auto seal = [&](const path& dir, std::vector<std::vector<event>> xs) {
+    auto p = self->spawn(system::partition, dir, nullptr);
+    for (auto& x : xs)
+      self->send(p, std::move(x));
+    self->send(p, system::shutdown_atom::value);
+    self->wait_for(p);
+    REQUIRE(exists(dir / "pack"));
+  };
+  MESSAGE("sealing two partitions");
+  seal(root / "a", {bro_conn_log});
+  seal(root / "b", {bro_http_log, bgpdump_txt});
+  MESSAGE("merging partitions out of ID order");
+  auto merged = root / "merged";
+  REQUIRE(system::merge_partitions(merged, {root / "b", root / "a"}));
+  CHECK(exists(merged / "pack"));
+  CHECK(!exists(merged / "meta"));
+  CHECK(exists(root / "a" / "pack"));
+  CHECK(!system::merge_partitions(merged, {root / "a"}));
+  MESSAGE("querying the merged partition");
+  auto p = self->spawn(system::partition, merged, nullptr);
+  auto check = [&](const std::string& str, size_t n) {
+    auto expr = to<expression>(str);
+    REQUIRE(expr);
+    self->request(p, infinite, *expr).receive(
+      [&](const bitmap& hits) { CHECK_EQUAL(rank(hits), n); },
+      error_handler()
+    );
+  };
+  check("conn_state == \"SF\" && id.resp_p == 443/?", 38u);
+  check("&type == \"bro::http\"", 4896u);
+  check(":subnet in 86.111.146.0/23", 72u);
+  check("&time > 1970-01-01", 4896u + 8462u);
+  self->send(p, system::shutdown_atom::value);
+  self->wait_for(p);
+}
+
+TEST(partition format version) {
+  MESSAGE("sealing a partition with unversioned meta data");
+  auto old = directory.parent() / "old";
+  REQUIRE(mkdir(old));
+  std::vector<std::pair<std::string, type>> meta;
+  meta.emplace_back("42", bro_conn_log[0].type());
+  REQUIRE(save(old / "meta", meta));
+  packfile::writer writer;
+  writer.add("meta", old / "meta");
+  REQUIRE(writer.write(old / "pack"));
+  REQUIRE(rm(old / "meta"));
+  MESSAGE("rejecting the partition up front");
+  self->spawn<monitored>(system::partition, old, nullptr);
+  self->receive(
+    [&](const down_msg& msg) {
+      CHECK_EQUAL(msg.reason.code(), static_cast<uint8_t>(ec::version_error));
+    }
+  );
+  CHECK(!system::merge_partitions(directory.parent() / "merged", {old}));
+}
+
 FIXTURE_SCOPE_END()
@@ -0,0 +1,44 @@
+#include "vast/bitmap.hpp"
+#include "vast/concept/parseable/to.hpp"
+#include "vast/concept/parseable/vast/expression.hpp"
+
+#include "vast/system/predicate_cache.hpp"
+
+#define SUITE system
+#include "test.hpp"
+
+using namespace vast;
+using namespace vast::system;
+
+TEST(predicate cache) {
+  auto x = to<predicate>("x == 42");
+  auto y = to<predicate>("y != 43");
+  REQUIRE(x);
+  REQUIRE(y);
+  predicate_cache cache{2};
+  MESSAGE("miss on empty cache");
+  CHECK(!cache.lookup("/p/a", *x));
+  CHECK_EQUAL(cache.misses(), 1u);
+  MESSAGE("hit after adding");
+  cache.add("/p/a", *x, bitmap{10, true});
+  auto bm = cache.lookup("/p/a", *x);
+  REQUIRE(bm);
+  CHECK(*bm == bitmap(10, true));
+  CHECK_EQUAL(cache.hits(), 1u);
+  MESSAGE("keys include the indexer directory");
+  CHECK(!cache.lookup("/p/b", *x));
+  CHECK(!cache.lookup("/p/a", *y));
+  MESSAGE("evict least recently used entry");
+  cache.add("/p/b", *x, bitmap{5, false});
+  cache.lookup("/p/a", *x);
+  cache.add("/q/a", *y, bitmap{3, true});
+  CHECK_EQUAL(cache.size(), 2u);
+  CHECK(!cache.lookup("/p/b", *x));
+  CHECK(cache.lookup("/p/a", *x));
+  MESSAGE("invalidate a partition");
+  CHECK_EQUAL(cache.invalidate("/p"), 1u);
+  CHECK(!cache.lookup("/p/a", *x));
+  CHECK(cache.lookup("/q/a", *y));
+  CHECK_EQUAL(cache.invalidate("/q/a"), 1u);
+  CHECK_EQUAL(cache.size(), 0u);
+}
@@ -1,4 +1,7 @@
+#include <thread>
+
 #include "vast/value_index.hpp"
+#include "vast/bitmap_algorithms.hpp"
 #include "vast/load.hpp"
 #include "vast/save.hpp"
 
@@ -76,6 +79,31 @@ TEST(integer) {
   CHECK(to_string(*less_than_leet) == "1111011");
 }
 
+TEST(bit-sliced integer) {
+  bitslice_index<integer> idx{base::uniform<64>(2)};
+  MESSAGE("push_back");
+  REQUIRE(idx.push_back(-7));
+  REQUIRE(idx.push_back(42));
+  REQUIRE(idx.push_back(10000));
+  REQUIRE(idx.push_back(4711));
+  REQUIRE(idx.push_back(31337));
+  REQUIRE(idx.push_back(42));
+  REQUIRE(idx.push_back(42));
+  MESSAGE("lookup");
+  CHECK_EQUAL(to_string(*idx.lookup(equal, 42)), "0100011");
+  CHECK_EQUAL(to_string(*idx.lookup(less, 31337)), "1111011");
+  CHECK_EQUAL(to_string(*idx.lookup(less_equal, 42)), "1100011");
+  CHECK_EQUAL(to_string(*idx.lookup(greater, 0)), "0111111");
+  CHECK_EQUAL(to_string(*idx.lookup(greater_equal, 4711)), "0011100");
+  CHECK_EQUAL(to_string(*idx.lookup(not_equal, -7)), "0111111");
+  MESSAGE("serialization");
+  std::vector<char> buf;
+  save(buf, idx);
+  auto idx2 = bitslice_index<integer>{};
+  load(buf, idx2);
+  CHECK_EQUAL(to_string(*idx2.lookup(less, 31337)), "1111011");
+}
+
 TEST(floating-point with custom binner) {
   using index_type = arithmetic_index<real, precision_binner<6, 2>>;
   auto idx = index_type{base::uniform<64>(10)};
@@ -166,6 +194,63 @@ TEST(timestamp) {
   CHECK(to_string(*eighteen) == "000101");
 }
 
+TEST(time index) {
+  using namespace std::chrono;
+  auto epoch = timestamp{};
+  auto at = [&](auto x) { return epoch + x; };
+  time_index idx;
+  MESSAGE("push_back");
+  REQUIRE(idx.push_back(at(nanoseconds(10))));
+  REQUIRE(idx.push_back(at(nanoseconds(20))));
+  REQUIRE(idx.push_back(at(nanoseconds(20))));
+  REQUIRE(idx.push_back(nil));
+  REQUIRE(idx.push_back(at(nanoseconds(15)))); // out of order
+  REQUIRE(idx.push_back(at(nanoseconds(30)), 7));
+  MESSAGE("lookup with nanosecond resolution");
+  CHECK_EQUAL(to_string(*idx.lookup(equal, at(nanoseconds(20)))), "01100000");
+  CHECK_EQUAL(to_string(*idx.lookup(not_equal, at(nanoseconds(20)))),
+              "10001001");
+  CHECK_EQUAL(to_string(*idx.lookup(less, at(nanoseconds(20)))), "10001000");
+  CHECK_EQUAL(to_string(*idx.lookup(less_equal, at(nanoseconds(15)))),
+              "10001000");
+  CHECK_EQUAL(to_string(*idx.lookup(greater, at(nanoseconds(15)))),
+              "01100001");
+  CHECK_EQUAL(to_string(*idx.lookup(greater_equal, at(nanoseconds(31)))),
+              "00000000");
+  CHECK(!idx.lookup(in, at(nanoseconds(20))));
+  MESSAGE("lookup across sorted blocks");
+  time_index big;
+  auto n = time_index::block_size * 3 + 42;
+  for (auto i = 0u; i < n; ++i)
+    REQUIRE(big.push_back(at(microseconds(i))));
+  auto x = at(microseconds(time_index::block_size + 7));
+  auto bm = big.lookup(less, x);
+  REQUIRE(bm);
+  CHECK_EQUAL(rank(*bm), time_index::block_size + 7);
+  CHECK(bm->size() == n);
+  bm = big.lookup(greater_equal, x);
+  REQUIRE(bm);
+  CHECK_EQUAL(rank(*bm), n - time_index::block_size - 7);
+  bm = big.lookup(equal, x);
+  REQUIRE(bm);
+  CHECK_EQUAL(rank(*bm), 1u);
+  CHECK_EQUAL(select(*bm, 1), time_index::block_size + 7);
+  MESSAGE("polymorphic construction and serialization");
+  type t = timestamp_type{}.attributes({{"index", "time"}});
+  auto poly = value_index::make(t);
+  REQUIRE(poly);
+  REQUIRE(dynamic_cast<time_index*>(poly.get()));
+  REQUIRE(poly->push_back(at(nanoseconds(1))));
+  REQUIRE(poly->push_back(at(nanoseconds(2))));
+  std::vector<char> buf;
+  save(buf, detail::value_index_inspect_helper{t, poly});
+  std::unique_ptr<value_index> poly2;
+  detail::value_index_inspect_helper helper{t, poly2};
+  load(buf, helper);
+  REQUIRE(poly2);
+  CHECK_EQUAL(to_string(*poly2->lookup(greater, at(nanoseconds(1)))), "01");
+}
+
 TEST(string) {
   string_index idx{100};
   MESSAGE("push_back");
@@ -257,6 +342,13 @@ TEST(address) {
   addr = *to<address>("192.168.0.2");
   auto str = "01000100000"s + std::string('0', 42) + '1';
   CHECK_EQUAL(idx.lookup(equal, addr), str);
+  MESSAGE("optimization");
+  idx.optimize();
+  CHECK_EQUAL(idx.lookup(equal, addr), str);
+  sub = {*to<address>("192.168.0.128"), 25};
+  bm = idx.lookup(in, sub);
+  REQUIRE(bm);
+  CHECK_EQUAL(rank<1>(*bm), 3u);
   MESSAGE("serialization");
   std::vector<char> buf;
   save(buf, idx);
@@ -349,6 +441,24 @@ TEST(port) {
   CHECK(to_string(*bm) == "1111010");
 }
 
+TEST(bit-sliced port) {
+  bitslice_port_index idx;
+  REQUIRE(idx.push_back(port(80, port::tcp)));
+  REQUIRE(idx.push_back(port(443, port::tcp)));
+  REQUIRE(idx.push_back(port(53, port::udp)));
+  REQUIRE(idx.push_back(port(8, port::icmp)));
+  REQUIRE(idx.push_back(port(31337, port::unknown)));
+  REQUIRE(idx.push_back(port(80, port::tcp)));
+  REQUIRE(idx.push_back(port(8080, port::tcp)));
+  CHECK_EQUAL(to_string(*idx.lookup(equal, port{80, port::tcp})), "1000010");
+  auto priv = port{1024, port::unknown};
+  CHECK_EQUAL(to_string(*idx.lookup(less_equal, priv)), "1111010");
+  CHECK_EQUAL(to_string(*idx.lookup(greater, port{2, port::unknown})),
+              "1111111");
+  CHECK_EQUAL(to_string(*idx.lookup(greater, port{80, port::tcp})),
+              "0100001");
+}
+
 TEST(container) {
   sequence_index idx{string_type{}};
   MESSAGE("push_back");
@@ -401,6 +511,25 @@ TEST(polymorphic) {
   REQUIRE(idx);
   MESSAGE("nil");
   REQUIRE(idx->push_back(nil));
+  MESSAGE("bit-sliced encoding");
+  t = count_type{}.attributes({{"index", "bitslice"}});
+  idx = value_index::make(t);
+  REQUIRE(idx);
+  CHECK(dynamic_cast<bitslice_index<count>*>(idx.get()) != nullptr);
+  REQUIRE(idx->push_back(count{3}));
+  REQUIRE(idx->push_back(count{1000}));
+  REQUIRE(idx->push_back(nil));
+  REQUIRE(idx->push_back(count{999}));
+  CHECK_EQUAL(to_string(*idx->lookup(greater_equal, count{999})), "0101");
+  buf.clear();
+  save(buf, detail::value_index_inspect_helper{t, idx});
+  idx2.reset();
+  load(buf, helper);
+  REQUIRE(idx2);
+  CHECK_EQUAL(to_string(*idx2->lookup(less, count{999})), "1000");
+  t = port_type{}.attributes({{"index", "bitslice"}});
+  idx = value_index::make(t);
+  CHECK(dynamic_cast<bitslice_port_index*>(idx.get()) != nullptr);
 }
 
 // Attention
@@ -442,3 +571,87 @@ TEST(polymorphic none values) {
   REQUIRE(bm);
   CHECK_EQUAL(to_string(*bm), "00000001100000001110000");
 }
+
+TEST(merge) {
+  using query = std::pair<relational_operator, data>;
+  auto check = [](type const& t, std::vector<data> const& xs,
+                  std::vector<data> const& ys,
+                  std::vector<query> const& queries) {
+    // The second index starts where the first one ends, after a gap.
+    auto whole = value_index::make(t);
+    auto first = value_index::make(t);
+    auto second = value_index::make(t);
+    REQUIRE(whole && first && second);
+    auto id = event_id{0};
+    for (auto& x : xs) {
+      REQUIRE(whole->push_back(x, id));
+      REQUIRE(first->push_back(x, id++));
+    }
+    id += 3;
+    for (auto& x : ys) {
+      REQUIRE(whole->push_back(x, id));
+      REQUIRE(second->push_back(x, id++));
+    }
+    REQUIRE(first->merge(*second));
+    CHECK_EQUAL(first->offset(), whole->offset());
+    CHECK_EQUAL(to_string(first->mask()), to_string(whole->mask()));
+    for (auto& q : queries) {
+      auto x = first->lookup(q.first, q.second);
+      auto y = whole->lookup(q.first, q.second);
+      REQUIRE(x && y);
+      CHECK_EQUAL(to_string(*x), to_string(*y));
+    }
+    MESSAGE("reject overlapping IDs");
+    CHECK(!second->merge(*whole));
+  };
+  MESSAGE("integer");
+  check(integer_type{}, {integer{42}, nil, integer{-7}, integer{42}},
+        {integer{3}, integer{42}, nil, nil},
+        {{equal, integer{42}}, {less, integer{5}}, {equal, nil}});
+  MESSAGE("string");
+  check(string_type{}, {"foo"s, "bar"s, nil, "foobar"s},
+        {"bar"s, nil, "a"s, "foo"s},
+        {{equal, "foo"s}, {not_equal, "bar"s}, {ni, "oo"s}});
+  MESSAGE("address");
+  auto a = *to<address>("10.0.0.1");
+  auto b = *to<address>("::1");
+  check(address_type{}, {a, b}, {a, nil, *to<address>("192.168.0.1")},
+        {{equal, a}, {equal, b}, {not_equal, a}});
+  MESSAGE("container");
+  check(vector_type{count_type{}}, {vector{count{1}, count{2}}, vector{}},
+        {vector{count{2}, count{3}, count{4}}, nil},
+        {{ni, count{2}}, {ni, count{4}}, {not_ni, count{1}}});
+  MESSAGE("reject different types");
+  auto x = value_index::make(integer_type{});
+  auto y = value_index::make(string_type{});
+  REQUIRE(y->push_back("foo"s));
+  CHECK(!x->merge(*y));
+}
+
+TEST(concurrent lookups) {
+  auto idx = value_index::make(integer_type{});
+  REQUIRE(idx);
+  for (auto i = 0; i < 10000; ++i)
+    REQUIRE(idx->push_back(integer{i % 1337 - 42}));
+  auto ops = std::vector<relational_operator>{
+    equal, not_equal, less, less_equal, greater, greater_equal};
+  auto lookup_all = [&] {
+    std::vector<bitmap> result;
+    for (auto op : ops)
+      for (auto x = -100; x < 1400; x += 37) {
+        auto bm = idx->lookup(op, integer{x});
+        result.push_back(bm ? std::move(*bm) : bitmap{});
+      }
+    return result;
+  };
+  auto expected = lookup_all();
+  MESSAGE("look up the same values from multiple threads");
+  std::vector<std::vector<bitmap>> results(4);
+  std::vector<std::thread> threads;
+  for (auto& result : results)
+    threads.emplace_back([&] { result = lookup_all(); });
+  for (auto& t : threads)
+    t.join();
+  for (auto& result : results)
+    CHECK(result == expected);
+}
@@ -5,6 +5,7 @@
 #include "vast/detail/type_traits.hpp"
 #include "vast/ewah_bitmap.hpp"
 #include "vast/null_bitmap.hpp"
+#include "vast/roaring_bitmap.hpp"
 #include "vast/wah_bitmap.hpp"
 #include "vast/variant.hpp"
 
@@ -17,7 +18,8 @@ class bitmap : public bitmap_base<bitmap>,
   using bitmap_variant = variant<
     ewah_bitmap,
     null_bitmap,
-    wah_bitmap
+    wah_bitmap,
+    roaring_bitmap
   >;
 
 public:
@@ -59,6 +61,18 @@ public:
 
   void flip();
 
+  /// Switches to the representation requiring the least space, based on the
+  /// density and the runs of the bitmap. The bitmap remains EWAH-encoded
+  /// unless it does not compress, in which case it becomes a ::null_bitmap,
+  /// or unless a ::roaring_bitmap takes at most half the space. Since the
+  /// choice requires a pass over the bitmap, it makes sense only once the
+  /// bitmap receives no more bits.
+  void optimize();
+
+  /// Attaches a skip index to the wrapped bitmap if its type supports one.
+  /// @see ewah_bitmap::build_skip_index
+  void build_skip_index();
+
   // -- concepts -------------------------------------------------------------
 
   friend bool operator==(bitmap const& x, bitmap const& y);
@@ -78,6 +92,9 @@ private:
 
 class bitmap_bit_range
   : public bit_range_base<bitmap_bit_range, bitmap::block_type> {
+  friend bitmap::size_type seek(bitmap_bit_range& rng, bitmap::size_type n,
+                                bitmap::size_type i);
+
 public:
   explicit bitmap_bit_range(bitmap const& bm);
 
@@ -88,7 +105,8 @@ private:
   using range_variant = variant<
     ewah_bitmap_range,
     null_bitmap_range,
-    wah_bitmap_range
+    wah_bitmap_range,
+    roaring_bitmap_range
   >;
 
   range_variant range_;
@@ -96,6 +114,46 @@ private:
 
 bitmap_bit_range bit_range(bitmap const& bm);
 
+/// Advances a type-erased bit range by seeking in the concrete range.
+/// @relates seek
+bitmap::size_type seek(bitmap_bit_range& rng, bitmap::size_type n,
+                       bitmap::size_type i);
+
+/// Computes the rank of a type-erased bitmap on the concrete bitmap, which
+/// allows for using its skip index.
+/// @relates rank
+template <bool Bit = true>
+bitmap::size_type rank(bitmap const& bm, bitmap::size_type i) {
+  return visit([&](auto& x) { return rank<Bit>(x, i); }, bm);
+}
+
+/// Selects a bit of a type-erased bitmap on the concrete bitmap, which
+/// allows for using its skip index.
+/// @relates select
+template <bool Bit = true>
+bitmap::size_type select(bitmap const& bm, bitmap::size_type i) {
+  return visit([&](auto& x) { return select<Bit>(x, i); }, bm);
+}
+
+/// Applies a bitwise operation on two type-erased bitmaps. If both wrap the
+/// same bitmap type with a ::word_range or both wrap a ::roaring_bitmap, the
+/// evaluation operates on the concrete bitmaps.
+/// @relates binary_eval
+template <bool FillLHS, bool FillRHS, class Operation>
+std::enable_if_t<detail::is_bitwise_operation<Operation>{}, bitmap>
+binary_eval(bitmap const& lhs, bitmap const& rhs, Operation op) {
+  if (auto x = get_if<ewah_bitmap>(lhs))
+    if (auto y = get_if<ewah_bitmap>(rhs))
+      return word_eval<FillLHS, FillRHS>(*x, *y, op);
+  if (auto x = get_if<null_bitmap>(lhs))
+    if (auto y = get_if<null_bitmap>(rhs))
+      return word_eval<FillLHS, FillRHS>(*x, *y, op);
+  if (auto x = get_if<roaring_bitmap>(lhs))
+    if (auto y = get_if<roaring_bitmap>(rhs))
+      return binary_eval<FillLHS, FillRHS>(*x, *y, op);
+  return detail::block_eval<FillLHS, FillRHS>(lhs, rhs, op);
+}
+
 } // namespace vast
 
 #endif
@@ -3,13 +3,17 @@
 
 #include <algorithm>
 #include <iterator>
+#include <limits>
 #include <queue>
 #include <type_traits>
+#include <vector>
 
 #include "vast/aliases.hpp"
+#include "vast/bitmap_formula.hpp"
 #include "vast/bits.hpp"
 #include "vast/optional.hpp"
 #include "vast/detail/assert.hpp"
+#include "vast/detail/bitwise.hpp"
 #include "vast/detail/range.hpp"
 #include "vast/detail/type_traits.hpp"
 
@@ -19,37 +23,59 @@ class bitmap;
 
 namespace detail {
 
+/// The owning bitmap type that holds the result of an operation on a given
+/// bitmap type. Read-only views of bitmaps name it as member `bitmap_type`.
+template <class Bitmap, class = void>
+struct owning_bitmap {
+  using type = Bitmap;
+};
+
+template <class Bitmap>
+struct owning_bitmap<
+  Bitmap,
+  decltype(void(std::declval<typename Bitmap::bitmap_type>()))
+> {
+  using type = typename Bitmap::bitmap_type;
+};
+
+template <class Bitmap>
+using owning_bitmap_t = typename owning_bitmap<Bitmap>::type;
+
 template <class T, class U>
 struct eval_result_type {
-  using type = std::conditional_t<std::is_same<T, U>::value, T, bitmap>;
+  using type = std::conditional_t<
+    std::is_same<owning_bitmap_t<T>, owning_bitmap_t<U>>::value,
+    owning_bitmap_t<T>,
+    bitmap
+  >;
 };
 
 template <class T, class U>
 using eval_result_type_t = typename eval_result_type<T, U>::type;
 
-} // namespace detail
+/// Checks whether a bitmap type provides a ::word_range.
+template <class Bitmap, class = void>
+struct has_word_range : std::false_type {};
 
-/// Applies a bitwise operation on two immutable bitmaps, writing the result
-/// into a new bitmap.
-/// @tparam FillLHS A boolean flag that controls the algorithm behavior after
-///                 one sequence has reached its end. If `true`, the algorithm
-///                 will append the remaining bits of *lhs* to the result iff
-///                 *lhs* is the longer bitmap. If `false`, the algorithm
-///                 returns the result after the first sequence has reached an
-///                 end.
-/// @tparam FillRHS The same as *fill_lhs*, except that it concerns *rhs*.
-/// @param lhs The LHS of the operation.
-/// @param rhs The RHS of the operation
-/// @param op The bitwise operation as block-wise lambda, e.g., for XOR:
-///
-///     [](auto lhs, auto rhs) { return lhs ^ rhs; }
-///
-/// @returns The result of a bitwise operation between *lhs* and *rhs*
-/// according to *op*.
+template <class Bitmap>
+struct has_word_range<
+  Bitmap,
+  decltype(void(word_range(std::declval<Bitmap const&>())))
+> : std::true_type {};
+
+/// Checks whether an operation is one of the ::bitwise_operation types.
+template <class Operation, class = void>
+struct is_bitwise_operation : std::false_type {};
+
+template <class Operation>
+struct is_bitwise_operation<Operation, decltype(void(Operation::kind))>
+  : std::true_type {};
+
+/// The block-wise implementation of ::binary_eval for arbitrary bitmaps.
 template <bool FillLHS, bool FillRHS, class LHS, class RHS, class Operation>
-detail::eval_result_type_t<LHS, RHS>
-binary_eval(LHS const& lhs, RHS const& rhs, Operation op) {
-  using result_type = detail::eval_result_type_t<LHS, RHS>;
+eval_result_type_t<LHS, RHS>
+block_eval(LHS const& lhs, RHS const& rhs, Operation op) {
+  using result_type = eval_result_type_t<LHS, RHS>;
   using word_type = typename result_type::word_type;
   static_assert(
     detail::are_same<
@@ -62,8 +88,16 @@ binary_eval(LHS const& lhs, RHS const& rhs, Operation op) {
   // homogeneous sequence greater-than-or-equal to the word size, or whether
   // we can operate on the bit sequences directly, possibly leading to
   // simplifications.
-  auto is_fill = [](auto x) {
-    return x->homogeneous() && x->size() >= word_type::width;
+  // A fill need not end at a block boundary, e.g., when it includes the last
+  // partial block of a bitmap. Therefore we consider the remaining bits of the
+  // current sequence rather than its size: once less than a block of a fill
+  // remains, we treat the remainder as literal.
+  auto is_fill = [](auto x, uint64_t bits) {
+    return x->homogeneous() && bits >= word_type::width;
+  };
+  auto value = [](auto x, uint64_t bits) {
+    return bits < word_type::width ? x->data() & word_type::lsb_mask(bits)
+                                   : x->data();
   };
   result_type result;
   // Initialize LHS.
@@ -78,20 +112,22 @@ binary_eval(LHS const& lhs, RHS const& rhs, Operation op) {
   uint64_t lhs_bits = lhs.empty() ? 0 : lhs_begin->size();
   uint64_t rhs_bits = rhs.empty() ? 0 : rhs_begin->size();
   while (lhs_begin != lhs_end && rhs_begin != rhs_end) {
-    auto block = op(lhs_begin->data(), rhs_begin->data());
-    if (is_fill(lhs_begin) && is_fill(rhs_begin)) {
+    auto block = op(value(lhs_begin, lhs_bits), value(rhs_begin, rhs_bits));
+    auto lhs_fill = is_fill(lhs_begin, lhs_bits);
+    auto rhs_fill = is_fill(rhs_begin, rhs_bits);
+    if (lhs_fill && rhs_fill) {
       VAST_ASSERT(word_type::all_or_none(block));
       auto min_bits = std::min(lhs_bits, rhs_bits);
       result.append_bits(block, min_bits);
       lhs_bits -= min_bits;
       rhs_bits -= min_bits;
-    } else if (is_fill(lhs_begin)) {
+    } else if (lhs_fill) {
       VAST_ASSERT(rhs_bits > 0);
       VAST_ASSERT(rhs_bits <= word_type::width);
       result.append_block(block);
       lhs_bits -= word_type::width;
       rhs_bits = 0;
-    } else if (is_fill(rhs_begin)) {
+    } else if (rhs_fill) {
       VAST_ASSERT(lhs_bits > 0);
       VAST_ASSERT(lhs_bits <= word_type::width);
       result.append_block(block);
@@ -109,17 +145,17 @@ binary_eval(LHS const& lhs, RHS const& rhs, Operation op) {
   // Fill the remaining bits, either with zeros or with the longer bitmap. If
   // we woudn't fill up the bitmap, we would end up with a shorter bitmap that
   // doesn't reflect the true result size.
-  if (!FillLHS && !FillLHS) {
+  if (!FillLHS && !FillRHS) {
     auto max_size = std::max(lhs.size(), rhs.size());
     VAST_ASSERT(max_size >= result.size());
     result.append_bits(false, max_size - result.size());
   } else {
     if (FillLHS) {
       while (lhs_begin != lhs_end) {
-        if (is_fill(lhs_begin))
+        if (lhs_begin->size() > word_type::width)
           result.append_bits(lhs_begin->data(), lhs_bits);
         else
-          result.append_block(lhs_begin->data(), lhs_begin->size());
+          result.append_block(lhs_begin->data(), lhs_bits);
         ++lhs_begin;
         if (lhs_begin != lhs_end)
           lhs_bits = lhs_begin->size();
@@ -127,20 +163,238 @@ binary_eval(LHS const& lhs, RHS const& rhs, Operation op) {
     }
     if (FillRHS) {
       while (rhs_begin != rhs_end) {
-        if (is_fill(rhs_begin))
+        if (rhs_begin->size() > word_type::width)
           result.append_bits(rhs_begin->data(), rhs_bits);
         else
-          result.append_block(rhs_begin->data(), rhs_begin->size());
+          result.append_block(rhs_begin->data(), rhs_bits);
         ++rhs_begin;
         if (rhs_begin != rhs_end)
           rhs_bits = rhs_begin->size();
       }
     }
+    // If only the longer side fills, e.g., in a difference, the result ends
+    // at the first block boundary past the shorter side, just as with the
+    // word-wise evaluation. We must pad explicitly because the shorter side
+    // may end in a fill that does not end at a block boundary.
+    auto pad = [&](uint64_t shorter, uint64_t longer) {
+      auto blocks = (shorter + word_type::width - 1) / word_type::width;
+      auto end = std::min(longer, blocks * word_type::width);
+      if (result.size() < end)
+        result.append_bits(false, end - result.size());
+    };
+    if (FillLHS && !FillRHS && lhs.size() < rhs.size())
+      pad(lhs.size(), rhs.size());
+    if (FillRHS && !FillLHS && rhs.size() < lhs.size())
+      pad(rhs.size(), lhs.size());
+  }
+  return result;
+}
+
+/// Appends the remaining words of a range to a bitmap.
+/// @param result The bitmap to append to.
+/// @param rng The word range positioned at the first words to append.
+/// @param skip The number of blocks to skip in the current words of *rng*.
+template <class Bitmap, class Range>
+void append_words(Bitmap& result, Range& rng, uint64_t skip) {
+  using word_type = typename Bitmap::word_type;
+  for (; !rng.done(); rng.next(), skip = 0) {
+    auto& x = rng.get();
+    auto bits = x.size() - skip * word_type::width;
+    if (x.fill()) {
+      result.append_bits(x.value() != 0, bits);
+    } else {
+      auto partial = bits % word_type::width;
+      result.append_blocks(x.data() + skip, bits / word_type::width);
+      if (partial > 0)
+        result.append_block(x.data()[x.blocks() - 1]
+                              & word_type::lsb_mask(partial),
+                            partial);
+    }
+  }
+}
+
+} // namespace detail
+
+/// A bitwise operation on blocks that ::binary_eval can map to a vectorized
+/// kernel.
+/// @tparam Op The operation.
+template <detail::bitwise_operator Op>
+struct bitwise_operation {
+  static constexpr detail::bitwise_operator kind = Op;
+
+  template <class T>
+  T operator()(T x, T y) const {
+    return static_cast<T>(detail::apply(Op, x, y));
+  }
+};
+
+using and_operation = bitwise_operation<detail::bitwise_operator::bitwise_and>;
+using or_operation = bitwise_operation<detail::bitwise_operator::bitwise_or>;
+using xor_operation = bitwise_operation<detail::bitwise_operator::bitwise_xor>;
+using nand_operation =
+  bitwise_operation<detail::bitwise_operator::bitwise_nand>;
+using nor_operation = bitwise_operation<detail::bitwise_operator::bitwise_nor>;
+
+/// Applies a bitwise operation on two bitmaps of the same type in terms of
+/// sequences of whole blocks, as opposed to one block at a time. Fills are
+/// processed in constant time, and literals with a vectorized kernel.
+/// @tparam FillLHS See ::binary_eval.
+/// @tparam FillRHS See ::binary_eval.
+/// @param lhs The LHS of the operation.
+/// @param rhs The RHS of the operation
+/// @param op The bitwise operation.
+/// @returns The result of a bitwise operation between *lhs* and *rhs*
+/// according to *op*.
+/// @pre `Bitmap` provides a ::word_range.
+template <bool FillLHS, bool FillRHS, class Bitmap, class Operation>
+detail::owning_bitmap_t<Bitmap>
+word_eval(Bitmap const& lhs, Bitmap const& rhs, Operation op) {
+  using word_type = typename Bitmap::word_type;
+  using block_type = typename word_type::value_type;
+  using size_type = typename Bitmap::size_type;
+  static constexpr size_type scratch_size = 256;
+  block_type scratch[scratch_size];
+  detail::owning_bitmap_t<Bitmap> result;
+  auto lhs_range = word_range(lhs);
+  auto rhs_range = word_range(rhs);
+  // The number of blocks consumed from the current words of each side.
+  auto lhs_blocks = size_type{0};
+  auto rhs_blocks = size_type{0};
+  // Returns the number of valid bits in the i-th block of some words.
+  auto valid_bits = [](auto& x, size_type i) {
+    auto partial = x.size() % word_type::width;
+    return i + 1 == x.blocks() && partial > 0 ? partial : word_type::width;
+  };
+  // Returns the i-th block of some words, with invalid bits cleared.
+  auto block_at = [&](auto& x, size_type i) {
+    auto block = x.fill() ? x.value() : x.data()[i];
+    auto bits = valid_bits(x, i);
+    return bits < word_type::width ? block & word_type::lsb_mask(bits) : block;
+  };
+  while (!lhs_range.done() && !rhs_range.done()) {
+    auto& x = lhs_range.get();
+    auto& y = rhs_range.get();
+    auto n = std::min(x.blocks() - lhs_blocks, y.blocks() - rhs_blocks);
+    // We process a trailing partial block separately.
+    if (valid_bits(x, lhs_blocks + n - 1) < word_type::width
+        || valid_bits(y, rhs_blocks + n - 1) < word_type::width)
+      --n;
+    if (n == 0) {
+      auto block = op(block_at(x, lhs_blocks), block_at(y, rhs_blocks));
+      auto bits = std::max(valid_bits(x, lhs_blocks),
+                           valid_bits(y, rhs_blocks));
+      result.append_block(block, bits);
+      n = 1;
+    } else if (x.fill() && y.fill()) {
+      result.append_bits(op(x.value(), y.value()) != 0, n * word_type::width);
+    } else if (x.fill() || y.fill()) {
+      // A fill either determines the result or lets the literal pass through
+      // as is or complemented.
+      auto literal = x.fill() ? y.data() + rhs_blocks : x.data() + lhs_blocks;
+      auto fill = x.fill() ? x.value() : y.value();
+      auto with_none = x.fill() ? op(fill, word_type::none)
+                                : op(word_type::none, fill);
+      auto with_all = x.fill() ? op(fill, word_type::all)
+                               : op(word_type::all, fill);
+      if (with_none == with_all) {
+        result.append_bits(with_none != 0, n * word_type::width);
+      } else if (with_none == word_type::none) {
+        result.append_blocks(literal, n);
+      } else {
+        for (auto i = size_type{0}; i < n; i += scratch_size) {
+          auto k = std::min(scratch_size, n - i);
+          detail::complement_blocks(literal + i, scratch, k);
+          result.append_blocks(scratch, k);
+        }
+      }
+    } else {
+      auto xs = x.data() + lhs_blocks;
+      auto ys = y.data() + rhs_blocks;
+      for (auto i = size_type{0}; i < n; i += scratch_size) {
+        auto k = std::min(scratch_size, n - i);
+        detail::bitwise_blocks(Operation::kind, xs + i, ys + i, scratch, k);
+        result.append_blocks(scratch, k);
+      }
+    }
+    lhs_blocks += n;
+    rhs_blocks += n;
+    if (lhs_blocks == x.blocks()) {
+      lhs_range.next();
+      lhs_blocks = 0;
+    }
+    if (rhs_blocks == y.blocks()) {
+      rhs_range.next();
+      rhs_blocks = 0;
+    }
+  }
+  // Fill the remaining bits with the same semantics as ::binary_eval.
+  if (!FillLHS && !FillRHS) {
+    auto max_size = std::max(lhs.size(), rhs.size());
+    VAST_ASSERT(max_size >= result.size());
+    result.append_bits(false, max_size - result.size());
+  } else {
+    if (FillLHS)
+      detail::append_words(result, lhs_range, lhs_blocks);
+    if (FillRHS)
+      detail::append_words(result, rhs_range, rhs_blocks);
   }
   return result;
 }
 
-/// Evaluates a binary operation over multiple bitmaps.
+/// Applies a bitwise operation on two immutable bitmaps, writing the result
+/// into a new bitmap.
+/// @tparam FillLHS A boolean flag that controls the algorithm behavior after
+///                 one sequence has reached its end. If `true`, the algorithm
+///                 will append the remaining bits of *lhs* to the result iff
+///                 *lhs* is the longer bitmap. If `false`, the algorithm
+///                 returns the result after the first sequence has reached an
+///                 end.
+/// @tparam FillRHS The same as *fill_lhs*, except that it concerns *rhs*.
+/// @param lhs The LHS of the operation.
+/// @param rhs The RHS of the operation
+/// @param op The bitwise operation as block-wise lambda, e.g., for XOR:
+///
+///     [](auto lhs, auto rhs) { return lhs ^ rhs; }
+///
+/// @returns The result of a bitwise operation between *lhs* and *rhs*
+/// according to *op*.
+/// @note If *lhs* and *rhs* have the same type that provides a ::word_range
+///       and *op* is a ::bitwise_operation, the evaluation dispatches to
+///       ::word_eval.
+template <bool FillLHS, bool FillRHS, class LHS, class RHS, class Operation>
+detail::eval_result_type_t<LHS, RHS>
+binary_eval(LHS const& lhs, RHS const& rhs, Operation op) {
+  return detail::block_eval<FillLHS, FillRHS>(lhs, rhs, op);
+}
+
+template <bool FillLHS, bool FillRHS, class Bitmap, class Operation>
+std::enable_if_t<
+  detail::has_word_range<Bitmap>{}
+    && detail::is_bitwise_operation<Operation>{},
+  detail::owning_bitmap_t<Bitmap>
+>
+binary_eval(Bitmap const& lhs, Bitmap const& rhs, Operation op) {
+  return word_eval<FillLHS, FillRHS>(lhs, rhs, op);
+}
+
+namespace detail {
+
+/// Counts the sequences in the bit range of a bitmap, which reflects its
+/// compressed size and thereby the cost of a bitwise operation on it.
+template <class Bitmap>
+uint64_t num_sequences(Bitmap const& bm) {
+  auto result = uint64_t{0};
+  for (auto rng = bit_range(bm); !rng.done(); rng.next())
+    ++result;
+  return result;
+}
+
+} // namespace detail
+
+/// Evaluates a binary operation over multiple bitmaps pairwise. Each step
+/// combines the two bitmaps with the smallest compressed size, i.e., the
+/// fewest sequences in their bit ranges, and releases intermediate results as
+/// soon as they have been consumed.
 /// @param begin The beginning of the bitmap range.
 /// @param end The end of the bitmap range.
 /// @param op A binary bitwise operation to execute over the given bitmaps.
@@ -151,88 +405,112 @@ binary_eval(LHS const& lhs, RHS const& rhs, Operation op) {
 template <class Iterator, class Operation>
 auto nary_eval(Iterator begin, Iterator end, Operation op) {
   using bitmap_type = std::decay_t<decltype(*begin)>;
-  // Exposes a pointer to represent either a non-owned bitmap from the input
-  // sequence or an intermediary result.
+  static constexpr auto input = std::numeric_limits<size_t>::max();
+  // Refers to either a bitmap from the input sequence or an intermediate
+  // result.
   struct element {
-    explicit element(bitmap_type const* bm) : bitmap{bm} {
-    }
-    explicit element(bitmap_type&& bm)
-      : data{std::make_shared<bitmap_type>(std::move(bm))},
-        bitmap{data.get()} {
-    }
-    std::shared_ptr<bitmap_type> data;
     bitmap_type const* bitmap;
+    size_t result; // The index of the intermediate result or `input`.
+    uint64_t cost;
   };
-  auto cmp = [](auto& lhs, auto& rhs) {
-    // TODO: instead of using the bitmap size, we should consider whether
-    // the rank yields better performance.
-    return lhs.bitmap->size() > rhs.bitmap->size();
-  };
-  std::priority_queue<element, std::vector<element>, decltype(cmp)> queue{cmp};
+  std::vector<element> elements;
   for (; begin != end; ++begin)
-    queue.emplace(&*begin);
-  // Evaluate bitmaps.
-  while (!queue.empty()) {
+    elements.push_back({&*begin, input, detail::num_sequences(*begin)});
+  if (elements.empty())
+    return bitmap_type{};
+  if (elements.size() == 1)
+    return *elements[0].bitmap;
+  // Reserving space for all intermediate results keeps pointers to them
+  // stable.
+  std::vector<bitmap_type> results;
+  results.reserve(elements.size() - 1);
+  auto cmp = [](auto& lhs, auto& rhs) { return lhs.cost > rhs.cost; };
+  std::priority_queue<element, std::vector<element>, decltype(cmp)> queue{
+    cmp, std::move(elements)};
+  auto release = [&](element const& x) {
+    if (x.result != input)
+      results[x.result] = bitmap_type{};
+  };
+  while (queue.size() > 1) {
     auto lhs = queue.top();
     queue.pop();
-    if (queue.empty())
-      // When our input sequence consists of a single bitmap, we end up with an
-      // element that has no data. Otherwise we would have had a least one
-      // intermediary result, which would be stored as data.
-      return lhs.data ? std::move(*lhs.data) : *lhs.bitmap;
     auto rhs = queue.top();
     queue.pop();
-    queue.emplace(op(*lhs.bitmap, *rhs.bitmap));
+    results.push_back(op(*lhs.bitmap, *rhs.bitmap));
+    release(lhs);
+    release(rhs);
+    auto& x = results.back();
+    queue.push({&x, results.size() - 1, detail::num_sequences(x)});
   }
-  return bitmap_type{};
+  return std::move(results.back());
+}
+
+namespace detail {
+
+/// Evaluates an associative bitwise operation over multiple bitmaps in a
+/// single pass over all of them, without intermediate results. Since the
+/// vectorized evaluation of two bitmaps outperforms the single pass, the
+/// function evaluates up to two bitmaps with ::nary_eval.
+/// @param begin The beginning of the bitmap range.
+/// @param end The end of the bitmap range.
+/// @param op The operation, which must apply to both bitmaps and
+///           ::bitmap_formula instances.
+/// @returns The application of *op* over the bitmaps *[begin,end)*.
+template <class Iterator, class Operation>
+auto multiway_eval(Iterator begin, Iterator end, Operation op) {
+  using bitmap_type = std::decay_t<decltype(*begin)>;
+  using formula = bitmap_formula<bitmap_type>;
+  if (std::distance(begin, end) <= 2)
+    return nary_eval(begin, end, op);
+  formula f{*begin};
+  for (++begin; begin != end; ++begin)
+    f = op(f, formula{*begin});
+  return eval(f);
 }
 
+} // namespace detail
+
 template <class LHS, class RHS>
 auto binary_and(LHS const& lhs, RHS const& rhs) {
-  auto op = [](auto x, auto y) { return x & y; };
-  return binary_eval<false, false>(lhs, rhs, op);
+  return binary_eval<false, false>(lhs, rhs, and_operation{});
 }
 
 template <class LHS, class RHS>
 auto binary_or(LHS const& lhs, RHS const& rhs) {
-  auto op = [](auto x, auto y) { return x | y; };
-  return binary_eval<true, true>(lhs, rhs, op);
+  return binary_eval<true, true>(lhs, rhs, or_operation{});
 }
 
 template <class LHS, class RHS>
 auto binary_xor(LHS const& lhs, RHS const& rhs) {
-  auto op = [](auto x, auto y) { return x ^ y; };
-  return binary_eval<true, true>(lhs, rhs, op);
+  return binary_eval<true, true>(lhs, rhs, xor_operation{});
 }
 
 template <class LHS, class RHS>
 auto binary_nand(LHS const& lhs, RHS const& rhs) {
-  auto op = [](auto x, auto y) { return x & ~y; };
-  return binary_eval<true, false>(lhs, rhs, op);
+  return binary_eval<true, false>(lhs, rhs, nand_operation{});
 }
 
 template <class LHS, class RHS>
 auto binary_nor(LHS const& lhs, RHS const& rhs) {
-  auto op = [](auto x, auto y) { return x | ~y; };
-  return binary_eval<true, true>(lhs, rhs, op);
+  return binary_eval<true, true>(lhs, rhs, nor_operation{});
 }
 
 template <class Iterator>
 auto nary_and(Iterator begin, Iterator end) {
-  auto op = [](auto x, auto y) { return x & y; };
-  return nary_eval(begin, end, op);
+  auto op = [](auto const& x, auto const& y) { return x & y; };
+  return detail::multiway_eval(begin, end, op);
 }
 
 template <class Iterator>
 auto nary_or(Iterator begin, Iterator end) {
-  auto op = [](auto x, auto y) { return x | y; };
-  return nary_eval(begin, end, op);
+  auto op = [](auto const& x, auto const& y) { return x | y; };
+  return detail::multiway_eval(begin, end, op);
 }
 
 template <class Iterator>
 auto nary_xor(Iterator begin, Iterator end) {
-  auto op = [](auto x, auto y) { return x ^ y; };
-  return nary_eval(begin, end, op);
+  auto op = [](auto const& x, auto const& y) { return x ^ y; };
+  return detail::multiway_eval(begin, end, op);
 }
 
 /// Computes the *rank* of a Bitmap, i.e., the number of occurrences of a bit
@@ -300,6 +578,23 @@ select(Bitmap const& bm, typename Bitmap::size_type i) {
   return Bitmap::word_type::npos;
 }
 
+/// Advances a bit range to the sequence containing a given position. Bit
+/// ranges over bitmaps with an index may provide a faster overload.
+/// @param rng The bit range to advance.
+/// @param n The position of the current sequence of *rng*.
+/// @param i The position to seek to.
+/// @returns The position of the current sequence after advancing *rng*, which
+///          contains *i* unless *rng* is done.
+/// @pre `n <= i`
+template <class BitRange, class Size>
+Size seek(BitRange& rng, Size n, Size i) {
+  while (!rng.done() && n + rng.get().size() <= i) {
+    n += rng.get().size();
+    rng.next();
+  }
+  return n;
+}
+
 /// A higher-order range that takes a bit-sequence range and transforms it into
 /// range of 1-bits. In ther words, this range provides an incremental
 /// interface to the one-shot algorithm that ::select computes.
@@ -363,21 +658,17 @@ public:
       i_ += n - 1;
       next();
     } else {
-      n -= remaining;
+      auto target = n_ + i_ + n;
       i_ = word_type::npos;
       n_ += rng_.get().size();
       rng_.next();
-      while (rng_) {
-        if (n > rng_.get().size()) {
-          n -= rng_.get().size();
-        } else {
-          i_ = n - 2;
-          next();
-          break;
-        }
-        n_ += rng_.get().size();
-        rng_.next();
-      }
+      n_ = seek(rng_, n_, target);
+      if (rng_.done())
+        return;
+      auto offset = target - n_;
+      i_ = offset == 0 ? find_first(rng_.get())
+                       : find_next(rng_.get(), offset - 1);
+      scan();
     }
   }
 
@@ -1,6 +1,7 @@
 #ifndef VAST_BITMAP_BASE_HPP
 #define VAST_BITMAP_BASE_HPP
 
+#include <algorithm>
 #include <cstdint>
 #include <limits>
 
@@ -35,6 +36,17 @@ namespace vast {
 ///    // to iterate over the bitmap in terms of sequences of bits.
 ///    auto bit_range(bitmap const& bm);
 ///
+/// Bitmaps that store blocks verbatim may additionally provide a range over
+/// sequences of whole blocks, which enables vectorized bitwise operations
+/// (see ::word_eval):
+///
+///    // Appends *n* complete blocks.
+///    void bitmap::append_blocks(block_type const* xs, size_type n);
+///
+///    // Provides a range instance to iterate over the bitmap in terms of
+///    // fills and literals.
+///    auto word_range(bitmap const& bm);
+///
 /// If possible, derived types shall provide an optimized version of the
 /// following operators:
 ///
@@ -74,6 +86,39 @@ public:
         derived().append_block(bits.data(), bits.size());
   }
 
+  /// Appends the contents of any other bitmap to this one, starting at a
+  /// given position of the other bitmap.
+  /// @tparam The type of the other bitmap.
+  /// @param other The other bitmap.
+  /// @param first The position in *other* of the first bit to append.
+  /// @pre `size() + other.size() - first` <= max_size`
+  template <class Bitmap>
+  void append_from(Bitmap const& other, size_type first) {
+    auto n = size_type{0};
+    for (auto bits : bit_range(other)) {
+      auto end = n + bits.size();
+      if (end <= first) {
+        n = end;
+        continue;
+      }
+      auto skip = first > n ? first - n : 0;
+      auto size = bits.size() - skip;
+      n = end;
+      if (bits.size() > word_type::width)
+        derived().append_bits(bits.data(), size);
+      else if (size == 1)
+        derived().append_bit((bits.data() >> skip) & word_type::lsb1);
+      else
+        derived().append_block(bits.data() >> skip, size);
+    }
+  }
+
+  /// Switches to the representation requiring the least space. Bitmaps with
+  /// a fixed representation have nothing to do.
+  void optimize() {
+    // nop
+  }
+
   /// Appends a single bit.
   /// @tparam Bit the bit value to append.
   template <bool Bit>
@@ -162,34 +207,71 @@ public:
 
   // -- inplace bitwise operations---------------------------------------------
   //
-  // Derived types should provide an optimized version where possible.
-
-  Derived& operator&=(Derived const rhs) {
-    derived() = derived() & rhs;
+  // Derived types should provide an optimized version where possible. The
+  // generic versions avoid re-encoding the LHS if one side has no 1-bits
+  // where the sides overlap. In particular, when accumulating bitmaps of
+  // increasing IDs, the RHS lies past the end of the LHS and the operation
+  // boils down to appending the tail of the RHS.
+
+  Derived& operator&=(Derived const& rhs) {
+    auto n = derived().size();
+    if (select<1>(rhs, 1) >= n) {
+      derived() = Derived{std::max(n, rhs.size()), false};
+    } else if (select<1>(derived(), 1) == word_type::npos) {
+      if (rhs.size() > n)
+        derived().append_bits(false, rhs.size() - n);
+    } else {
+      derived() = derived() & rhs;
+    }
     return derived();
   }
 
-  Derived& operator|=(Derived const rhs) {
-    derived() = derived() | rhs;
-    return derived();
+  Derived& operator|=(Derived const& rhs) {
+    return append_or_eval(rhs, [](auto& x, auto& y) { return x | y; });
   }
 
-  Derived& operator^=(Derived const rhs) {
-    derived() = derived() ^ rhs;
-    return derived();
+  Derived& operator^=(Derived const& rhs) {
+    return append_or_eval(rhs, [](auto& x, auto& y) { return x ^ y; });
   }
 
-  Derived& operator-=(Derived const rhs) {
-    derived() = derived() - rhs;
+  Derived& operator-=(Derived const& rhs) {
+    auto n = derived().size();
+    if (select<1>(rhs, 1) >= n) {
+      // A difference with a shorter LHS ends at the first block boundary past
+      // the LHS.
+      auto blocks = (n + word_type::width - 1) / word_type::width;
+      auto m = std::min(rhs.size(), blocks * word_type::width);
+      if (m > n)
+        derived().append_bits(false, m - n);
+    } else {
+      derived() = derived() - rhs;
+    }
     return derived();
   }
 
-  Derived& operator/=(Derived const rhs) {
+  Derived& operator/=(Derived const& rhs) {
     derived() = derived() / rhs;
     return derived();
   }
 
 private:
+  // Evaluates an operation that maps 0 to the identity, i.e., OR and XOR.
+  template <class F>
+  Derived& append_or_eval(Derived const& rhs, F f) {
+    auto n = derived().size();
+    if (select<1>(rhs, 1) >= n) {
+      if (rhs.size() > n)
+        derived().append_from(rhs, n);
+    } else if (select<1>(derived(), 1) == word_type::npos) {
+      derived() = rhs;
+      if (n > rhs.size())
+        derived().append_bits(false, n - rhs.size());
+    } else {
+      derived() = f(derived(), rhs);
+    }
+    return derived();
+  }
+
   Derived& derived() {
     return *static_cast<Derived*>(this);
   }
@@ -211,6 +293,18 @@ protected:
   bits<Block> bits_;
 };
 
+/// The base class for bitmap word ranges.
+template <class Derived, class Block>
+class word_range_base : public detail::range_facade<Derived> {
+public:
+  words<Block> const& get() const {
+    return words_;
+  }
+
+protected:
+  words<Block> words_;
+};
+
 } // namespace vast
 
 #endif
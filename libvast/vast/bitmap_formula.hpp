@@ -0,0 +1,238 @@
+#ifndef VAST_BITMAP_FORMULA_HPP
+#define VAST_BITMAP_FORMULA_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "vast/detail/bitwise.hpp"
+
+namespace vast {
+
+/// A lazily evaluated boolean formula over bitmaps. Combining bitmaps with
+/// the bitwise operators of this class builds a DAG of operations instead of
+/// computing intermediate bitmaps. The function ::eval then walks over the
+/// bit sequences of all input bitmaps in lock-step and materializes only the
+/// final result.
+///
+/// A formula references its input bitmaps, which must outlive it. The sizes
+/// of all results match the bitwise operations on bitmaps: a binary operation
+/// has the size of its larger operand, with the shorter operand counting as 0
+/// beyond its end, except that a difference with a shorter LHS ends at the
+/// first block boundary past the LHS. A complement has the size of its
+/// operand.
+/// @tparam Bitmap The type of the input and result bitmaps.
+template <class Bitmap>
+class bitmap_formula {
+public:
+  using bitmap_type = Bitmap;
+  using size_type = typename Bitmap::size_type;
+  using word_type = typename Bitmap::word_type;
+  using block_type = typename word_type::value_type;
+
+  /// Constructs a formula that consists of a constant sequence.
+  /// @param n The number of bits.
+  /// @param bit The value of all *n* bits.
+  bitmap_formula(size_type n, bool bit) {
+    nodes_.push_back({node::constant, {}, 0, 0, bit, n});
+  }
+
+  /// Constructs a formula that consists of a single bitmap.
+  /// @param bm The bitmap to reference.
+  bitmap_formula(Bitmap const& bm) {
+    inputs_.push_back(&bm);
+    nodes_.push_back({node::input, {}, 0, 0, false, bm.size()});
+  }
+
+  /// Prevents referencing temporaries.
+  bitmap_formula(Bitmap&&) = delete;
+
+  /// @returns The size of the result of ::eval.
+  size_type size() const {
+    return nodes_.back().size;
+  }
+
+  /// @returns The number of distinct bitmaps the formula references.
+  size_t inputs() const {
+    return inputs_.size();
+  }
+
+  friend bitmap_formula operator~(bitmap_formula x) {
+    auto size = x.size();
+    auto root = x.nodes_.size() - 1;
+    x.nodes_.push_back({node::complement, {}, root, 0, false, size});
+    return x;
+  }
+
+  friend bitmap_formula operator&(bitmap_formula x, bitmap_formula const& y) {
+    return combine(std::move(x), y, detail::bitwise_operator::bitwise_and);
+  }
+
+  friend bitmap_formula operator|(bitmap_formula x, bitmap_formula const& y) {
+    return combine(std::move(x), y, detail::bitwise_operator::bitwise_or);
+  }
+
+  friend bitmap_formula operator^(bitmap_formula x, bitmap_formula const& y) {
+    return combine(std::move(x), y, detail::bitwise_operator::bitwise_xor);
+  }
+
+  friend bitmap_formula operator-(bitmap_formula x, bitmap_formula const& y) {
+    return combine(std::move(x), y, detail::bitwise_operator::bitwise_nand);
+  }
+
+  /// Evaluates the formula in a single pass over all input bitmaps.
+  /// @param f The formula to evaluate.
+  /// @returns The result of *f*.
+  friend Bitmap eval(bitmap_formula const& f) {
+    return f.evaluate();
+  }
+
+private:
+  struct node {
+    enum kind_type : uint8_t { input, constant, complement, binary };
+    kind_type kind;
+    detail::bitwise_operator op; // For binary nodes.
+    size_t lhs;                  // The operand or the input index.
+    size_t rhs;
+    bool bit;                    // For constant nodes.
+    size_type size;
+  };
+
+  static bitmap_formula combine(bitmap_formula x, bitmap_formula const& y,
+                                detail::bitwise_operator op) {
+    auto lhs = x.nodes_.size() - 1;
+    auto offset = x.nodes_.size();
+    // Share inputs that occur on both sides.
+    std::vector<size_t> input_map(y.inputs_.size());
+    for (auto i = 0u; i < y.inputs_.size(); ++i) {
+      auto j = std::find(x.inputs_.begin(), x.inputs_.end(), y.inputs_[i]);
+      input_map[i] = j - x.inputs_.begin();
+      if (j == x.inputs_.end())
+        x.inputs_.push_back(y.inputs_[i]);
+    }
+    for (auto n : y.nodes_) {
+      switch (n.kind) {
+        default:
+          break;
+        case node::input:
+          n.lhs = input_map[n.lhs];
+          break;
+        case node::complement:
+          n.lhs += offset;
+          break;
+        case node::binary:
+          n.lhs += offset;
+          n.rhs += offset;
+          break;
+      }
+      x.nodes_.push_back(n);
+    }
+    auto rhs = x.nodes_.size() - 1;
+    auto size = std::max(x.nodes_[lhs].size, x.nodes_[rhs].size);
+    if (op == detail::bitwise_operator::bitwise_nand
+        && x.nodes_[lhs].size < size) {
+      // The difference ends at the first block boundary past a shorter LHS.
+      auto blocks = (x.nodes_[lhs].size + word_type::width - 1)
+                    / word_type::width;
+      size = std::min(size, blocks * word_type::width);
+    }
+    x.nodes_.push_back({node::binary, op, lhs, rhs, false, size});
+    return x;
+  }
+
+  Bitmap evaluate() const {
+    using range_type = decltype(bit_range(std::declval<Bitmap const&>()));
+    // The read position of each input.
+    struct cursor {
+      range_type range;
+      size_type offset;
+    };
+    std::vector<cursor> cursors;
+    cursors.reserve(inputs_.size());
+    for (auto bm : inputs_)
+      cursors.push_back({bit_range(*bm), 0});
+    // A node changes its value at its end, so we never let a step cross the
+    // end of a node.
+    std::vector<size_type> ends;
+    for (auto& n : nodes_)
+      ends.push_back(n.size);
+    std::sort(ends.begin(), ends.end());
+    ends.erase(std::unique(ends.begin(), ends.end()), ends.end());
+    std::vector<block_type> values(nodes_.size());
+    Bitmap result;
+    auto end = ends.begin();
+    for (auto pos = size_type{0}; pos < size(); ) {
+      while (*end <= pos)
+        ++end;
+      // Determine the length of the next step. It ends at the end of the
+      // current sequence of the inputs and spans at most one block unless
+      // all inputs are in a fill.
+      auto n = *end - pos;
+      auto literal = false;
+      for (auto& c : cursors) {
+        if (c.range.done())
+          continue;
+        auto& bits = c.range.get();
+        n = std::min(n, bits.size() - c.offset);
+        if (bits.size() <= word_type::width)
+          literal = true;
+      }
+      if (literal)
+        n = std::min(n, word_type::width);
+      // Evaluate the nodes in topological order.
+      for (auto i = 0u; i < nodes_.size(); ++i) {
+        auto& x = nodes_[i];
+        if (pos >= x.size) {
+          values[i] = word_type::none;
+          continue;
+        }
+        switch (x.kind) {
+          case node::input: {
+            auto& c = cursors[x.lhs];
+            auto& bits = c.range.get();
+            if (bits.size() > word_type::width)
+              values[i] = bits.data();
+            else
+              values[i] = bits.data() >> c.offset;
+          } break;
+          case node::constant:
+            values[i] = x.bit ? word_type::all : word_type::none;
+            break;
+          case node::complement:
+            values[i] = ~values[x.lhs];
+            break;
+          case node::binary:
+            values[i] = detail::apply(x.op, values[x.lhs], values[x.rhs]);
+            break;
+        }
+      }
+      auto value = values.back();
+      if (literal)
+        result.append_block(n < word_type::width
+                              ? value & word_type::lsb_mask(n) : value,
+                            n);
+      else
+        result.append_bits(value != word_type::none, n);
+      // Advance the inputs.
+      for (auto& c : cursors) {
+        if (c.range.done())
+          continue;
+        c.offset += n;
+        if (c.offset == c.range.get().size()) {
+          c.range.next();
+          c.offset = 0;
+        }
+      }
+      pos += n;
+    }
+    return result;
+  }
+
+  std::vector<Bitmap const*> inputs_;
+  std::vector<node> nodes_; // In topological order, with the root last.
+};
+
+} // namespace vast
+
+#endif
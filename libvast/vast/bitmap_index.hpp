@@ -66,7 +66,21 @@ public:
     coder_.append(other.coder_);
   }
 
+  /// Merges another bitmap index whose entries follow the ones of this index.
+  /// @param other The other bitmap index.
+  /// @pre *other* has skipped the first `size()` entries.
+  void merge(bitmap_index const& other) {
+    coder_.merge(other.coder_);
+  }
+
+  /// Switches all bitmaps to the representation requiring the least space.
+  /// @see bitmap::optimize
+  void optimize() {
+    coder_.optimize();
+  }
+
   /// Retrieves a bitmap of a given value with respect to a given operator.
+  /// Concurrent lookups are safe as long as no thread modifies the index.
   /// @param op The relational operator to use for looking up *x*.
   /// @param x The value to find the bitmap for.
   /// @returns The bitmap for all values *v* where *op(v,x)* is `true`.
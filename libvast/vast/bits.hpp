@@ -61,6 +61,67 @@ private:
   size_type size_;
 };
 
+/// A sequence of whole blocks. Either a *fill*, i.e., a run of homogeneous
+/// blocks represented by a single value, or a *literal*, i.e., contiguous
+/// blocks in memory. Only the last block of a literal may be partial, in which
+/// case the bits beyond the size are unspecified.
+template <class T>
+class words {
+public:
+  using word_type = word<T>;
+  using value_type = typename word_type::value_type;
+  using size_type = typename word_type::size_type;
+
+  /// Constructs an empty fill.
+  words() = default;
+
+  /// Constructs a fill.
+  /// @param x The value of all blocks.
+  /// @param n The number of bits.
+  /// @pre `all_or_none(x) && n % w == 0` where *w* is the word width.
+  words(value_type x, size_type n) : fill_{x}, size_{n} {
+    VAST_ASSERT(word_type::all_or_none(x));
+    VAST_ASSERT(n % word_type::width == 0);
+  }
+
+  /// Constructs a literal.
+  /// @param xs The address of the first block.
+  /// @param n The number of bits.
+  words(value_type const* xs, size_type n) : data_{xs}, size_{n} {
+    VAST_ASSERT(xs != nullptr);
+  }
+
+  /// Checks whether this sequence is a fill.
+  bool fill() const {
+    return data_ == nullptr;
+  }
+
+  /// @returns The block value of a fill.
+  value_type value() const {
+    return fill_;
+  }
+
+  /// @returns The blocks of a literal.
+  value_type const* data() const {
+    return data_;
+  }
+
+  /// @returns The number of bits.
+  size_type size() const {
+    return size_;
+  }
+
+  /// @returns The number of (possibly partial) blocks.
+  size_type blocks() const {
+    return (size_ + word_type::width - 1) / word_type::width;
+  }
+
+private:
+  value_type const* data_ = nullptr;
+  value_type fill_ = 0;
+  size_type size_ = 0;
+};
+
 // -- searching --------------------------------------------------------------
 
 /// Finds the first bit of a particular value.
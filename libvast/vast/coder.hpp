@@ -11,6 +11,7 @@
 #include <caf/meta/save_callback.hpp>
 
 #include "vast/base.hpp"
+#include "vast/bitmap_formula.hpp"
 #include "vast/operator.hpp"
 #include "vast/detail/assert.hpp"
 #include "vast/detail/operators.hpp"
@@ -37,7 +38,9 @@ struct coder {
   /// @post Skipped entries show up as 0s during decoding.
   void encode(value_type x, size_type n = 1, size_type skip = 0);
 
-  /// Decodes a value under a relational operator.
+  /// Decodes a value under a relational operator. Decoding does not modify
+  /// the coder, so that multiple threads can decode from the same coder
+  /// concurrently as long as no thread modifies it.
   /// @param x The value to decode.
   /// @param op The relation operator under which to decode *x*.
   /// @returns The bitmap for lookup *? op x* where *?* represents the value in
@@ -49,6 +52,17 @@ struct coder {
   /// @pre `size() + other.size() < Bitmap::max_size`
   void append(coder const& other);
 
+  /// Merges another coder into this instance. In contrast to `append`, both
+  /// coders share the same positions: *other* has skipped all entries up to
+  /// `size()` and only contributes the entries thereafter.
+  /// @param other The coder to merge.
+  /// @pre *other* has skipped the first `size()` entries.
+  void merge(coder const& other);
+
+  /// Switches all bitmaps to the representation requiring the least space.
+  /// @see bitmap::optimize
+  void optimize();
+
   /// Retrieves the number entries in the coder, i.e., the number of rows.
   /// @returns The size of the coder measured in number of entries.
   size_type size() const;
@@ -83,6 +97,14 @@ public:
     bitmap_.append(other.bitmap_);
   }
 
+  void merge(singleton_coder const& other) {
+    bitmap_.append_from(other.bitmap_, size());
+  }
+
+  void optimize() {
+    bitmap_.optimize();
+  }
+
   size_type size() const {
     return bitmap_.size();
   }
@@ -121,6 +143,15 @@ public:
     append(other, false);
   }
 
+  void merge(vector_coder const& other) {
+    merge(other, false);
+  }
+
+  void optimize() {
+    for (auto& bm : bitmaps_)
+      bm.optimize();
+  }
+
   auto size() const {
     return size_;
   }
@@ -148,6 +179,21 @@ protected:
     size_ += other.size_;
   }
 
+  void merge(vector_coder const& other, bool bit) {
+    if (size_ == 0) {
+      *this = other;
+      return;
+    }
+    VAST_ASSERT(bitmaps_.size() == other.bitmaps_.size());
+    for (auto i = 0u; i < bitmaps_.size(); ++i) {
+      if (other.bitmaps_[i].size() <= size_)
+        continue;
+      bitmaps_[i].append_bits(bit, size_ - bitmaps_[i].size());
+      bitmaps_[i].append_from(other.bitmaps_[i], size_);
+    }
+    size_ = std::max(size_, other.size_);
+  }
+
   size_type size_;
   std::vector<Bitmap> bitmaps_;
 };
@@ -293,6 +339,10 @@ public:
   void append(range_coder const& other) {
     vector_coder<Bitmap>::append(other, true);
   }
+
+  void merge(range_coder const& other) {
+    vector_coder<Bitmap>::merge(other, true);
+  }
 };
 
 /// Maintains one bitmap per *bit* of the value to encode.
@@ -317,6 +367,7 @@ public:
 
   // RangeEval-Opt for the special case with uniform base 2.
   Bitmap decode(relational_operator op, value_type x) const {
+    using formula = bitmap_formula<Bitmap>;
     switch (op) {
       default:
         break;
@@ -332,39 +383,40 @@ public:
         } else if (op == less || op == greater_equal) {
           --x;
         }
-        auto result = x & 1 ? Bitmap{this->size_, true} : this->bitmaps_[0];
+        auto result = x & 1 ? formula{this->size_, true}
+                            : formula{this->bitmaps_[0]};
         for (auto i = 1u; i < this->bitmaps_.size(); ++i)
           if ((x >> i) & 1)
-            result |= this->bitmaps_[i];
+            result = result | this->bitmaps_[i];
           else
-            result &= this->bitmaps_[i];
+            result = result & this->bitmaps_[i];
         if (op == greater || op == greater_equal || op == not_equal)
-          result.flip();
-        return result;
+          result = ~result;
+        return eval(result);
       }
       case equal:
       case not_equal: {
-        auto result = Bitmap{this->size_, true};
+        auto result = formula{this->size_, true};
         for (auto i = 0u; i < this->bitmaps_.size(); ++i) {
-          auto& bm = this->bitmaps_[i];
-          result &= (((x >> i) & 1) ? ~bm : bm);
+          auto bm = formula{this->bitmaps_[i]};
+          result = result & (((x >> i) & 1) ? ~bm : bm);
         }
         if (op == not_equal)
-          result.flip();
-        return result;
+          result = ~result;
+        return eval(result);
       }
       case in:
       case not_in: {
         if (x == 0)
           break;
         x = ~x;
-        auto result = Bitmap{this->size_, false};
+        auto result = formula{this->size_, false};
         for (auto i = 0u; i < this->bitmaps_.size(); ++i)
           if (((x >> i) & 1) == 0)
-            result |= this->bitmaps_[i];
+            result = result | this->bitmaps_[i];
         if (op == in)
-          result.flip();
-        return result;
+          result = ~result;
+        return eval(result);
       }
     }
     return {this->size_, false};
@@ -416,11 +468,13 @@ public:
   }
 
   void encode(value_type x, size_type n = 1, size_type skip = 0) {
-    if (xs_.empty())
+    if (coders_.empty())
       init();
-    base_.decompose(x, xs_);
-    for (auto i = 0u; i < base_.size(); ++i)
-      coders_[i].encode(xs_[i], n, skip);
+    // Decompose the value on the fly, one component per coder.
+    for (auto i = 0u; i < base_.size(); ++i) {
+      coders_[i].encode(x % base_[i], n, skip);
+      x /= base_[i];
+    }
   }
 
   auto decode(relational_operator op, value_type x) const {
@@ -433,6 +487,23 @@ public:
       coders_[i].append(other.coders_[i]);
   }
 
+  void merge(multi_level_coder const& other) {
+    if (other.coders_.empty())
+      return;
+    if (coders_.empty()) {
+      *this = other;
+      return;
+    }
+    VAST_ASSERT(coders_.size() == other.coders_.size());
+    for (auto i = 0u; i < coders_.size(); ++i)
+      coders_[i].merge(other.coders_[i]);
+  }
+
+  void optimize() {
+    for (auto& c : coders_)
+      c.optimize();
+  }
+
   size_type size() const {
     return coders_.empty() ? 0 : coders_[0].size();
   }
@@ -448,18 +519,26 @@ public:
 
   template <class Inspector>
   friend auto inspect(Inspector& f, multi_level_coder& mlc) {
-    return f(mlc.base_, mlc.xs_, mlc.coders_);
+    return f(mlc.base_, mlc.coders_);
   }
 
 private:
   void init() {
     VAST_ASSERT(base_.well_defined());
-    xs_.resize(base_.size()),
     coders_.resize(base_.size());
     init_coders(coders_); // dispatch on coder_type
     VAST_ASSERT(coders_.size() == base_.size());
   }
 
+  // Decomposes a value into one component per coder. Decoding must not touch
+  // any state of the coder, so that multiple threads can decode concurrently
+  // from the same coder.
+  std::vector<value_type> decompose(value_type x) const {
+    std::vector<value_type> xs(base_.size());
+    base_.decompose(x, xs);
+    return xs;
+  }
+
   // TODO
   // We could further optimze the number of bitmaps per coder: any base b
   // requires only b-1 bitmaps because one can obtain any bitmap through
@@ -477,6 +556,17 @@ private:
       coders[i] = range_coder<bitmap_type>{base_[i] - 1};
   }
 
+  void init_coders(std::vector<bitslice_coder<bitmap_type>>& coders) {
+    // Bit-sliced coders require one bitmap per bit of the largest component
+    // value.
+    for (auto i = 0u; i < base_.size(); ++i) {
+      auto bits = size_t{1};
+      while ((base_[i] - 1) >> bits)
+        ++bits;
+      coders[i] = bitslice_coder<bitmap_type>{bits};
+    }
+  }
+
   template <class C>
   void init_coders(std::vector<C>& coders) {
     // All other multi-bitmap coders use one bitmap per unique value.
@@ -489,7 +579,7 @@ private:
               relational_operator op, value_type x) const {
     VAST_ASSERT(!(op == in || op == not_in));
     // All coders must have the same number of elements.
-    auto pred = [n=size()](auto c) { return c.size() == n; };
+    auto pred = [n=size()](auto& c) { return c.size() == n; };
     VAST_ASSERT(std::all_of(coders.begin(), coders.end(), pred));
     // Check boundaries first.
     if (x == 0) {
@@ -500,8 +590,12 @@ private:
     } else if (op == less || op == greater_equal) {
       --x;
     }
-    base_.decompose(x, xs_);
-    bitmap_type result{size(), true};
+    auto xs = decompose(x);
+    // We assemble the result as a formula over the component bitmaps and
+    // evaluate it in a single pass, rather than materializing a bitmap for
+    // each step.
+    using formula = bitmap_formula<bitmap_type>;
+    auto result = formula{size(), true};
     auto bitmaps = [&](auto i) -> auto& { return coders[i].storage(); };
     switch (op) {
       default:
@@ -510,53 +604,121 @@ private:
       case less_equal:
       case greater:
       case greater_equal: {
-        if (xs_[0] < base_[0] - 1) // && bitmap != all_ones
-          result = bitmaps(0)[xs_[0]];
+        if (xs[0] < base_[0] - 1) // && bitmap != all_ones
+          result = bitmaps(0)[xs[0]];
         for (auto i = 1u; i < base_.size(); ++i) {
-          if (xs_[i] != base_[i] - 1) // && bitmap != all_ones
-            result &= bitmaps(i)[xs_[i]];
-          if (xs_[i] != 0) // && bitmap != all_ones
-            result |= bitmaps(i)[xs_[i] - 1];
+          if (xs[i] != base_[i] - 1) // && bitmap != all_ones
+            result = result & bitmaps(i)[xs[i]];
+          if (xs[i] != 0) // && bitmap != all_ones
+            result = result | bitmaps(i)[xs[i] - 1];
         }
       } break;
       case equal:
       case not_equal: {
         for (auto i = 0u; i < base_.size(); ++i) {
-          if (xs_[i] == 0) // && bitmap != all_ones
-            result &= bitmaps(i)[0];
-          else if (xs_[i] == base_[i] - 1)
-            result &= ~bitmaps(i)[base_[i] - 2];
+          if (xs[i] == 0) // && bitmap != all_ones
+            result = result & bitmaps(i)[0];
+          else if (xs[i] == base_[i] - 1)
+            result = result & ~formula{bitmaps(i)[base_[i] - 2]};
           else
-            result &= bitmaps(i)[xs_[i]] ^ bitmaps(i)[xs_[i] - 1];
+            result = result & (formula{bitmaps(i)[xs[i]]}
+                               ^ bitmaps(i)[xs[i] - 1]);
         }
       } break;
     }
     if (op == greater || op == greater_equal || op == not_equal)
-      result.flip();
-    return result;
+      result = ~result;
+    return eval(result);
   }
 
-  // If we don't have a range_coder, we only support simple equality queries at
-  // this point.
+  // RangeEval-Opt of O'Neil and Quass over bit-sliced components. A component
+  // compares less than or equal to its counterpart of the value if the
+  // component is less, or if it is equal and all lower components compare
+  // less than or equal. With a uniform base of 2, this reduces to the
+  // algorithm for a single bit-sliced index.
+  auto decode(std::vector<bitslice_coder<bitmap_type>> const& coders,
+              relational_operator op, value_type x) const {
+    VAST_ASSERT(!(op == in || op == not_in));
+    auto pred = [n=size()](auto& c) { return c.size() == n; };
+    VAST_ASSERT(std::all_of(coders.begin(), coders.end(), pred));
+    if (x == 0) {
+      if (op == less)
+        return bitmap_type{size(), false};
+      else if (op == greater_equal)
+        return bitmap_type{size(), true};
+    } else if (op == less || op == greater_equal) {
+      --x;
+    }
+    auto xs = decompose(x);
+    using formula = bitmap_formula<bitmap_type>;
+    // Selects the rows whose i-th component is at most y. The slices of a
+    // component hold a 1 where the bit of the value is 0.
+    auto at_most = [&](auto i, value_type y) {
+      auto& slices = coders[i].storage();
+      auto result = y & 1 ? formula{size(), true} : formula{slices[0]};
+      for (auto j = 1u; j < slices.size(); ++j)
+        if ((y >> j) & 1)
+          result = result | slices[j];
+        else
+          result = result & slices[j];
+      return result;
+    };
+    auto result = formula{size(), true};
+    switch (op) {
+      default:
+        return bitmap_type{size(), false};
+      case less:
+      case less_equal:
+      case greater:
+      case greater_equal: {
+        result = at_most(0, xs[0]);
+        for (auto i = 1u; i < base_.size(); ++i) {
+          if (xs[i] == 0)
+            result = at_most(i, 0) & result;
+          else if (xs[i] == base_[i] - 1)
+            result = at_most(i, xs[i] - 1) | result;
+          else
+            result = at_most(i, xs[i] - 1) | (at_most(i, xs[i]) & result);
+        }
+      } break;
+      case equal:
+      case not_equal: {
+        for (auto i = 0u; i < base_.size(); ++i) {
+          auto& slices = coders[i].storage();
+          for (auto j = 0u; j < slices.size(); ++j) {
+            auto slice = formula{slices[j]};
+            result = result & (((xs[i] >> j) & 1) ? ~slice : slice);
+          }
+        }
+      } break;
+    }
+    if (op == greater || op == greater_equal || op == not_equal)
+      result = ~result;
+    return eval(result);
+  }
+
+  // For equality coders, we only support simple equality queries at this
+  // point.
   template <class C>
   auto decode(std::vector<C> const& coders, relational_operator op,
               value_type x) const
-  -> std::enable_if_t<
-    is_equality_coder<C>{} || is_bitslice_coder<C>{},
-    bitmap_type
-  > {
+  -> std::enable_if_t<is_equality_coder<C>{}, bitmap_type> {
     VAST_ASSERT(op == equal || op == not_equal);
-    base_.decompose(x, xs_);
-    auto result = coders[0].decode(equal, xs_[0]);
-    for (auto i = 1u; i < base_.size(); ++i)
-      result &= coders[i].decode(equal, xs_[i]);
+    auto xs = decompose(x);
+    // Conjoin the components in a single pass.
+    std::vector<bitmap_type> components;
+    components.reserve(base_.size());
+    for (auto i = 0u; i < base_.size(); ++i)
+      components.push_back(coders[i].decode(equal, xs[i]));
+    auto result = bitmap_formula<bitmap_type>{components[0]};
+    for (auto i = 1u; i < components.size(); ++i)
+      result = result & components[i];
     if (op == not_equal || op == not_in)
-      result.flip();
-    return result;
+      result = ~result;
+    return eval(result);
   }
 
   base base_;
-  mutable std::vector<value_type> xs_;
   std::vector<coder_type> coders_;
 };
 
@@ -0,0 +1,67 @@
+#ifndef VAST_DETAIL_BITWISE_HPP
+#define VAST_DETAIL_BITWISE_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace vast {
+namespace detail {
+
+/// The bitwise operations on blocks for which vectorized kernels exist.
+enum class bitwise_operator : uint8_t {
+  bitwise_and,  ///< `x & y`
+  bitwise_or,   ///< `x | y`
+  bitwise_xor,  ///< `x ^ y`
+  bitwise_nand, ///< `x & ~y`
+  bitwise_nor   ///< `x | ~y`
+};
+
+/// Applies a bitwise operation to two blocks.
+/// @param op The operation to apply.
+/// @param x The LHS block.
+/// @param y The RHS block.
+/// @returns *op(x, y)*.
+constexpr uint64_t apply(bitwise_operator op, uint64_t x, uint64_t y) {
+  switch (op) {
+    case bitwise_operator::bitwise_and:
+      return x & y;
+    case bitwise_operator::bitwise_or:
+      return x | y;
+    case bitwise_operator::bitwise_xor:
+      return x ^ y;
+    case bitwise_operator::bitwise_nand:
+      return x & ~y;
+    case bitwise_operator::bitwise_nor:
+      return x | ~y;
+  }
+  return 0;
+}
+
+/// Applies a bitwise operation block-wise to two arrays of blocks, using the
+/// widest vector instructions the CPU supports.
+/// @param op The operation to apply.
+/// @param x The LHS blocks.
+/// @param y The RHS blocks.
+/// @param out The result with `out[i] = apply(op, x[i], y[i])`.
+/// @param n The number of blocks in *x*, *y*, and *out*.
+/// @pre *out* either equals or does not overlap with *x* and *y*.
+void bitwise_blocks(bitwise_operator op, uint64_t const* x, uint64_t const* y,
+                    uint64_t* out, size_t n);
+
+/// Complements an array of blocks, using the widest vector instructions the
+/// CPU supports.
+/// @param x The blocks to complement.
+/// @param out The result with `out[i] = ~x[i]`.
+/// @param n The number of blocks in *x* and *out*.
+/// @pre *out* either equals or does not overlap with *x*.
+void complement_blocks(uint64_t const* x, uint64_t* out, size_t n);
+
+/// Retrieves the name of the kernel selected at runtime for ::bitwise_blocks
+/// and ::complement_blocks.
+/// @returns One of `"avx2"`, `"sse2"`, or `"scalar"`.
+const char* bitwise_kernel();
+
+} // namespace detail
+} // namespace vast
+
+#endif
@@ -28,6 +28,10 @@ public:
   /// Returns the size of the mapped memory region.
   size_t size() const;
 
+  /// Returns a pointer to the beginning of the mapped memory region.
+  /// @returns A pointer to the mapped memory or `nullptr` if mapping failed.
+  const char_type* data() const;
+
 protected:
   std::streamsize showmanyc() override;
 
@@ -1,8 +1,15 @@
 #ifndef VAST_EWAH_BITMAP_HPP
 #define VAST_EWAH_BITMAP_HPP
 
+#include <memory>
+#include <vector>
+
+#include <caf/meta/load_callback.hpp>
+
 #include "vast/bitmap_base.hpp"
 #include "vast/bitvector.hpp"
+#include "vast/error.hpp"
+#include "vast/expected.hpp"
 #include "vast/word.hpp"
 
 #include "vast/detail/operators.hpp"
@@ -60,6 +67,81 @@ struct ewah_word : word<Block> {
   }
 };
 
+class ewah_bitmap;
+class ewah_bitmap_view;
+class ewah_bitmap_range;
+
+/// A sampled index over the blocks of an ::ewah_bitmap. Every *interval*
+/// blocks, the index records the state of an ::ewah_bitmap_range together
+/// with the number of 1-bits preceding it. This makes it possible to resume a
+/// scan in the middle of the bitmap, which turns rank, select, and seeking
+/// into a binary search followed by a scan over at most *interval* blocks.
+class ewah_skip_index {
+public:
+  using size_type = uint64_t;
+
+  /// The default number of blocks between two samples.
+  static constexpr size_t default_interval = 64;
+
+  /// A resumable state of an ::ewah_bitmap_range.
+  struct entry {
+    size_t block;       ///< The index of the next block to scan.
+    size_t num_dirty;   ///< The number of dirty blocks left at *block*.
+    size_type position; ///< The position of the first bit at *block*.
+    size_type rank;     ///< The number of 1-bits before *position*.
+  };
+
+  ewah_skip_index() = default;
+
+  /// Samples a bitmap.
+  /// @param bm The bitmap to index.
+  /// @param interval The number of blocks between two samples.
+  /// @pre `interval > 0`
+  explicit ewah_skip_index(ewah_bitmap_view bm,
+                           size_t interval = default_interval);
+
+  /// @returns The total number of 1-bits in the indexed bitmap.
+  size_type count() const;
+
+  /// Locates the last sample at or before a position.
+  /// @param i The position to look for.
+  /// @returns The last entry with a position not greater than *i* or `nullptr`
+  ///          if no such entry exists.
+  entry const* find_position(size_type i) const;
+
+  /// Locates the last sample preceding the *i*-th bit of a given value.
+  /// @param i The rank of the bit to look for.
+  /// @param bit The bit value to count.
+  /// @returns The last entry with fewer than *i* bits of value *bit* before
+  ///          it or `nullptr` if no such entry exists.
+  /// @pre `i > 0`
+  entry const* find_rank(size_type i, bool bit) const;
+
+  /// Counts the 1-bits of a bitmap up to a position. The scan starts at the
+  /// last sample before the position if the bitmap has a skip index and at
+  /// the beginning otherwise.
+  /// @param bm The bitmap to count in.
+  /// @param i The position up to which to count.
+  /// @returns The number of 1-bits in *[0, i]*.
+  /// @pre `i < bm.size()`
+  static size_type rank(ewah_bitmap_view bm, size_type i);
+
+  /// Locates the *i*-th bit of a given value in a bitmap. The scan starts at
+  /// the last sample before the bit if the bitmap has a skip index and at the
+  /// beginning otherwise.
+  /// @param bm The bitmap to search in.
+  /// @param i The rank of the bit to look for.
+  /// @param bit The bit value to look for.
+  /// @returns The position of the *i*-th bit of value *bit* or `npos` if no
+  ///          such bit exists.
+  /// @pre `i > 0`
+  static size_type select(ewah_bitmap_view bm, size_type i, bool bit);
+
+private:
+  std::vector<entry> entries_;
+  size_type count_ = 0;
+};
+
 /// A bitmap encoded with the *Enhanced World-Aligned Hybrid (EWAH)* algorithm.
 /// EWAH has two types of blocks: *marker* and *dirty*. The bits in a dirty
 /// block are literally interpreted whereas the bits of a marker block have
@@ -100,15 +182,35 @@ public:
 
   void append_block(block_type bits, size_type n = word_type::width);
 
+  void append_blocks(block_type const* xs, size_type n);
+
   void flip();
 
+  // -- skip index -----------------------------------------------------------
+
+  /// Attaches a ::ewah_skip_index to the bitmap. Thereafter, ::rank,
+  /// ::select, and seeking in bit ranges run in logarithmic time. Since the
+  /// index must be rebuilt after every change, it makes most sense for
+  /// bitmaps that no longer change. Modifying the bitmap discards the index.
+  /// @param interval The number of blocks between two samples.
+  void build_skip_index(
+    size_t interval = ewah_skip_index::default_interval);
+
+  /// @returns The attached skip index or `nullptr` if none exists.
+  ewah_skip_index const* skip_index() const;
+
   // -- concepts -------------------------------------------------------------
 
   friend bool operator==(ewah_bitmap const& x, ewah_bitmap const& y);
 
   template <class Inspector>
   friend auto inspect(Inspector&f, ewah_bitmap& bm) {
-    return f(bm.blocks_, bm.last_marker_, bm.num_bits_);
+    auto load = [&]() -> error {
+      bm.skip_index_.reset();
+      return {};
+    };
+    return f(bm.blocks_, bm.last_marker_, bm.num_bits_,
+             caf::meta::load_callback(load));
   }
 
 private:
@@ -124,16 +226,94 @@ private:
   block_vector blocks_;
   block_type last_marker_ = 0;
   size_type num_bits_ = 0;
+  std::shared_ptr<ewah_skip_index const> skip_index_;
 };
 
+/// A read-only view of an EWAH-encoded bitmap whose blocks live in memory
+/// owned by someone else, e.g., an ::ewah_bitmap, a memory-mapped file, or a
+/// message buffer. Bit ranges, word ranges, ::binary_eval, ::rank, and
+/// ::select operate directly on the viewed blocks, without copying them.
+/// Bitwise operations on views produce an ::ewah_bitmap. The viewed memory
+/// must outlive the view.
+class ewah_bitmap_view {
+public:
+  using bitmap_type = ewah_bitmap;
+  using block_type = ewah_bitmap::block_type;
+  using size_type = ewah_bitmap::size_type;
+  using word_type = ewah_bitmap::word_type;
+
+  ewah_bitmap_view() = default;
+
+  /// Constructs a view of a bitmap, including its skip index.
+  /// @param bm The bitmap to view.
+  ewah_bitmap_view(ewah_bitmap const& bm);
+
+  /// Constructs a view of a sequence of EWAH-encoded blocks.
+  /// @param blocks The blocks of the bitmap.
+  /// @param num_blocks The number of blocks at *blocks*.
+  /// @param num_bits The number of bits of the bitmap.
+  /// @pre The blocks satisfy the invariants of ::ewah_bitmap.
+  /// @see make_ewah_bitmap_view
+  ewah_bitmap_view(block_type const* blocks, size_t num_blocks,
+                   size_type num_bits);
+
+  // -- inspectors -----------------------------------------------------------
+
+  bool empty() const;
+
+  size_type size() const;
+
+  /// @returns A pointer to the first block.
+  block_type const* data() const;
+
+  size_t num_blocks() const;
+
+  /// @returns The skip index of the viewed bitmap or `nullptr` if it has
+  ///          none.
+  ewah_skip_index const* skip_index() const;
+
+private:
+  block_type const* blocks_ = nullptr;
+  size_t num_blocks_ = 0;
+  size_type num_bits_ = 0;
+  ewah_skip_index const* skip_index_ = nullptr;
+};
+
+/// Writes a bitmap in a flat layout that ::make_ewah_bitmap_view can access
+/// in place: the number of bits and the number of blocks, followed by the
+/// blocks, each as a 64-bit integer in host byte order. Value indexes don't
+/// use this layout yet, so loading them from a packfile still deserializes
+/// owning bitmaps.
+/// @param buf The buffer to append to.
+/// @param bm The bitmap to write.
+/// @relates ewah_bitmap_view
+void save_flat(std::vector<char>& buf, ewah_bitmap_view bm);
+
+/// Creates a view of a bitmap in the layout of ::save_flat after checking
+/// that the blocks form a valid EWAH encoding.
+/// @param data The beginning of the bitmap, aligned to 8 bytes.
+/// @param size The number of bytes available at *data*, which may exceed
+///             the size of the bitmap.
+/// @returns A view of the bitmap at *data* or an error if *data* does not
+///          contain a valid bitmap.
+/// @relates ewah_bitmap_view
+expected<ewah_bitmap_view> make_ewah_bitmap_view(char const* data,
+                                                 size_t size);
+
 class ewah_bitmap_range
   : public bit_range_base<ewah_bitmap_range, ewah_bitmap::block_type> {
+  friend ewah_skip_index;
+
+  friend ewah_bitmap::size_type seek(ewah_bitmap_range& rng,
+                                     ewah_bitmap::size_type n,
+                                     ewah_bitmap::size_type i);
+
 public:
   using word_type = ewah_bitmap::word_type;
 
   ewah_bitmap_range() = default;
 
-  explicit ewah_bitmap_range(ewah_bitmap const& bm);
+  explicit ewah_bitmap_range(ewah_bitmap_view bm);
 
   void next();
   bool done() const;
@@ -141,7 +321,10 @@ public:
 private:
   void scan();
 
-  ewah_bitmap const* bm_;
+  /// Resumes the range at a sampled state of the skip index.
+  void resume(ewah_skip_index::entry const& e);
+
+  ewah_bitmap_view bm_;
   size_t next_ = 0;
   size_t num_dirty_ = 0;
   size_t num_bits_ = 0;
@@ -149,6 +332,85 @@ private:
 
 ewah_bitmap_range bit_range(ewah_bitmap const& bm);
 
+ewah_bitmap_range bit_range(ewah_bitmap_view const& bm);
+
+/// Advances an EWAH bit range to the sequence containing a given position.
+/// If the underlying bitmap has a skip index, the range jumps directly to the
+/// last sample before the position.
+/// @relates seek
+ewah_bitmap::size_type seek(ewah_bitmap_range& rng, ewah_bitmap::size_type n,
+                            ewah_bitmap::size_type i);
+
+/// Computes the rank of an EWAH bitmap view, using its skip index if
+/// available.
+/// @relates rank
+template <bool Bit = true>
+ewah_bitmap::size_type rank(ewah_bitmap_view const& bm,
+                            ewah_bitmap::size_type i) {
+  auto ones = ewah_skip_index::rank(bm, i);
+  return Bit ? ones : i + 1 - ones;
+}
+
+/// Computes the rank of an EWAH bitmap, using its skip index if available.
+/// @relates rank
+template <bool Bit = true>
+ewah_bitmap::size_type rank(ewah_bitmap const& bm, ewah_bitmap::size_type i) {
+  return rank<Bit>(ewah_bitmap_view{bm}, i);
+}
+
+/// Selects a bit of an EWAH bitmap view, using its skip index if available.
+/// @relates select
+template <bool Bit = true>
+ewah_bitmap::size_type select(ewah_bitmap_view const& bm,
+                              ewah_bitmap::size_type i) {
+  if (i == ewah_bitmap::word_type::npos) {
+    // The last occurrence is the one with the highest rank.
+    if (bm.empty())
+      return ewah_bitmap::word_type::npos;
+    auto idx = bm.skip_index();
+    auto ones = idx ? idx->count() : ewah_skip_index::rank(bm, bm.size() - 1);
+    i = Bit ? ones : bm.size() - ones;
+    if (i == 0)
+      return ewah_bitmap::word_type::npos;
+  }
+  return ewah_skip_index::select(bm, i, Bit);
+}
+
+/// Selects a bit of an EWAH bitmap, using its skip index if available.
+/// @relates select
+template <bool Bit = true>
+ewah_bitmap::size_type select(ewah_bitmap const& bm,
+                              ewah_bitmap::size_type i) {
+  return select<Bit>(ewah_bitmap_view{bm}, i);
+}
+
+/// Iterates over an EWAH bitmap in terms of the clean words of each marker
+/// (as fill) and the dirty words following it (as literal).
+class ewah_bitmap_word_range
+  : public word_range_base<ewah_bitmap_word_range, ewah_bitmap::block_type> {
+public:
+  using word_type = ewah_bitmap::word_type;
+
+  ewah_bitmap_word_range() = default;
+
+  explicit ewah_bitmap_word_range(ewah_bitmap_view bm);
+
+  void next();
+  bool done() const;
+
+private:
+  void scan();
+
+  ewah_bitmap_view bm_;
+  size_t next_ = 0;
+  size_t num_dirty_ = 0;
+  bool done_ = true;
+};
+
+ewah_bitmap_word_range word_range(ewah_bitmap const& bm);
+
+ewah_bitmap_word_range word_range(ewah_bitmap_view const& bm);
+
 } // namespace vast
 
 #endif
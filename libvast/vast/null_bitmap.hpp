@@ -8,6 +8,7 @@
 namespace vast {
 
 class null_bitmap_range;
+class null_bitmap_word_range;
 
 /// An uncompressed bitmap. Essentially, a null_bitmap lifts an append-only
 /// ::bitvector into a bitmap type, enabling efficient block-level operations
@@ -15,6 +16,7 @@ class null_bitmap_range;
 class null_bitmap : public bitmap_base<null_bitmap>,
                     detail::equality_comparable<null_bitmap> {
   friend null_bitmap_range;
+  friend null_bitmap_word_range;
 
 public:
   using bitvector_type = bitvector<block_type>;
@@ -37,6 +39,8 @@ public:
 
   void append_block(block_type bits, size_type n = word_type::width);
 
+  void append_blocks(block_type const* xs, size_type n);
+
   void flip();
 
   // -- concepts -------------------------------------------------------------
@@ -50,6 +54,8 @@ public:
 
   friend null_bitmap_range bit_range(null_bitmap const& bm);
 
+  friend null_bitmap_word_range word_range(null_bitmap const& bm);
+
 private:
   bitvector_type bitvector_;
 };
@@ -72,6 +78,19 @@ private:
   typename null_bitmap::bitvector_type::block_vector::const_iterator end_;
 };
 
+/// Iterates over a null bitmap as a single literal.
+class null_bitmap_word_range
+  : public word_range_base<null_bitmap_word_range, null_bitmap::block_type> {
+public:
+  explicit null_bitmap_word_range(null_bitmap const& bm);
+
+  void next();
+  bool done() const;
+
+private:
+  bool done_;
+};
+
 
 } // namespace vast
 
@@ -0,0 +1,127 @@
+#ifndef VAST_PACKFILE_HPP
+#define VAST_PACKFILE_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <caf/streambuf.hpp>
+
+#include "vast/error.hpp"
+#include "vast/expected.hpp"
+#include "vast/filesystem.hpp"
+#include "vast/load.hpp"
+
+namespace vast {
+namespace detail {
+
+class mmapbuf;
+
+} // namespace detail
+
+/// A single file that bundles a set of named blobs. A packfile begins with a
+/// fixed-size header, followed by a table of contents (TOC) and the blobs,
+/// each of which starts at an 8-byte aligned offset:
+///
+///     +-------+---------+-------------+-----+--------+-----+--------+
+///     | magic | version | data offset | TOC | blob 0 | ... | blob N |
+///     +-------+---------+-------------+-----+--------+-----+--------+
+///
+/// The header integers use host byte order. Readers open a packfile with a
+/// single `open`/`mmap` and access blobs in place.
+class packfile {
+public:
+  /// The magic constant at the beginning of every packfile.
+  static constexpr uint32_t magic = 0x4b434150; // "PACK"
+
+  /// The version of the on-disk format.
+  static constexpr uint32_t version = 1;
+
+  /// The alignment of each blob in the file.
+  static constexpr size_t alignment = 8;
+
+  /// Describes the location of a blob.
+  struct entry {
+    uint64_t offset; ///< The offset relative to the data section.
+    uint64_t size;   ///< The size of the blob in bytes.
+
+    template <class Inspector>
+    friend auto inspect(Inspector& f, entry& x) {
+      return f(x.offset, x.size);
+    }
+  };
+
+  /// The table of contents, sorted by blob name.
+  using toc_type = std::vector<std::pair<std::string, entry>>;
+
+  /// Bundles a set of files into a packfile.
+  class writer {
+  public:
+    /// Adds a file to the packfile.
+    /// @param name The name of the blob.
+    /// @param filename The file whose contents become the blob.
+    void add(path name, path filename);
+
+    /// Writes the packfile. The packfile first goes to a temporary file
+    /// next to *filename*, which replaces *filename* only once complete.
+    /// @param filename The path of the packfile to create.
+    expected<void> write(path const& filename);
+
+  private:
+    std::vector<std::pair<path, path>> files_;
+  };
+
+  /// Opens and memory-maps an existing packfile.
+  /// @param filename The path to the packfile.
+  /// @returns The opened packfile or an error.
+  static expected<std::shared_ptr<packfile>> open(path const& filename);
+
+  ~packfile();
+
+  /// Retrieves the directory relative to which this packfile resolves paths.
+  path const& root() const;
+
+  /// Retrieves the table of contents.
+  toc_type const& toc() const;
+
+  /// Looks up a blob.
+  /// @param p The path of the blob, either relative to the packfile's
+  ///          directory or a path under it.
+  /// @returns A pointer to the blob entry or `nullptr` if *p* doesn't exist.
+  entry const* find(path const& p) const;
+
+  /// Checks whether a blob exists.
+  /// @param p The path of the blob.
+  bool contains(path const& p) const;
+
+  /// Retrieves a pointer to the first byte of a blob.
+  /// @param x The entry of the blob.
+  char const* data(entry const& x) const;
+
+  /// Deserializes a sequence of objects from a blob.
+  /// @param p The path of the blob.
+  /// @param xs The objects to deserialize.
+  /// @see load
+  template <class... Ts>
+  expected<void> load(path const& p, Ts&&... xs) const {
+    auto x = find(p);
+    if (!x)
+      return make_error(ec::filesystem_error, "no such blob in packfile", p);
+    caf::charbuf buf{const_cast<char*>(data(*x)), x->size};
+    return vast::load(buf, std::forward<Ts>(xs)...);
+  }
+
+private:
+  packfile() = default;
+
+  path root_;
+  toc_type toc_;
+  char const* data_ = nullptr;
+  std::unique_ptr<detail::mmapbuf> map_;
+};
+
+} // namespace vast
+
+#endif
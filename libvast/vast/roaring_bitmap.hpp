@@ -0,0 +1,276 @@
+#ifndef VAST_ROARING_BITMAP_HPP
+#define VAST_ROARING_BITMAP_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "vast/bitmap_base.hpp"
+#include "vast/word.hpp"
+
+#include "vast/detail/bitwise.hpp"
+#include "vast/detail/operators.hpp"
+
+namespace vast {
+namespace detail {
+
+/// A chunk of 2^16 bits of a ::roaring_bitmap. Depending on its density, a
+/// container represents its 1-bits either as a sorted array of positions, as
+/// an uncompressed bitset, or as a sorted sequence of runs.
+class roaring_container : equality_comparable<roaring_container> {
+public:
+  using block_type = uint64_t;
+  using word_type = word<block_type>;
+
+  /// The representation of a container.
+  enum class kind : uint8_t {
+    array,  ///< Sorted positions of the 1-bits.
+    bitset, ///< An uncompressed sequence of blocks.
+    runs    ///< Sorted pairs of first and last position of runs of 1-bits.
+  };
+
+  /// The number of bits in a container.
+  static constexpr uint32_t capacity = 1u << 16;
+
+  /// The number of blocks of a container in bitset representation.
+  static constexpr uint32_t num_blocks = capacity / word_type::width;
+
+  /// The maximum number of positions in the array representation. Beyond
+  /// this size, a bitset requires less space.
+  static constexpr uint32_t max_array_size = 4096;
+
+  /// Constructs an empty container.
+  /// @param key The position of the container in units of ::capacity.
+  explicit roaring_container(uint64_t key = 0);
+
+  // -- inspectors -----------------------------------------------------------
+
+  uint64_t key() const;
+
+  kind representation() const;
+
+  bool empty() const;
+
+  /// @returns The number of 1-bits.
+  uint32_t cardinality() const;
+
+  /// Tests a single bit.
+  /// @param i The position within the container.
+  /// @returns `true` iff bit *i* is 1.
+  /// @pre `i < capacity`
+  bool test(uint32_t i) const;
+
+  /// Retrieves a block of the container.
+  /// @param i The block index.
+  /// @returns The bits at positions *[64i, 64i + 64)*.
+  /// @pre `i < num_blocks`
+  block_type block(uint32_t i) const;
+
+  /// Counts the homogeneous blocks of a given value.
+  /// @param i The index of the first block to consider.
+  /// @param bit The bit value of the blocks.
+  /// @returns The number of consecutive blocks starting at *i* that consist
+  ///          of *bit* only.
+  /// @pre `i < num_blocks`
+  uint32_t uniform_blocks(uint32_t i, bool bit) const;
+
+  /// Writes all blocks of the container.
+  /// @param out The destination of ::num_blocks blocks.
+  void blocks(block_type* out) const;
+
+  // -- modifiers ------------------------------------------------------------
+
+  /// Sets a range of bits to 1.
+  /// @param first The position of the first bit.
+  /// @param last The position one past the last bit.
+  /// @pre `first < last && last <= capacity` and *first* lies past the last
+  ///      1-bit of the container.
+  void append(uint32_t first, uint32_t last);
+
+  /// Replaces the contents of the container.
+  /// @param xs The ::num_blocks new blocks.
+  void assign(block_type const* xs);
+
+  /// Flips the bits in the first *n* positions.
+  /// @param n The number of bits to flip.
+  /// @pre `n <= capacity`
+  void complement(uint32_t n);
+
+  /// Clears all bits at positions greater than or equal to *n*.
+  /// @param n The number of bits to keep.
+  /// @pre `n <= capacity`
+  void truncate(uint32_t n);
+
+  /// Switches to the representation requiring the least space.
+  void optimize();
+
+  // -- concepts -------------------------------------------------------------
+
+  friend bool operator==(roaring_container const& x,
+                         roaring_container const& y);
+
+  template <class Inspector>
+  friend auto inspect(Inspector& f, roaring_container& c) {
+    return f(c.key_, c.kind_, c.values_, c.blocks_);
+  }
+
+  /// Applies a bitwise operation on two containers with the same key.
+  friend roaring_container eval(roaring_container const& x,
+                                roaring_container const& y,
+                                bitwise_operator op);
+
+private:
+  /// Invokes a function for each maximal run of 1-bits with the position of
+  /// the first bit and one past the last bit.
+  template <class F>
+  void each_run(F f) const;
+
+  /// @returns The index of the first run ending at or after *i*.
+  /// @pre `representation() == kind::runs`
+  size_t find_run(uint32_t i) const;
+
+  uint32_t num_runs() const;
+
+  void convert(kind k);
+
+  uint64_t key_;
+  kind kind_ = kind::array;
+  std::vector<uint16_t> values_; // The array or runs representation.
+  std::vector<block_type> blocks_; // The bitset representation.
+};
+
+} // namespace detail
+
+class roaring_bitmap_range;
+
+/// A bitmap in the style of *Roaring* bitmaps. It partitions the ID space
+/// into chunks of 2^16 bits and stores only the chunks containing 1-bits,
+/// each in a ::roaring_container whose representation depends on the density
+/// of the chunk. Unlike the run-length codecs, this allows for random access
+/// in logarithmic time and performs well on sparse and scattered IDs.
+class roaring_bitmap : public bitmap_base<roaring_bitmap>,
+                       detail::equality_comparable<roaring_bitmap> {
+  friend roaring_bitmap_range;
+
+public:
+  using container_type = detail::roaring_container;
+  using container_vector = std::vector<container_type>;
+
+  roaring_bitmap() = default;
+
+  roaring_bitmap(size_type n, bool bit = false);
+
+  // -- inspectors -----------------------------------------------------------
+
+  bool empty() const;
+
+  size_type size() const;
+
+  container_vector const& containers() const;
+
+  // -- element access -------------------------------------------------------
+
+  /// Accesses the *i*-th bit in logarithmic time.
+  /// @param i The index into the bitmap.
+  /// @returns `true` iff bit *i* is 1.
+  /// @pre `i < size()`
+  bool operator[](size_type i) const;
+
+  // -- modifiers ------------------------------------------------------------
+
+  void append_bit(bool bit);
+
+  void append_bits(bool bit, size_type n);
+
+  void append_block(block_type bits, size_type n = word_type::width);
+
+  void flip();
+
+  // -- concepts -------------------------------------------------------------
+
+  friend bool operator==(roaring_bitmap const& x, roaring_bitmap const& y);
+
+  template <class Inspector>
+  friend auto inspect(Inspector& f, roaring_bitmap& bm) {
+    return f(bm.containers_, bm.num_bits_);
+  }
+
+  friend roaring_bitmap container_eval(roaring_bitmap const& lhs,
+                                       roaring_bitmap const& rhs,
+                                       detail::bitwise_operator op,
+                                       size_type n);
+
+private:
+  /// Sets the bits in *[first, last)* to 1.
+  /// @pre *first* lies past the last 1-bit of the bitmap.
+  void append_ones(size_type first, size_type last);
+
+  container_vector containers_;
+  size_type num_bits_ = 0;
+};
+
+class roaring_bitmap_range
+  : public bit_range_base<roaring_bitmap_range, roaring_bitmap::block_type> {
+public:
+  using word_type = roaring_bitmap::word_type;
+
+  roaring_bitmap_range() = default;
+
+  explicit roaring_bitmap_range(roaring_bitmap const& bm);
+
+  void next();
+  bool done() const;
+
+private:
+  void scan();
+
+  roaring_bitmap const* bm_;
+  size_t container_ = 0;
+  roaring_bitmap::size_type next_ = 0; // The position of the next sequence.
+  bool done_ = true;
+};
+
+roaring_bitmap_range bit_range(roaring_bitmap const& bm);
+
+/// Applies a bitwise operation on two roaring bitmaps container by
+/// container, skipping chunks without 1-bits entirely.
+/// @param lhs The LHS of the operation.
+/// @param rhs The RHS of the operation
+/// @param op The bitwise operation.
+/// @param n The size of the result.
+/// @returns The first *n* bits of the result of *op* between *lhs* and *rhs*.
+/// @pre `apply(op, 0, 0) == 0`
+/// @relates binary_eval
+roaring_bitmap container_eval(roaring_bitmap const& lhs,
+                              roaring_bitmap const& rhs,
+                              detail::bitwise_operator op,
+                              roaring_bitmap::size_type n);
+
+/// Applies a bitwise operation on two roaring bitmaps. Operations that map
+/// two 0-bits to 0 evaluate container-wise, all others block-wise.
+/// @relates binary_eval
+template <bool FillLHS, bool FillRHS, class Operation>
+std::enable_if_t<detail::is_bitwise_operation<Operation>{}, roaring_bitmap>
+binary_eval(roaring_bitmap const& lhs, roaring_bitmap const& rhs,
+            Operation op) {
+  using word_type = roaring_bitmap::word_type;
+  if (op(word_type::none, word_type::none) != word_type::none)
+    return detail::block_eval<FillLHS, FillRHS>(lhs, rhs, op);
+  // Mirror the result size of the block-wise algorithm: if only one side
+  // fills up the result and it's the shorter one, the result ends at the
+  // first block boundary past the shorter side.
+  auto n = std::max(lhs.size(), rhs.size());
+  if (FillLHS != FillRHS) {
+    auto& filled = FillLHS ? lhs : rhs;
+    auto& other = FillLHS ? rhs : lhs;
+    if (filled.size() < other.size()) {
+      auto blocks = (filled.size() + word_type::width - 1) / word_type::width;
+      n = std::min(other.size(), blocks * word_type::width);
+    }
+  }
+  return container_eval(lhs, rhs, Operation::kind, n);
+}
+
+} // namespace vast
+
+#endif
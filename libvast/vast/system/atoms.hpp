@@ -23,9 +23,11 @@ using caf::subscribe_atom;
 using accept_atom = caf::atom_constant<caf::atom("accept")>;
 using announce_atom = caf::atom_constant<caf::atom("announce")>;
 using batch_atom = caf::atom_constant<caf::atom("batch")>;
+using cancel_atom = caf::atom_constant<caf::atom("cancel")>;
 using continuous_atom = caf::atom_constant<caf::atom("continuous")>;
 using cpu_atom = caf::atom_constant<caf::atom("cpu")>;
 using data_atom = caf::atom_constant<caf::atom("data")>;
+using deadline_atom = caf::atom_constant<caf::atom("deadline")>;
 using disable_atom = caf::atom_constant<caf::atom("disable")>;
 using disconnect_atom = caf::atom_constant<caf::atom("disconnect")>;
 using done_atom = caf::atom_constant<caf::atom("done")>;
@@ -43,10 +45,12 @@ using limit_atom = caf::atom_constant<caf::atom("limit")>;
 using link_atom = caf::atom_constant<caf::atom("link")>;
 using list_atom = caf::atom_constant<caf::atom("list")>;
 using load_atom = caf::atom_constant<caf::atom("load")>;
+using merge_atom = caf::atom_constant<caf::atom("merge")>;
 using peer_atom = caf::atom_constant<caf::atom("peer")>;
 using persist_atom = caf::atom_constant<caf::atom("persist")>;
 using ping_atom = caf::atom_constant<caf::atom("ping")>;
 using pong_atom = caf::atom_constant<caf::atom("pong")>;
+using prefetch_atom = caf::atom_constant<caf::atom("prefetch")>;
 using progress_atom = caf::atom_constant<caf::atom("progress")>;
 using prompt_atom = caf::atom_constant<caf::atom("prompt")>;
 using publish_atom = caf::atom_constant<caf::atom("publish")>;
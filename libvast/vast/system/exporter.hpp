@@ -2,6 +2,7 @@
 #define VAST_SYSTEM_EXPORTER_HPP
 
 #include <chrono>
+#include <cstdint>
 #include <deque>
 #include <memory>
 #include <unordered_map>
@@ -10,6 +11,7 @@
 #include "vast/bitmap.hpp"
 #include "vast/expression.hpp"
 #include "vast/query_options.hpp"
+#include "vast/time.hpp"
 #include "vast/uuid.hpp"
 
 #include "vast/system/accountant.hpp"
@@ -25,11 +27,17 @@ struct exporter_state {
   caf::actor sink;
   accountant_type accountant;
   bitmap hits;
-  bitmap unprocessed;
+  bitmap pending;     ///< Hits not yet forwarded to the archive.
+  bitmap unprocessed; ///< Hits forwarded to the archive.
+  uint64_t limit = 0; ///< The maximum number of results; 0 means unlimited.
+  timestamp deadline = timestamp::max(); ///< When the query expires.
   std::unordered_map<type, expression> checkers;
   std::deque<event> candidates;
   std::vector<event> results;
   std::chrono::steady_clock::time_point start;
+  std::chrono::steady_clock::time_point batch_start;
+  size_t batch = 0;                    ///< Partitions of the last request.
+  timespan latency = timespan::zero(); ///< Average latency per partition.
   query_statistics stats;
   uuid id;
   char const* name = "exporter";
@@ -37,7 +45,12 @@ struct exporter_state {
 
 /// The EXPORTER receives index hits, looks up the corresponding events in the
 /// archive, and performs a candidate check to select the resulting stream of
-/// matching events.
+/// matching events. It forwards only as many hits to the archive as it needs
+/// for the requested results, and terminates once it has shipped the number of
+/// results given by an optional `(limit_atom, uint64_t)` message. A
+/// `(deadline_atom, timespan)` message before running the query bounds its
+/// runtime, and `cancel_atom` aborts it. In both cases, the EXPORTER releases
+/// the lookup at the index and drops all hits it has not yet processed.
 /// @param self The actor handle.
 /// @param ast The AST of query.
 /// @param qos The query options.
@@ -1,25 +1,78 @@
 #ifndef VAST_INDEX_HPP
 #define VAST_INDEX_HPP
 
+#include <chrono>
+#include <deque>
+#include <memory>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
+#include <caf/response_promise.hpp>
 #include <caf/stateful_actor.hpp>
 
 #include "vast/bitmap.hpp"
 #include "vast/expression.hpp"
 #include "vast/filesystem.hpp"
+#include "vast/query_options.hpp"
 #include "vast/uuid.hpp"
 #include "vast/time.hpp"
 
 #include "vast/detail/flat_set.hpp"
 
+#include "vast/system/accountant.hpp"
+
 namespace vast {
 
 class event;
 
 namespace system {
 
-/// Maps events to horizontal partitions of the ::index.
+class predicate_cache;
+
+/// Determines when the INDEX seals the active partition and starts a new one.
+/// The INDEX seals a partition as soon as one of the enabled limits would be
+/// exceeded by the next batch.
+struct partition_policy {
+  /// The maximum number of events per partition. 0 disables the limit.
+  size_t max_events = 1 << 20;
+
+  /// The maximum number of bytes of event data per partition, based on the
+  /// approximate in-memory size of the events. 0 disables the limit.
+  size_t max_bytes = 0;
+
+  /// The length of the time windows that partitions cover. Windows are
+  /// aligned to multiples of the window length since the UNIX epoch and
+  /// apply to event timestamps. Late events, whose window lies before the
+  /// window of the active partition, go into the active partition. 0
+  /// disables time windows.
+  timespan window = timespan::zero();
+
+  /// Whether to merge adjacent sealed partitions in the background. The INDEX
+  /// combines runs of partitions that together hold at most `max_events`
+  /// events, so that the number of partitions follows the data volume rather
+  /// than the burstiness of ingestion. Requires `max_events > 0`.
+  bool merge = false;
+};
+
+/// Determines how the INDEX shares its in-memory partitions among concurrent
+/// lookups. Lookups that wait for partitions to load are served by weighted
+/// fair queuing, so that a lookup spanning many partitions cannot starve the
+/// others.
+struct scheduling_policy {
+  /// The maximum number of lookups with partitions left to dispatch. The INDEX
+  /// defers further lookups until one completes, admitting interactive
+  /// lookups before background lookups. 0 disables the limit.
+  size_t max_lookups = 0;
+
+  /// The number of partitions an interactive lookup may load for each
+  /// partition of a background lookup when both wait for memory.
+  size_t interactive_weight = 8;
+};
+
+/// Maps events to horizontal partitions of the ::index. The partitions are
+/// ordered by the beginning of their time range.
 class partition_index {
 public:
   /// A closed interval.
@@ -31,12 +84,23 @@ public:
   /// Per-partition summary statistics.
   struct partition_synopsis {
     interval range;
+    uint64_t events = 0;
   };
 
   /// Adds a set of events to the index for a given partition.
   void add(const std::vector<event> xs, const uuid& partition);
 
+  /// Replaces a set of partitions with a single one that holds their events,
+  /// e.g., after merging them.
+  /// @param xs The IDs of the partitions to replace.
+  /// @param y The ID of the partition that replaces *xs*.
+  void replace(const std::vector<uuid>& xs, const uuid& y);
+
+  /// Retrieves all partitions in chronological order.
+  const std::vector<std::pair<uuid, partition_synopsis>>& partitions() const;
+
   /// Retrieves the list of partition IDs for a given expression.
+  /// @returns The IDs of the qualifying partitions in chronological order.
   std::vector<uuid> lookup(const expression& expr) const;
 
   template <class Inspector>
@@ -46,7 +110,7 @@ public:
 
   template <class Inspector>
   friend auto inspect(Inspector& f, partition_synopsis& ps) {
-    return f(ps.range);
+    return f(ps.range, ps.events);
   }
 
   template <class Inspector>
@@ -55,47 +119,97 @@ public:
   }
 
 private:
-  std::unordered_map<uuid, partition_synopsis> partitions_;
+  std::vector<std::pair<uuid, partition_synopsis>> partitions_;
 };
 
 struct active_partition_state {
   uuid id;
   caf::actor partition;
   size_t events = 0;
+  size_t bytes = 0;
+  timestamp window;
 };
 
 struct scheduled_partition_state {
   uuid id;
   detail::flat_set<uuid> lookups;
+  std::chrono::steady_clock::time_point queued;
 };
 
 struct lookup_state {
   expression expr;
   caf::actor sink;
   std::vector<uuid> partitions;
+  timestamp deadline = timestamp::max(); ///< When the lookup expires.
+  size_t weight = 1;                     ///< The share under contention.
+  double vtime = 0;                      ///< The virtual time of the lookup.
+  timespan waited = timespan::zero();    ///< The time spent in queues.
+};
+
+/// A merge of sealed partitions in progress.
+struct merge_state {
+  uuid id;                 ///< The ID of the merged partition.
+  std::vector<uuid> parts; ///< The partitions to merge.
+  bool done = false;       ///< Whether the merged partition exists on disk.
+};
+
+/// A lookup that waits for admission.
+struct pending_lookup_state {
+  expression expr;
+  timestamp deadline;
+  query_options options;
+  caf::actor sink;
+  caf::response_promise promise;
+  std::chrono::steady_clock::time_point arrived;
 };
 
 struct index_state {
   partition_index part_index;
   active_partition_state active;
   std::unordered_map<uuid, caf::actor> loaded;
+  std::unordered_set<uuid> prefetched;
   std::unordered_map<caf::actor, uuid> evicted;
   std::deque<scheduled_partition_state> scheduled;
   std::unordered_map<uuid, lookup_state> lookups;
+  std::deque<pending_lookup_state> admission;
+  merge_state merging;
+  std::unordered_set<uuid> unmergeable;
+  std::vector<uuid> retired; ///< Merged partitions that await deletion.
+  partition_policy policy;
+  scheduling_policy scheduling;
+  double vtime = 0; ///< The virtual time of the last dispatch.
+  accountant_type accountant;
+  std::shared_ptr<predicate_cache> cache;
   size_t capacity;
+  size_t taste;
+  size_t prefetch;
   path dir;
   char const* name = "index";
 };
 
-/// Indexes events in horizontal partitions.
+/// Indexes events in horizontal partitions. A lookup ends when its sink
+/// terminates, sends `(cancel_atom, uuid)`, or exceeds the deadline that came
+/// with the expression. The INDEX then drops all queued partition loads of the
+/// lookup and no longer dispatches it. Lookups with the `background` query
+/// option yield to interactive lookups. If the partition policy enables
+/// merging, the INDEX combines small sealed partitions in the background and
+/// swaps the result into its partition index as soon as the merge completes.
+/// It deletes the original partitions once no lookup refers to them anymore.
 /// @param dir The directory of the index.
-/// @param max_events The maximum number of events per partition.
+/// @param policy The policy that determines when to seal partitions.
 /// @param max_parts The maximum number of partitions to hold in memory.
 /// @param taste_parts The number of partitions to schedule immediately for
-///                    each query
-/// @pre `max_events > 0 && max_parts > 0`
+///                    each query, and to prefetch ahead of each request for
+///                    more partitions
+/// @param cache_size The maximum number of predicate results of sealed
+///                   partitions to cache. 0 disables the cache.
+/// @param scheduling The policy that determines how concurrent lookups share
+///                   the in-memory partitions.
+/// @pre `max_parts > 0`
 caf::behavior index(caf::stateful_actor<index_state>* self, const path& dir,
-                    size_t max_events, size_t max_parts, size_t taste_parts);
+                    partition_policy policy, size_t max_parts,
+                    size_t taste_parts, size_t cache_size,
+                    scheduling_policy scheduling);
 
 } // namespace system
 } // namespace vast
@@ -1,29 +1,117 @@
 #ifndef VAST_SYSTEM_INDEXER_HPP
 #define VAST_SYSTEM_INDEXER_HPP
 
+#include <cstdint>
+#include <memory>
 #include <unordered_map>
+#include <vector>
 
 #include <caf/stateful_actor.hpp>
 
+#include "vast/bitmap.hpp"
+#include "vast/expected.hpp"
 #include "vast/filesystem.hpp"
+#include "vast/offset.hpp"
+#include "vast/operator.hpp"
 #include "vast/type.hpp"
+#include "vast/value_index.hpp"
 
 namespace vast {
+
+class event;
+class packfile;
+
 namespace system {
 
+class predicate_cache;
+
+/// Wraps a value index that covers one aspect of an event: a meta data
+/// attribute, the data of a non-record event, or a field of a record event.
+class column_index {
+public:
+  /// The aspect of an event that a column indexes.
+  enum kind_type {
+    time_column,
+    data_column,
+  };
+
+  /// Constructs a column.
+  /// @param kind The aspect of the event to index.
+  /// @param filename The location of the persistent state.
+  /// @param index_type The type of the value index.
+  /// @param off The offset of a record field for data columns.
+  column_index(kind_type kind, path filename, type index_type,
+               offset off = {});
+
+  /// Materializes the value index from persistent state or creates a new one.
+  /// @param pack The packfile to look for persistent state, or `nullptr`.
+  expected<void> init(packfile const* pack);
+
+  /// Indexes the relevant aspect of an event.
+  /// @param e The event to index.
+  expected<void> add(event const& e);
+
+  /// Looks up data under a relational operator.
+  /// @see value_index::lookup
+  expected<bitmap> lookup(relational_operator op, data const& x) const;
+
+  /// Retrieves the IDs of all events added to this column.
+  bitmap ids() const;
+
+  /// Merges the value index of another column for the same aspect of an
+  /// event, whose IDs follow the ones of this column.
+  /// @param other The column to merge.
+  /// @see value_index::merge
+  expected<void> merge(column_index const& other);
+
+  /// Writes the value index to the file system if it has new state.
+  expected<void> flush();
+
+  /// Retrieves the location of the persistent state.
+  path const& filename() const;
+
+private:
+  kind_type kind_;
+  path filename_;
+  type type_;
+  offset offset_;
+  std::unique_ptr<value_index> idx_;
+  value_index::size_type last_flush_ = 0;
+};
+
+/// Creates the (uninitialized) columns for an event type.
+/// @param dir The directory of the event indexer.
+/// @param event_type The type of the events to index.
+/// @returns The time column, followed by one data column per indexed field.
+std::vector<column_index> make_columns(path const& dir,
+                                       type const& event_type);
+
 struct event_indexer_state {
   path dir;
   type event_type;
-  std::unordered_map<path, caf::actor> indexers;
+  std::shared_ptr<packfile const> pack;
+  std::shared_ptr<predicate_cache> cache;
+  std::unordered_map<path, column_index> columns;
+  uint64_t cache_hits = 0;
+  uint64_t cache_misses = 0;
+  uint64_t shared_predicates = 0;
   const char* name = "event-indexer";
 };
 
-/// Indexes an event.
+/// Indexes an event. The indexer holds one value index per column in-process
+/// and evaluates entire expressions synchronously against them. For a batch
+/// of expressions, it looks up each distinct predicate only once.
 /// @param self The actor handle.
 /// @param dir The directory where to store the indexes in.
 /// @param type event_type The type of the event to index.
+/// @param pack The packfile of a sealed partition to load indexes from, or
+///             `nullptr` if the indexes reside in *dir*.
+/// @param cache The cache for predicate results of sealed partitions, or
+///              `nullptr` to disable caching.
 caf::behavior event_indexer(caf::stateful_actor<event_indexer_state>* self,
-                            path dir, type event_type);
+                            path dir, type event_type,
+                            std::shared_ptr<packfile const> pack,
+                            std::shared_ptr<predicate_cache> cache);
 
 } // namespace system
 } // namespace vast
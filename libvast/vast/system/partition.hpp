@@ -1,27 +1,66 @@
 #ifndef VAST_SYSTEM_PARTITION_HPP
 #define VAST_SYSTEM_PARTITION_HPP
 
+#include <chrono>
+#include <memory>
 #include <unordered_map>
+#include <vector>
 
 #include <caf/stateful_actor.hpp>
+#include <caf/typed_response_promise.hpp>
 
 #include "vast/aliases.hpp"
+#include "vast/bitmap.hpp"
+#include "vast/expected.hpp"
+#include "vast/expression.hpp"
 #include "vast/filesystem.hpp"
+#include "vast/time.hpp"
 #include "vast/type.hpp"
 
 namespace vast {
+
+class packfile;
+
 namespace system {
 
+class predicate_cache;
+
+/// An expression that waits for evaluation in the next batch.
+struct pending_query {
+  expression expr;
+  timestamp deadline;
+  caf::typed_response_promise<bitmap> promise;
+  std::chrono::steady_clock::time_point start;
+};
+
 struct partition_state {
   std::unordered_map<type, caf::actor> indexers;
+  std::shared_ptr<packfile const> pack;
+  std::vector<pending_query> pending;
   const char* name = "partition";
 };
 
 /// A horizontal partition of the INDEX.
 /// For each event batch, PARTITION spawns one event indexer per
-/// type occurring in the batch and forwards to them the events.
+/// type occurring in the batch and forwards to them the events. Upon
+/// shutdown, PARTITION seals its state into a single packfile.
+/// PARTITION evaluates all queries that arrive while it is busy as a single
+/// batch, so that the INDEXERs look up predicates common to multiple queries
+/// only once.
 /// @param dir The directory where to store this partition on the file system.
-caf::behavior partition(caf::stateful_actor<partition_state>* self, path dir);
+/// @param cache The cache for predicate results of the INDEXERs, or `nullptr`
+///              to disable caching.
+caf::behavior partition(caf::stateful_actor<partition_state>* self, path dir,
+                        std::shared_ptr<predicate_cache> cache);
+
+/// Merges sealed partitions into a single sealed partition. The partitions
+/// must cover disjoint ranges of event IDs, but can appear in any order.
+/// The function leaves the input partitions untouched.
+/// @param dir The directory of the merged partition, which must not exist.
+/// @param parts The directories of the sealed partitions to merge.
+/// @returns An error if reading, merging, or writing fails.
+expected<void> merge_partitions(path const& dir,
+                                std::vector<path> const& parts);
 
 } // namespace system
 } // namespace vast
@@ -0,0 +1,98 @@
+#ifndef VAST_SYSTEM_PREDICATE_CACHE_HPP
+#define VAST_SYSTEM_PREDICATE_CACHE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+
+#include "vast/bitmap.hpp"
+#include "vast/expression.hpp"
+#include "vast/filesystem.hpp"
+#include "vast/optional.hpp"
+
+#include "vast/detail/cache.hpp"
+
+namespace vast {
+namespace system {
+
+/// Identifies a cached lookup result.
+struct predicate_cache_key {
+  path dir;       ///< The directory of the INDEXER that computed the result.
+  predicate pred; ///< The resolved predicate.
+
+  friend bool operator==(predicate_cache_key const& x,
+                         predicate_cache_key const& y) {
+    return x.dir == y.dir && x.pred == y.pred;
+  }
+};
+
+} // namespace system
+} // namespace vast
+
+namespace std {
+
+template <>
+struct hash<vast::system::predicate_cache_key> {
+  size_t operator()(vast::system::predicate_cache_key const& x) const {
+    auto h = hash<vast::path>{}(x.dir);
+    h ^= hash<vast::predicate>{}(x.pred) + 0x9e3779b9 + (h << 6) + (h >> 2);
+    return h;
+  }
+};
+
+} // namespace std
+
+namespace vast {
+namespace system {
+
+/// A bounded LRU cache of predicate lookup results in sealed partitions.
+/// Since sealed partitions are immutable, a result remains valid until its
+/// partition changes. All INDEXERs of an INDEX share one cache, so all member
+/// functions are thread-safe.
+class predicate_cache {
+public:
+  /// Constructs a cache.
+  /// @param capacity The maximum number of results to keep.
+  /// @pre `capacity > 0`
+  explicit predicate_cache(size_t capacity);
+
+  /// Retrieves a cached result.
+  /// @param dir The directory of the INDEXER.
+  /// @param pred The resolved predicate.
+  /// @returns The cached result or `nil` on a cache miss.
+  optional<bitmap> lookup(path const& dir, predicate const& pred);
+
+  /// Adds a result to the cache, evicting the least recently used entry if
+  /// the cache is full.
+  /// @param dir The directory of the INDEXER.
+  /// @param pred The resolved predicate.
+  /// @param bm The result of *pred*.
+  void add(path dir, predicate pred, bitmap bm);
+
+  /// Removes all results of INDEXERs at or below a directory, e.g., when a
+  /// partition changes.
+  /// @param dir The directory of an INDEXER or partition.
+  /// @returns The number of removed results.
+  size_t invalidate(path const& dir);
+
+  /// Retrieves the number of cache hits since construction.
+  uint64_t hits() const;
+
+  /// Retrieves the number of cache misses since construction.
+  uint64_t misses() const;
+
+  /// Retrieves the number of cached results.
+  size_t size() const;
+
+private:
+  mutable std::mutex mutex_;
+  detail::cache<predicate_cache_key, bitmap> cache_;
+  uint64_t hits_ = 0;
+  uint64_t misses_ = 0;
+};
+
+} // namespace system
+} // namespace vast
+
+#endif
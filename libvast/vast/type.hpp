@@ -485,6 +485,12 @@ bool is_recursive(const type& t);
 /// @returns `true` iff *t* is a container type.
 bool is_container(const type& t);
 
+/// Checks whether a type has an attribute with a given key.
+/// @param t The type to check.
+/// @param key The key of the attribute.
+/// @returns `true` iff *t* has an attribute with key *key*.
+bool has_attribute(const type& t, const std::string& key);
+
 /// Checks whether two types are *congruent* to each other, i.e., whether they
 /// are *representationally equal*.
 /// @param x The first type.
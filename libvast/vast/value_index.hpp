@@ -4,6 +4,7 @@
 #include <algorithm>
 #include <memory>
 #include <type_traits>
+#include <vector>
 
 #include "vast/ewah_bitmap.hpp"
 #include "vast/bitmap.hpp"
@@ -44,21 +45,34 @@ public:
 
   /// Looks up data under a relational operator. If the value to look up is
   /// `nil`, only `==` and `!=` are valid operations. The concrete index
-  /// type determines validity of other values.
+  /// type determines validity of other values. Lookups do not modify the
+  /// index, so that multiple threads can look up values in an index
+  /// concurrently once it no longer receives new values.
   /// @param op The relation operator.
   /// @param x The value to lookup.
   /// @returns The result of the lookup or an error upon failure.
   expected<bitmap> lookup(relational_operator op, data const& x) const;
 
-  /// Merges another value index with this one.
+  /// Merges another value index of the same type into this one. The other
+  /// index must not contain IDs below `offset()`, e.g., because it indexes
+  /// the events of a subsequent partition.
   /// @param other The value index to merge.
-  /// @returns `true` on success.
-  //bool merge(value_index const& other);
+  /// @returns An error if the indexes have different types or overlap.
+  expected<void> merge(value_index const& other);
+
+  /// Switches all bitmaps of the index to the representation requiring the
+  /// least space. This makes sense once the index receives no more values,
+  /// e.g., when sealing its partition.
+  /// @see bitmap::optimize
+  void optimize();
 
   /// Retrieves the ID of the last ::push_back operation.
   /// @returns The largest ID in the index.
   size_type offset() const;
 
+  /// Retrieves the IDs of all appended values, including `nil`.
+  ewah_bitmap const& mask() const;
+
   template <class Inspector>
   friend auto inspect(Inspector& f, value_index& vi) {
     return f(vi.mask_, vi.none_);
@@ -73,13 +87,26 @@ private:
   virtual expected<bitmap>
   lookup_impl(relational_operator op, data const& x) const = 0;
 
+  virtual bool merge_impl(value_index const& other) = 0;
+
+  virtual void optimize_impl() = 0;
+
   size_type nils_ = 0;
   ewah_bitmap mask_;
   ewah_bitmap none_;
 };
 
+/// Checks whether a type selects bit-sliced encoding for its index, i.e.,
+/// whether it has the attribute `index=bitslice`. The attribute takes effect
+/// for `count`, `integer`, `timespan`, and `port` types.
+/// @param t The type to check.
+bool uses_bitslice_encoding(type const& t);
+
 /// An index for arithmetic values.
-template <class T, class Binner = void>
+/// @tparam T The value type.
+/// @tparam Binner The binning policy, or `void` to choose one based on *T*.
+/// @tparam Coder The coding policy, or `void` to choose one based on *T*.
+template <class T, class Binner = void, class Coder = void>
 class arithmetic_index : public value_index {
 public:
   using value_type =
@@ -101,9 +128,13 @@ public:
 
   using coder_type =
     std::conditional_t<
-      std::is_same<T, boolean>{},
-      singleton_coder<bitmap>,
-      multi_level_coder<range_coder<bitmap>>
+      !std::is_void<Coder>{},
+      Coder,
+      std::conditional_t<
+        std::is_same<T, boolean>{},
+        singleton_coder<bitmap>,
+        multi_level_coder<range_coder<bitmap>>
+      >
     >;
 
   using binner_type =
@@ -209,9 +240,79 @@ private:
     return visit(searcher{bmi_, op}, x);
   };
 
+  bool merge_impl(value_index const& other) override {
+    bmi_.merge(static_cast<arithmetic_index const&>(other).bmi_);
+    return true;
+  }
+
+  void optimize_impl() override {
+    bmi_.optimize();
+  }
+
   bitmap_index_type bmi_;
 };
 
+/// An arithmetic index with bit-sliced encoding. Each component of a value
+/// takes only one bitmap per bit, which keeps the index of high-cardinality
+/// values small, and range lookups combine the slices in a single pass.
+template <class T, class Binner = void>
+using bitslice_index =
+  arithmetic_index<T, Binner, multi_level_coder<bitslice_coder<bitmap>>>;
+
+/// An exact index for timestamps. Since event timestamps arrive nearly
+/// sorted, the index stores the raw nanosecond values in ID order and
+/// partitions them into fixed-size blocks, each of which carries a zone map
+/// (minimum, maximum, and whether the block is sorted). A lookup resolves
+/// entire blocks from their zone map, uses binary search within sorted blocks,
+/// and scans only unsorted blocks that straddle the queried value. Unlike an
+/// `arithmetic_index<timestamp>`, the result contains no false positives.
+class time_index : public value_index {
+public:
+  using value_type = timespan::rep;
+
+  /// The number of values per zone.
+  static constexpr size_t block_size = 1024;
+
+  /// Summarizes a block of values.
+  struct zone {
+    value_type min;
+    value_type max;
+    bool sorted;
+
+    template <class Inspector>
+    friend auto inspect(Inspector& f, zone& x) {
+      return f(x.min, x.max, x.sorted);
+    }
+  };
+
+  /// Checks whether a timestamp type selects a time index, i.e., whether it
+  /// has the attribute `index=time`.
+  /// @param t The type to check.
+  static bool applies(timestamp_type const& t);
+
+  time_index() = default;
+
+  template <class Inspector>
+  friend auto inspect(Inspector& f, time_index& idx) {
+    return f(static_cast<value_index&>(idx), idx.values_, idx.zones_);
+  }
+
+private:
+  void append(value_type x);
+
+  bool push_back_impl(data const& x, size_type skip) override;
+
+  expected<bitmap>
+  lookup_impl(relational_operator op, data const& x) const override;
+
+  bool merge_impl(value_index const& other) override;
+
+  void optimize_impl() override;
+
+  std::vector<value_type> values_;
+  std::vector<zone> zones_;
+};
+
 /// An index for strings.
 class string_index : public value_index {
 public:
@@ -227,7 +328,7 @@ public:
 
 private:
   /// The index which holds each character.
-  using char_bitmap_index = bitmap_index<uint8_t, bitslice_coder<ewah_bitmap>>;
+  using char_bitmap_index = bitmap_index<uint8_t, bitslice_coder<bitmap>>;
 
   /// The index which holds the string length.
   using length_bitmap_index =
@@ -240,6 +341,10 @@ private:
   expected<bitmap>
   lookup_impl(relational_operator op, data const& x) const override;
 
+  bool merge_impl(value_index const& other) override;
+
+  void optimize_impl() override;
+
   size_t max_length_;
   length_bitmap_index length_;
   std::vector<char_bitmap_index> chars_;
@@ -248,8 +353,8 @@ private:
 /// An index for IP addresses.
 class address_index : public value_index {
 public:
-  using byte_index = bitmap_index<uint8_t, bitslice_coder<ewah_bitmap>>;
-  using type_index = bitmap_index<bool, singleton_coder<ewah_bitmap>>;
+  using byte_index = bitmap_index<uint8_t, bitslice_coder<bitmap>>;
+  using type_index = bitmap_index<bool, singleton_coder<bitmap>>;
 
   address_index() = default;
 
@@ -266,6 +371,10 @@ private:
   expected<bitmap>
   lookup_impl(relational_operator op, data const& x) const override;
 
+  bool merge_impl(value_index const& other) override;
+
+  void optimize_impl() override;
+
   std::array<byte_index, 16> bytes_;
   type_index v4_;
 };
@@ -273,7 +382,7 @@ private:
 /// An index for subnets.
 class subnet_index : public value_index {
 public:
-  using prefix_index = bitmap_index<uint8_t, equality_coder<ewah_bitmap>>;
+  using prefix_index = bitmap_index<uint8_t, equality_coder<bitmap>>;
 
   subnet_index() = default;
 
@@ -290,29 +399,31 @@ private:
   expected<bitmap>
   lookup_impl(relational_operator op, data const& x) const override;
 
+  bool merge_impl(value_index const& other) override;
+
+  void optimize_impl() override;
+
   address_index network_;
   prefix_index length_;
 };
 
 /// An index for ports.
-class port_index : public value_index {
+/// @tparam NumberCoder The coding policy for the port number.
+template <class NumberCoder>
+class basic_port_index : public value_index {
 public:
-  using number_index =
-    bitmap_index<
-      port::number_type,
-      multi_level_coder<range_coder<ewah_bitmap>>
-    >;
+  using number_index = bitmap_index<port::number_type, NumberCoder>;
 
   using protocol_index =
     bitmap_index<
       std::underlying_type<port::port_type>::type,
-      equality_coder<ewah_bitmap>
+      equality_coder<bitmap>
     >;
 
-  port_index() = default;
+  basic_port_index() = default;
 
   template <class Inspector>
-  friend auto inspect(Inspector& f, port_index& idx) {
+  friend auto inspect(Inspector& f, basic_port_index& idx) {
     return f(static_cast<value_index&>(idx), idx.num_, idx.proto_);
   }
 
@@ -324,10 +435,20 @@ private:
   expected<bitmap>
   lookup_impl(relational_operator op, data const& x) const override;
 
+  bool merge_impl(value_index const& other) override;
+
+  void optimize_impl() override;
+
   number_index num_;
   protocol_index proto_;
 };
 
+using port_index = basic_port_index<multi_level_coder<range_coder<bitmap>>>;
+
+/// A port index with a bit-sliced encoding of the port number.
+using bitslice_port_index =
+  basic_port_index<multi_level_coder<bitslice_coder<bitmap>>>;
+
 /// An index for vectors and sets.
 class sequence_index : public value_index {
 public:
@@ -374,6 +495,10 @@ private:
   expected<bitmap>
   lookup_impl(relational_operator op, data const& x) const override;
 
+  bool merge_impl(value_index const& other) override;
+
+  void optimize_impl() override;
+
   std::vector<std::unique_ptr<value_index>> elements_;
   size_bitmap_index size_;
   size_t max_size_;
@@ -403,11 +528,15 @@ struct value_index_inspect_helper {
       return f_(static_cast<arithmetic_index<boolean>&>(idx_));
     }
 
-    result_type operator()(integer_type const&) const {
+    result_type operator()(integer_type const& t) const {
+      if (uses_bitslice_encoding(t))
+        return f_(static_cast<bitslice_index<integer>&>(idx_));
       return f_(static_cast<arithmetic_index<integer>&>(idx_));
     }
 
-    result_type operator()(count_type const&) const {
+    result_type operator()(count_type const& t) const {
+      if (uses_bitslice_encoding(t))
+        return f_(static_cast<bitslice_index<count>&>(idx_));
       return f_(static_cast<arithmetic_index<count>&>(idx_));
     }
 
@@ -415,11 +544,15 @@ struct value_index_inspect_helper {
       return f_(static_cast<arithmetic_index<real>&>(idx_));
     }
 
-    result_type operator()(timespan_type const&) const {
+    result_type operator()(timespan_type const& t) const {
+      if (uses_bitslice_encoding(t))
+        return f_(static_cast<bitslice_index<timespan>&>(idx_));
       return f_(static_cast<arithmetic_index<timespan>&>(idx_));
     }
 
-    result_type operator()(timestamp_type const&) const {
+    result_type operator()(timestamp_type const& t) const {
+      if (time_index::applies(t))
+        return f_(static_cast<time_index&>(idx_));
       return f_(static_cast<arithmetic_index<timestamp>&>(idx_));
     }
 
@@ -435,7 +568,9 @@ struct value_index_inspect_helper {
       return f_(static_cast<subnet_index&>(idx_));
     }
 
-    result_type operator()(port_type const&) const {
+    result_type operator()(port_type const& t) const {
+      if (uses_bitslice_encoding(t))
+        return f_(static_cast<bitslice_port_index&>(idx_));
       return f_(static_cast<port_index&>(idx_));
     }
 
@@ -467,11 +602,15 @@ struct value_index_inspect_helper {
       return std::make_unique<arithmetic_index<boolean>>();
     }
 
-    result_type operator()(integer_type const&) const {
+    result_type operator()(integer_type const& t) const {
+      if (uses_bitslice_encoding(t))
+        return std::make_unique<bitslice_index<integer>>();
       return std::make_unique<arithmetic_index<integer>>();
     }
 
-    result_type operator()(count_type const&) const {
+    result_type operator()(count_type const& t) const {
+      if (uses_bitslice_encoding(t))
+        return std::make_unique<bitslice_index<count>>();
       return std::make_unique<arithmetic_index<count>>();
     }
 
@@ -479,11 +618,15 @@ struct value_index_inspect_helper {
       return std::make_unique<arithmetic_index<real>>();
     }
 
-    result_type operator()(timespan_type const&) const {
+    result_type operator()(timespan_type const& t) const {
+      if (uses_bitslice_encoding(t))
+        return std::make_unique<bitslice_index<timespan>>();
       return std::make_unique<arithmetic_index<timespan>>();
     }
 
-    result_type operator()(timestamp_type const&) const {
+    result_type operator()(timestamp_type const& t) const {
+      if (time_index::applies(t))
+        return std::make_unique<time_index>();
       return std::make_unique<arithmetic_index<timestamp>>();
     }
 
@@ -499,7 +642,9 @@ struct value_index_inspect_helper {
       return std::make_unique<subnet_index>();
     }
 
-    result_type operator()(port_type const&) const {
+    result_type operator()(port_type const& t) const {
+      if (uses_bitslice_encoding(t))
+        return std::make_unique<bitslice_port_index>();
       return std::make_unique<port_index>();
     }
 